@@ -1,6 +1,7 @@
 #include "allocations_checker.h"
 
 #include <atomic>
+#include <cstddef>
 #include <new>
 #include <stdexcept>
 
@@ -14,6 +15,7 @@
 #endif
 
 std::atomic<size_t> allocations_count{0}, deallocations_count{0};
+std::atomic<size_t> allocated_bytes{0}, live_bytes{0}, peak_live_bytes{0};
 
 namespace alloc_checker {
 
@@ -25,22 +27,50 @@ size_t DeallocCount() {
     return deallocations_count.load();
 }
 
+size_t AllocatedBytes() {
+    return allocated_bytes.load();
+}
+
+size_t LiveBytes() {
+    return live_bytes.load();
+}
+
+size_t PeakLiveBytes() {
+    return peak_live_bytes.load();
+}
+
+void ResetPeakLiveBytes() {
+    peak_live_bytes.store(live_bytes.load());
+}
+
 void ResetCounters() {
     allocations_count.store(0);
     deallocations_count.store(0);
+    allocated_bytes.store(0);
+    ResetPeakLiveBytes();
 }
 
 }  // namespace alloc_checker
 
-void MallocHook(const volatile void*, size_t) {
+void MallocHook(const volatile void*, size_t size) {
     allocations_count.fetch_add(1);
+    allocated_bytes.fetch_add(size);
+    const size_t live = live_bytes.fetch_add(size) + size;
+    size_t peak = peak_live_bytes.load();
+    while (peak < live && !peak_live_bytes.compare_exchange_weak(peak, live)) {
+    }
 }
 
-void FreeHook(const volatile void*) {
+void FreeHook(const volatile void*, size_t size) {
     deallocations_count.fetch_add(1);
+    live_bytes.fetch_sub(size);
 }
 
 #ifdef HAS_SANITIZER
+void FreeHook(const volatile void* p) {
+    FreeHook(p, __sanitizer_get_allocated_size(const_cast<const void*>(p)));
+}
+
 [[maybe_unused]] const auto kInit = [] {
     int res = __sanitizer_install_malloc_and_free_hooks(MallocHook, FreeHook);
     if (res == 0) {
@@ -49,47 +79,75 @@ void FreeHook(const volatile void*) {
     return 0;
 }();
 #else
-void* operator new(size_t size) {
-    void* p = malloc(size);
+// Without sanitizers there is no way to ask malloc for the size of a block, so
+// every block starts with a header holding the requested size.
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+
+void* Allocate(size_t size) noexcept {
+    auto* header = static_cast<char*>(malloc(size + kHeaderSize));
+    if (header == nullptr) {
+        return nullptr;
+    }
+    *reinterpret_cast<size_t*>(header) = size;
+    void* p = header + kHeaderSize;
     MallocHook(p, size);
     return p;
 }
 
-void* operator new(size_t size, const std::nothrow_t&) noexcept {
-    void* p = malloc(size);
-    MallocHook(p, size);
+void Deallocate(void* p) noexcept {
+    if (p == nullptr) {
+        return;
+    }
+    auto* header = static_cast<char*>(p) - kHeaderSize;
+    FreeHook(p, *reinterpret_cast<size_t*>(header));
+    free(header);
+}
+
+void* operator new(size_t size) {
+    void* p = Allocate(size);
+    if (p == nullptr) {
+        throw std::bad_alloc{};
+    }
     return p;
 }
 
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return Allocate(size);
+}
+
 void* operator new[] (size_t size) {
-    void* p = malloc(size);
-    MallocHook(p, size);
+    void* p = Allocate(size);
+    if (p == nullptr) {
+        throw std::bad_alloc{};
+    }
     return p;
 }
 
 void* operator new[] (size_t size, const std::nothrow_t&) noexcept {
-    void* p = malloc(size);
-    MallocHook(p, size);
-    return p;
+    return Allocate(size);
 }
 
 void operator delete(void* p) noexcept {
-    FreeHook(p);
-    free(p);
+    Deallocate(p);
 }
 
 void operator delete(void* p, size_t) noexcept {
-    FreeHook(p);
-    free(p);
+    Deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    Deallocate(p);
 }
 
 void operator delete[] (void* p) noexcept {
-    FreeHook(p);
-    free(p);
+    Deallocate(p);
 }
 
 void operator delete[] (void* p, size_t) noexcept {
-    FreeHook(p);
-    free(p);
+    Deallocate(p);
+}
+
+void operator delete[] (void* p, const std::nothrow_t&) noexcept {
+    Deallocate(p);
 }
 #endif
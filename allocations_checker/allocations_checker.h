@@ -8,6 +8,19 @@ std::size_t AllocCount();
 
 std::size_t DeallocCount();
 
+// Bytes requested by all allocations so far.
+std::size_t AllocatedBytes();
+
+// Bytes allocated and not yet freed, and the maximum it has reached.
+std::size_t LiveBytes();
+
+std::size_t PeakLiveBytes();
+
+// Starts tracking the maximum again from the current LiveBytes().
+void ResetPeakLiveBytes();
+
+// Zeroes the counters and AllocatedBytes() and resets the peak. LiveBytes()
+// is left as is: the memory is still in use.
 void ResetCounters();
 
 }  // namespace alloc_checker
@@ -32,3 +45,20 @@ void ResetCounters();
         X;                                                 \
         REQUIRE(alloc_checker::AllocCount() <= __xxx + 1); \
     } while (0)
+
+// |limit| bounds the bytes X had in use at its worst moment, on top of what was
+// already live before it.
+#define EXPECT_PEAK_BYTES_BELOW(X, limit)                           \
+    do {                                                            \
+        alloc_checker::ResetPeakLiveBytes();                        \
+        auto __live = alloc_checker::LiveBytes();                   \
+        X;                                                          \
+        REQUIRE(alloc_checker::PeakLiveBytes() - __live < (limit)); \
+    } while (0)
+
+#define EXPECT_ALLOCATED_BYTES_BELOW(X, limit)                      \
+    do {                                                            \
+        auto __xxx = alloc_checker::AllocatedBytes();               \
+        X;                                                          \
+        REQUIRE(alloc_checker::AllocatedBytes() - __xxx < (limit)); \
+    } while (0)
@@ -0,0 +1,39 @@
+#include "bench_commons.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef HSE_TASK_DIR
+#define HSE_TASK_DIR "./"
+#endif
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin.is_open()) {
+        throw std::invalid_argument("Cannot open a file " + path);
+    }
+    std::stringstream ss;
+    ss << fin.rdbuf();
+    return ss.str();
+}
+
+std::string ReadTestImage(const std::string& name) {
+    return ReadFile(std::string(HSE_TASK_DIR) + "tests/" + name + ".jpg");
+}
+
+std::vector<BenchImage> LoadTestImages() {
+    const std::filesystem::path tests_dir = std::string(HSE_TASK_DIR) + "tests";
+    std::vector<BenchImage> images;
+    for (const auto& entry : std::filesystem::directory_iterator(tests_dir)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".jpg") {
+            continue;
+        }
+        images.push_back({entry.path().stem().string(), ReadFile(entry.path().string())});
+    }
+    std::sort(images.begin(), images.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.name < rhs.name; });
+    return images;
+}
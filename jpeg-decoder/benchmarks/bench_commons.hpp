@@ -0,0 +1,29 @@
+#pragma once
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Image from tests/, loaded into memory once so that benchmarks measure decoding only.
+struct BenchImage {
+    std::string name;
+    std::string data;
+};
+
+// Every tests/*.jpg (bad/ is not included), sorted by name.
+std::vector<BenchImage> LoadTestImages();
+
+std::string ReadFile(const std::string& path);
+
+// Contents of tests/<name>.jpg.
+std::string ReadTestImage(const std::string& name);
+
+// Read-only view of a memory buffer as a streambuf, so Decode can be fed
+// from memory without copying the file into a stringstream on each iteration.
+class MemoryBuf : public std::streambuf {
+public:
+    explicit MemoryBuf(const std::string& data) {
+        char* begin = const_cast<char*>(data.data());  // NOLINT
+        setg(begin, begin, begin + data.size());
+    }
+};
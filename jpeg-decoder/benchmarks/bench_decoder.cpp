@@ -0,0 +1,82 @@
+// End-to-end decoding throughput on tests/*.jpg.
+//
+// The same source is built once per decoder (bench_decoder_baseline and
+// bench_decoder_faster), because both libraries define Decode(). Each binary
+// also runs libjpeg on the same inputs, so the numbers are comparable across
+// builds and machines. `make bench_decoder` runs both and writes JSON reports.
+// Where perf_event_open is allowed, hardware counters per pixel are reported too.
+
+#include <decoder.h>
+#include <image.h>
+#include <libjpg_reader.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_commons.hpp"
+#include "perf_counters.hpp"
+
+#include <exception>
+#include <istream>
+#include <string>
+
+#ifndef DECODER_NAME
+#define DECODER_NAME "decoder"
+#endif
+
+namespace {
+
+void BM_Decode(benchmark::State& state, const BenchImage* image) {
+    size_t pixels = 0;
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        MemoryBuf buf(image->data);
+        std::istream input(&buf);
+        try {
+            auto result = Decode(input);
+            pixels = result.Width() * result.Height();
+            benchmark::DoNotOptimize(result);
+        } catch (const std::exception& e) {
+            state.SkipWithError(e.what());
+            return;
+        }
+    }
+    perf_counters.Stop();
+    SetThroughputCounters(state, image->data.size(), pixels);
+    ReportPerfCounters(state, perf_counters, pixels, "px");
+}
+
+void BM_DecodeLibjpeg(benchmark::State& state, const BenchImage* image) {
+    size_t pixels = 0;
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        auto result = ReadJpgFromMemory(image->data);
+        pixels = result.Width() * result.Height();
+        benchmark::DoNotOptimize(result);
+    }
+    perf_counters.Stop();
+    SetThroughputCounters(state, image->data.size(), pixels);
+    ReportPerfCounters(state, perf_counters, pixels, "px");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static const auto kImages = LoadTestImages();
+    for (const auto& image : kImages) {
+        benchmark::RegisterBenchmark(("BM_Decode/" DECODER_NAME "/" + image.name).c_str(),
+                                     BM_Decode, &image)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("BM_Decode/libjpeg/" + image.name).c_str(),
+                                     BM_DecodeLibjpeg, &image)
+            ->Unit(benchmark::kMillisecond);
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
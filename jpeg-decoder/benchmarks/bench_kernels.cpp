@@ -0,0 +1,366 @@
+// Microbenchmarks of decoder_faster kernels on inputs captured from tests/.
+//
+// Every kernel is fed with data taken from a real image at the point where
+// Decode would pass it: Huffman trees get the exact bit streams they consume
+// while decoding the scan, IDCT gets dequantized blocks, color conversion and
+// upsampling get level-shifted samples. So coefficient and symbol
+// distributions are the real ones, not uniform noise.
+//
+// Hardware counters per item (symbol, block or pixel) are reported when
+// perf_event_open is available: branch mispredicts of the Huffman walk and
+// cache misses of upsampling are what plain wall time hides.
+
+#include <fft.h>
+#include <huffman.h>
+#include <image.h>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_commons.hpp"
+#include "perf_counters.hpp"
+#include "bit_reader.h"
+#include "parsers.h"
+#include "stages.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t kMaxCapturedPixels = 1 << 16;
+
+struct HuffmanStream {
+    std::vector<uint8_t> code_lengths, values;
+    std::vector<uint8_t> bits;
+    size_t symbols = 0;
+};
+
+uint8_t ByteAt(const std::string& data, size_t pos) {
+    return static_cast<uint8_t>(data.at(pos));
+}
+
+// Replays the baseline scan of |data| and records, for every DHT table, the
+// bits that Parser::ReadFromHuffmanTree would feed into HuffmanTree::Move.
+// Keys are the DHT Tc/Th byte: 0x0n for DC tables, 0x1n for AC tables.
+std::map<uint8_t, HuffmanStream> CaptureHuffmanStreams(const std::string& data) {
+    std::map<uint8_t, HuffmanStream> streams;
+    std::map<uint8_t, std::pair<uint8_t, uint8_t>> sampling;
+    std::vector<std::pair<uint8_t, uint8_t>> scan_tables, scan_sampling;
+    uint16_t height = 0, width = 0;
+    size_t scan_start = 0;
+
+    for (size_t pos = 2; pos + 4 <= data.size() && scan_start == 0;) {
+        const uint8_t marker = ByteAt(data, pos + 1);
+        const size_t payload = pos + 4;
+        const size_t end = pos + 2 + ((ByteAt(data, pos + 2) << 8) | ByteAt(data, pos + 3));
+        if (marker == 0xc0) {
+            height = (ByteAt(data, payload + 1) << 8) | ByteAt(data, payload + 2);
+            width = (ByteAt(data, payload + 3) << 8) | ByteAt(data, payload + 4);
+            for (size_t c = 0; c < ByteAt(data, payload + 5); ++c) {
+                const uint8_t hv = ByteAt(data, payload + 7 + c * 3);
+                sampling[ByteAt(data, payload + 6 + c * 3)] = {hv >> 4, hv & 0xf};
+            }
+        } else if (marker == 0xc4) {
+            for (size_t p = payload; p < end;) {
+                auto& stream = streams[ByteAt(data, p++)];
+                stream.code_lengths.assign(data.begin() + p, data.begin() + p + 16);
+                size_t values_cnt = 0;
+                for (const auto length : stream.code_lengths) {
+                    values_cnt += length;
+                }
+                p += 16;
+                stream.values.assign(data.begin() + p, data.begin() + p + values_cnt);
+                p += values_cnt;
+            }
+        } else if (marker == 0xda) {
+            for (size_t c = 0; c < ByteAt(data, payload); ++c) {
+                const uint8_t tables = ByteAt(data, payload + 2 + c * 2);
+                scan_tables.emplace_back(tables >> 4, 0x10 | (tables & 0xf));
+                scan_sampling.push_back(sampling.at(ByteAt(data, payload + 1 + c * 2)));
+            }
+            scan_start = end;
+        }
+        pos = end;
+    }
+
+    std::map<uint8_t, HuffmanTree> trees;
+    for (auto& [key, stream] : streams) {
+        trees[key].Build(stream.code_lengths, stream.values);
+    }
+
+    uint8_t h_max = 0, v_max = 0;
+    for (const auto& [h, v] : scan_sampling) {
+        h_max = std::max(h_max, h);
+        v_max = std::max(v_max, v);
+    }
+    const size_t mcu_cnt =
+        ((height + 8 * v_max - 1) / (8 * v_max)) * ((width + 8 * h_max - 1) / (8 * h_max));
+
+    std::istringstream input(data.substr(scan_start));
+    BitReader reader(input);
+    auto read_symbol = [&](uint8_t key) {
+        auto& stream = streams.at(key);
+        auto& tree = trees.at(key);
+        int value = 0;
+        bool bit;
+        do {
+            bit = reader.ReadBits();
+            stream.bits.push_back(bit);
+        } while (!tree.Move(bit, value));
+        ++stream.symbols;
+        return static_cast<uint8_t>(value);
+    };
+
+    for (size_t mcu = 0; mcu < mcu_cnt; ++mcu) {
+        for (size_t c = 0; c < scan_tables.size(); ++c) {
+            const auto [dc_key, ac_key] = scan_tables[c];
+            for (size_t block = 0; block < scan_sampling[c].first * scan_sampling[c].second;
+                 ++block) {
+                reader.ReadBits(read_symbol(dc_key));
+                for (size_t k = 1; k < kBlockSz; ++k) {
+                    const uint8_t symbol = read_symbol(ac_key);
+                    if (symbol == 0) {
+                        break;
+                    }
+                    k += symbol >> 4;
+                    reader.ReadBits(symbol & 0xf);
+                }
+            }
+        }
+    }
+    return streams;
+}
+
+size_t NonZeroCount(const int16_t* block) {
+    size_t cnt = 0;
+    for (size_t k = 0; k < kBlockSz; ++k) {
+        cnt += block[k] != 0;
+    }
+    return cnt;
+}
+
+// One image taken through the stages of Decode, keeping the input of every stage.
+struct KernelInputs {
+    explicit KernelInputs(const std::string& data)
+        : raw(ParseRaw(data)),
+          quantized(Quantized(raw)),
+          transformed(Transformed(quantized)),
+          rationed(Rationed(transformed)),
+          huffman_streams(CaptureHuffmanStreams(data)) {
+        for (const auto& channel : raw.data.channels) {
+            quant_tables.push_back(&raw.quantum_tables[channel.quant_id].value().data);
+        }
+        // Sparse and dense are the lower and the upper quartiles of the image
+        // by the number of non-zero coefficients in a block.
+        std::vector<size_t> non_zero_counts;
+        for (size_t c = 0; c < quantized.ChannelsCount(); ++c) {
+            for (size_t i = 0; i < quantized.BlocksCount(c); ++i) {
+                non_zero_counts.push_back(NonZeroCount(quantized.Block(c, i)));
+            }
+        }
+        std::sort(non_zero_counts.begin(), non_zero_counts.end());
+        const size_t sparse_max = non_zero_counts[non_zero_counts.size() / 4];
+        const size_t dense_min = non_zero_counts[non_zero_counts.size() * 3 / 4];
+        for (size_t c = 0; c < quantized.ChannelsCount(); ++c) {
+            for (size_t i = 0; i < quantized.BlocksCount(c); ++i) {
+                const int16_t* block = quantized.Block(c, i);
+                const size_t non_zero = NonZeroCount(block);
+                if (non_zero <= sparse_max) {
+                    sparse_blocks.emplace_back(block, block + kBlockSz);
+                } else if (non_zero >= dense_min) {
+                    dense_blocks.emplace_back(block, block + kBlockSz);
+                }
+            }
+        }
+        const auto& channels = rationed.channel_blocks;
+        for (size_t i = 0; i < channels[0].size() && pixels.size() < kMaxCapturedPixels; ++i) {
+            std::array<int16_t, 3> pixel = {0, 128, 128};
+            for (size_t c = 0; c < std::min<size_t>(rationed.ChannelsCount(), 3); ++c) {
+                pixel[c] = channels[c][i % channels[c].size()];
+            }
+            pixels.push_back(pixel);
+        }
+    }
+
+    static RawImage ParseRaw(const std::string& data) {
+        MemoryBuf buf(data);
+        std::istream input(&buf);
+        return Parser(input).ReadRawImage();
+    }
+
+    static ImageData Quantized(const RawImage& raw) {
+        ImageData result = raw.data;
+        Quantization(raw, result, 0, result.mcu_h);
+        return result;
+    }
+
+    static ImageData Transformed(const ImageData& quantized) {
+        ImageData result = quantized;
+        StagesContext context;
+        IDCT(result, context, 0, result.mcu_h);
+        return result;
+    }
+
+    static ImageData Rationed(const ImageData& transformed) {
+        ImageData result = transformed;
+        Rationing(result, 0, result.mcu_h);
+        return result;
+    }
+
+    RawImage raw;
+    ImageData quantized, transformed, rationed;
+    std::map<uint8_t, HuffmanStream> huffman_streams;
+    std::vector<const std::array<uint16_t, kBlockSz>*> quant_tables;
+    std::vector<std::vector<int16_t>> sparse_blocks, dense_blocks;
+    std::vector<std::array<int16_t, 3>> pixels;
+};
+
+size_t BlocksCount(const ImageData& data) {
+    size_t cnt = 0;
+    for (size_t c = 0; c < data.ChannelsCount(); ++c) {
+        cnt += data.BlocksCount(c);
+    }
+    return cnt;
+}
+
+void BM_HuffmanMove(benchmark::State& state, const HuffmanStream* stream) {
+    HuffmanTree tree;
+    tree.Build(stream->code_lengths, stream->values);
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        int value = 0, sum = 0;
+        for (const auto bit : stream->bits) {
+            if (tree.Move(bit, value)) {
+                sum += value;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    perf_counters.Stop();
+    state.SetItemsProcessed(state.iterations() * stream->symbols);
+    ReportPerfCounters(state, perf_counters, stream->symbols, "symbol");
+}
+
+void BM_Idct(benchmark::State& state, const std::vector<std::vector<int16_t>>* blocks) {
+    std::vector<double> input(kBlockSz), output(kBlockSz);
+    DctCalculator calc(8, &input, &output);
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        for (const auto& block : *blocks) {
+            for (size_t k = 0; k < kBlockSz; ++k) {
+                input[k] = block[k];
+            }
+            calc.Inverse();
+            benchmark::DoNotOptimize(output.data());
+        }
+    }
+    perf_counters.Stop();
+    state.SetItemsProcessed(state.iterations() * blocks->size());
+    ReportPerfCounters(state, perf_counters, blocks->size(), "block");
+}
+
+void BM_Mult(benchmark::State& state, const KernelInputs* inputs) {
+    PerfCounters perf_counters;
+    for (auto _ : state) {
+        state.PauseTiming();
+        ImageData data = inputs->raw.data;
+        state.ResumeTiming();
+        perf_counters.Start();
+        for (size_t c = 0; c < data.ChannelsCount(); ++c) {
+            for (size_t i = 0; i < data.BlocksCount(c); ++i) {
+                Mult(data.Block(c, i), *inputs->quant_tables[c]);
+            }
+        }
+        benchmark::DoNotOptimize(data);
+        perf_counters.Stop();
+    }
+    state.SetItemsProcessed(state.iterations() * BlocksCount(inputs->raw.data));
+    ReportPerfCounters(state, perf_counters, BlocksCount(inputs->raw.data), "block");
+}
+
+void BM_Rationing(benchmark::State& state, const KernelInputs* inputs) {
+    PerfCounters perf_counters;
+    for (auto _ : state) {
+        state.PauseTiming();
+        ImageData data = inputs->transformed;
+        state.ResumeTiming();
+        perf_counters.Start();
+        Rationing(data, 0, data.mcu_h);
+        benchmark::DoNotOptimize(data);
+        perf_counters.Stop();
+    }
+    state.SetItemsProcessed(state.iterations() * BlocksCount(inputs->transformed));
+    ReportPerfCounters(state, perf_counters, BlocksCount(inputs->transformed), "block");
+}
+
+void BM_YCbCrToRGB(benchmark::State& state, const KernelInputs* inputs) {
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        for (const auto& pixel : inputs->pixels) {
+            benchmark::DoNotOptimize(YCbCrToRGB(pixel[0], pixel[1], pixel[2]));
+        }
+    }
+    perf_counters.Stop();
+    state.SetItemsProcessed(state.iterations() * inputs->pixels.size());
+    ReportPerfCounters(state, perf_counters, inputs->pixels.size(), "px");
+}
+
+void BM_GetAns(benchmark::State& state, const KernelInputs* inputs) {
+    const auto& meta = inputs->raw.metadata;
+    const auto& data = inputs->rationed;
+    Image image(meta.width, meta.height);
+    StagesContext context;
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        GetAns(data, meta, context, 0, data.mcu_h, image);
+        benchmark::DoNotOptimize(image);
+    }
+    perf_counters.Stop();
+    state.SetItemsProcessed(state.iterations() * meta.width * meta.height);
+    ReportPerfCounters(state, perf_counters, meta.width * meta.height, "px");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // 4:4:4, 4:2:0 and grayscale, so that upsampling is covered in every flavour.
+    static const std::vector<std::string> kImageNames = {"lenna", "test", "grayscale"};
+    static std::map<std::string, KernelInputs> inputs;
+    for (const auto& name : kImageNames) {
+        inputs.emplace(name, ReadTestImage(name));
+    }
+
+    for (const auto& [name, input] : inputs) {
+        for (const auto& [key, stream] : input.huffman_streams) {
+            const std::string table =
+                std::string(key >> 4 ? "ac" : "dc") + std::to_string(key & 0xf);
+            benchmark::RegisterBenchmark(("BM_HuffmanMove/" + name + "/" + table).c_str(),
+                                         BM_HuffmanMove, &stream);
+        }
+        benchmark::RegisterBenchmark(("BM_Idct/" + name + "/sparse").c_str(), BM_Idct,
+                                     &input.sparse_blocks);
+        benchmark::RegisterBenchmark(("BM_Idct/" + name + "/dense").c_str(), BM_Idct,
+                                     &input.dense_blocks);
+        benchmark::RegisterBenchmark(("BM_Mult/" + name).c_str(), BM_Mult, &input);
+        benchmark::RegisterBenchmark(("BM_Rationing/" + name).c_str(), BM_Rationing, &input);
+        benchmark::RegisterBenchmark(("BM_YCbCrToRGB/" + name).c_str(), BM_YCbCrToRGB, &input);
+        benchmark::RegisterBenchmark(("BM_GetAns/" + name).c_str(), BM_GetAns, &input)
+            ->Unit(benchmark::kMillisecond);
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
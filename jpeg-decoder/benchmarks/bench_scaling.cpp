@@ -0,0 +1,101 @@
+// Decoding throughput along each dimension of the synthetic corpus: size,
+// subsampling, quality, restart interval and content (see jpeg_generator.hpp).
+//
+// Benchmarks are named BM_Scaling/<decoder>/<axis>/<spec>, so one axis can be
+// selected with --benchmark_filter and Mpx/s plotted against it to spot
+// scaling cliffs. Built per decoder like bench_decoder.
+//
+// Sizes above 4096 px need gigabytes for the decoded Image and are skipped
+// unless --corpus_max_size=16384 is passed.
+
+#include <decoder.h>
+#include <image.h>
+#include <jpeg_generator.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_commons.hpp"
+#include "perf_counters.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <map>
+#include <string>
+
+#ifndef DECODER_NAME
+#define DECODER_NAME "decoder"
+#endif
+
+namespace {
+
+constexpr char kMaxSizeFlag[] = "--corpus_max_size=";
+
+// The image is generated on the first run of its benchmark only, so that
+// registering the whole corpus stays cheap when --benchmark_filter selects a
+// part of it, and repetitions do not pay for it again.
+const std::string& CachedJpeg(const JpegSpec& spec) {
+    static std::map<std::string, std::string> cache;
+    auto [it, inserted] = cache.try_emplace(spec.Name());
+    if (inserted) {
+        it->second = GenerateJpeg(spec);
+    }
+    return it->second;
+}
+
+void BM_Scaling(benchmark::State& state, const JpegSpec& spec) {
+    const std::string& data = CachedJpeg(spec);
+    size_t pixels = 0;
+    PerfCounters perf_counters;
+    perf_counters.Start();
+    for (auto _ : state) {
+        MemoryBuf buf(data);
+        std::istream input(&buf);
+        try {
+            auto result = Decode(input);
+            pixels = result.Width() * result.Height();
+            benchmark::DoNotOptimize(result);
+        } catch (const std::exception& e) {
+            state.SkipWithError(e.what());
+            return;
+        }
+    }
+    perf_counters.Stop();
+    SetThroughputCounters(state, data.size(), pixels);
+    ReportPerfCounters(state, perf_counters, pixels, "px");
+}
+
+// Removes --corpus_max_size from argv, benchmark::Initialize rejects unknown flags.
+size_t ParseMaxSize(int* argc, char** argv) {
+    size_t max_size = 4096;
+    int kept = 1;
+    for (int i = 1; i < *argc; ++i) {
+        if (std::strncmp(argv[i], kMaxSizeFlag, sizeof(kMaxSizeFlag) - 1) == 0) {
+            max_size = std::strtoull(argv[i] + sizeof(kMaxSizeFlag) - 1, nullptr, 10);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    *argc = kept;
+    return max_size;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (const auto& axis : ScalingCorpus(ParseMaxSize(&argc, argv))) {
+        for (const auto& spec : axis.specs) {
+            const std::string name = "BM_Scaling/" DECODER_NAME "/" + axis.name + "/" + spec.Name();
+            benchmark::RegisterBenchmark(name.c_str(), BM_Scaling, spec)
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
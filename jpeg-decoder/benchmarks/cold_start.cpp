@@ -0,0 +1,195 @@
+// Process-start-to-first-pixel time of decoder_faster, for workers that
+// decode one image per process.
+//
+// The tool re-executes itself |runs| times. Each child decodes one file and
+// reports when it reached each phase on the monotonic clock, which is shared
+// by all processes, so the parent can split the time since its spawn call:
+//   exec       spawn to main: exec, dynamic loading, static initializers.
+//   glog       google::InitGoogleLogging.
+//   decoder    JpegDecoder construction, FFTW planning with the default build.
+//   read       reading the file into memory.
+//   decode     the first Decode call, that is until the first pixel is ready.
+//   exit       from the decoded image to the parent seeing the process exit.
+// Minor page faults and peak RSS of the children come from wait4.
+//
+// Build decoder_faster with -DDECODER_FAST_START=ON to compare against the
+// mode without runtime FFTW planning (see faster/CMakeLists.txt).
+//
+// Usage: cold_start [runs=20] [image.jpg]
+// Without an image a 512x512 one is generated.
+
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+
+#include "bench_commons.hpp"
+
+#include <glog/logging.h>
+
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+
+constexpr char kChildFlag[] = "--child";
+constexpr std::array<const char*, 6> kPhases = {"exec", "glog",   "decoder",
+                                                "read", "decode", "exit"};
+
+int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Prints the timestamps of main, glog, decoder, read and decode to stdout.
+int RunChild(const char* argv0, const char* path) {
+    const int64_t main_entered = Now();
+    google::InitGoogleLogging(argv0);
+    const int64_t glog_ready = Now();
+    JpegDecoder decoder;
+    const int64_t decoder_ready = Now();
+    std::ifstream file(path, std::ios::binary);
+    const std::string data{std::istreambuf_iterator<char>(file), {}};
+    const int64_t read_done = Now();
+    MemoryBuf buf(data);
+    std::istream input(&buf);
+    const auto image = decoder.Decode(input);
+    const int64_t first_pixel = Now();
+    std::printf("%lld %lld %lld %lld %lld %d\n", static_cast<long long>(main_entered),
+                static_cast<long long>(glog_ready), static_cast<long long>(decoder_ready),
+                static_cast<long long>(read_done), static_cast<long long>(first_pixel),
+                image.GetPixel(0, 0).r);
+    return 0;
+}
+
+struct Run {
+    std::array<double, kPhases.size()> phases_ms;
+    double total_ms;
+    long minor_faults, max_rss_kb;
+};
+
+Run SpawnChild(const char* argv0, const std::string& path) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+    char* const child_argv[] = {const_cast<char*>(argv0), const_cast<char*>(kChildFlag),
+                                const_cast<char*>(path.c_str()), nullptr};
+
+    pid_t pid;
+    const int64_t spawned = Now();
+    const int error = posix_spawn(&pid, argv0, &actions, nullptr, child_argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipe_fds[1]);
+    if (error != 0) {
+        close(pipe_fds[0]);
+        throw std::runtime_error("posix_spawn failed");
+    }
+
+    std::string output;
+    char chunk[256];
+    for (ssize_t n; (n = read(pipe_fds[0], chunk, sizeof(chunk))) > 0;) {
+        output.append(chunk, n);
+    }
+    close(pipe_fds[0]);
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    const int64_t exited = Now();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Child failed");
+    }
+
+    std::array<int64_t, kPhases.size() + 1> marks;
+    marks.front() = spawned;
+    marks.back() = exited;
+    std::istringstream in(output);
+    for (size_t i = 1; i < kPhases.size(); ++i) {
+        in >> marks[i];
+    }
+    if (!in) {
+        throw std::runtime_error("Bad child output");
+    }
+    Run run{{}, (exited - spawned) / 1e6, usage.ru_minflt, usage.ru_maxrss};
+    for (size_t i = 0; i < kPhases.size(); ++i) {
+        run.phases_ms[i] = (marks[i + 1] - marks[i]) / 1e6;
+    }
+    return run;
+}
+
+template <class F>
+void PrintStat(const char* name, const std::vector<Run>& runs, F key) {
+    std::vector<double> values;
+    for (const auto& run : runs) {
+        values.push_back(key(run));
+    }
+    std::sort(values.begin(), values.end());
+    std::printf("%-14s %10.3f %10.3f %10.3f\n", name, values.front(), values[values.size() / 2],
+                values.back());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 3 && std::string(argv[1]) == kChildFlag) {
+        return RunChild(argv[0], argv[2]);
+    }
+
+    const size_t runs_count = argc > 1 ? std::stoul(argv[1]) : 20;
+    std::string path;
+    if (argc > 2) {
+        path = argv[2];
+    } else {
+        JpegSpec spec;
+        spec.width = spec.height = 512;
+        path = (std::filesystem::temp_directory_path() / (spec.Name() + ".jpg")).string();
+        const auto data = GenerateJpeg(spec);
+        std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+    }
+
+    // /proc/self/exe, so that a relative argv[0] found through PATH still works.
+    const std::string self = std::filesystem::read_symlink("/proc/self/exe").string();
+    std::vector<Run> runs;
+    try {
+        for (size_t i = 0; i < runs_count; ++i) {
+            runs.push_back(SpawnChild(self.c_str(), path));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    std::printf("%s, %zu runs\n\n%-14s %10s %10s %10s\n", path.c_str(), runs.size(), "ms", "min",
+                "median", "max");
+    for (size_t i = 0; i < kPhases.size(); ++i) {
+        PrintStat(kPhases[i], runs, [i](const Run& run) { return run.phases_ms[i]; });
+    }
+    PrintStat("first pixel", runs, [](const Run& run) {
+        return run.total_ms - run.phases_ms.back();
+    });
+    PrintStat("total", runs, [](const Run& run) { return run.total_ms; });
+    PrintStat("minor faults", runs, [](const Run& run) { return run.minor_faults; });
+    PrintStat("max RSS, KiB", runs, [](const Run& run) { return run.max_rss_kb; });
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Service-style load test of decoder_faster: latency under a target request rate.
+//
+// Requests arrive open-loop, as a Poisson process at --rate per second,
+// whether or not the workers keep up. They are drawn from a size mix of
+// generated images (see jpeg_generator.hpp) and decoded by a pool of
+// --workers threads, each with its own JpegDecoder. Latency is measured from
+// the scheduled arrival, not from the moment a request was dequeued, so an
+// overloaded pool shows up as growing latency instead of a lower rate
+// (no coordinated omission).
+//
+// Reported per request: queueing delay (arrival to start), service time
+// (start to finish) and latency (arrival to finish), as p50/p90/p99/p999/max,
+// overall and per image size.
+//
+// Usage: load_generator [--rate=200] [--duration=10] [--workers=N]
+//                       [--mix=64:50,256:30,1024:15,2048:5] [--seed=0]
+// --mix is a list of <square image side>:<weight>.
+
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+
+#include "bench_commons.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    double rate = 200;
+    double duration = 10;
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    std::string mix = "64:50,256:30,1024:15,2048:5";
+    uint64_t seed = 0;
+};
+
+struct MixEntry {
+    size_t size;
+    double weight;
+    std::string data;
+};
+
+struct Request {
+    size_t mix_index;
+    Clock::time_point arrival;
+};
+
+struct Result {
+    size_t mix_index;
+    Clock::duration queueing, service;
+    bool failed;
+};
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--rate") {
+            options.rate = std::stod(value);
+        } else if (key == "--duration") {
+            options.duration = std::stod(value);
+        } else if (key == "--workers") {
+            options.workers = std::stoul(value);
+        } else if (key == "--mix") {
+            options.mix = value;
+        } else if (key == "--seed") {
+            options.seed = std::stoull(value);
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    if (options.rate <= 0 || options.duration <= 0 || options.workers == 0) {
+        throw std::invalid_argument("Rate, duration and workers must be positive");
+    }
+    return options;
+}
+
+std::vector<MixEntry> ParseMix(const std::string& mix) {
+    std::vector<MixEntry> entries;
+    std::istringstream input(mix);
+    for (std::string item; std::getline(input, item, ',');) {
+        const auto colon = item.find(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("Bad mix entry " + item);
+        }
+        JpegSpec spec;
+        spec.width = spec.height = std::stoul(item.substr(0, colon));
+        entries.push_back({spec.width, std::stod(item.substr(colon + 1)), GenerateJpeg(spec)});
+    }
+    if (entries.empty()) {
+        throw std::invalid_argument("Empty mix");
+    }
+    return entries;
+}
+
+double Milliseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void PrintPercentiles(const std::string& label, std::vector<double> values) {
+    if (values.empty()) {
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    auto at = [&](double q) {
+        return values[std::min(values.size() - 1, static_cast<size_t>(q * values.size()))];
+    };
+    std::printf("%-24s %8zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", label.c_str(), values.size(),
+                at(0.5), at(0.9), at(0.99), at(0.999), values.back());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<MixEntry> mix;
+    try {
+        options = ParseOptions(argc, argv);
+        mix = ParseMix(options.mix);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    // The whole arrival schedule is drawn up front, so it does not depend on timing.
+    std::mt19937_64 rng(options.seed);
+    std::exponential_distribution<double> interarrival(options.rate);
+    std::vector<double> weights;
+    for (const auto& entry : mix) {
+        weights.push_back(entry.weight);
+    }
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    std::vector<std::pair<size_t, std::chrono::duration<double>>> schedule;
+    for (double t = interarrival(rng); t < options.duration; t += interarrival(rng)) {
+        schedule.emplace_back(pick(rng), std::chrono::duration<double>(t));
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Request> queue;
+    bool done = false;
+    std::vector<Result> results;
+    results.reserve(schedule.size());
+
+    std::vector<JpegDecoder> decoders(options.workers);
+    std::vector<std::thread> workers;
+    for (auto& decoder : decoders) {
+        workers.emplace_back([&] {
+            Image image;
+            std::vector<Result> local;
+            while (true) {
+                Request request;
+                {
+                    std::unique_lock lock(mutex);
+                    cv.wait(lock, [&] { return done || !queue.empty(); });
+                    if (queue.empty()) {
+                        break;
+                    }
+                    request = queue.front();
+                    queue.pop_front();
+                }
+                const auto start = Clock::now();
+                bool failed = false;
+                try {
+                    MemoryBuf buf(mix[request.mix_index].data);
+                    std::istream input(&buf);
+                    decoder.Decode(input, &image);
+                } catch (const std::exception&) {
+                    failed = true;
+                }
+                local.push_back({request.mix_index, start - request.arrival,
+                                 Clock::now() - start, failed});
+            }
+            std::lock_guard lock(mutex);
+            results.insert(results.end(), local.begin(), local.end());
+        });
+    }
+
+    const auto begin = Clock::now();
+    for (const auto& [mix_index, offset] : schedule) {
+        const auto arrival = begin + std::chrono::duration_cast<Clock::duration>(offset);
+        std::this_thread::sleep_until(arrival);
+        {
+            std::lock_guard lock(mutex);
+            queue.push_back({mix_index, arrival});
+        }
+        cv.notify_one();
+    }
+    {
+        std::lock_guard lock(mutex);
+        done = true;
+    }
+    cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    size_t failed = 0;
+    std::vector<double> queueing, service, latency;
+    std::map<size_t, std::vector<double>> latency_by_size;
+    for (const auto& result : results) {
+        failed += result.failed;
+        queueing.push_back(Milliseconds(result.queueing));
+        service.push_back(Milliseconds(result.service));
+        latency.push_back(Milliseconds(result.queueing + result.service));
+        latency_by_size[mix[result.mix_index].size].push_back(latency.back());
+    }
+
+    std::printf("offered %.1f req/s, completed %zu requests in %.2f s (%.1f req/s), %zu failed, "
+                "%zu workers\n\n",
+                options.rate, results.size(), elapsed, results.size() / elapsed, failed,
+                options.workers);
+    std::printf("%-24s %8s %10s %10s %10s %10s %10s\n", "ms", "count", "p50", "p90", "p99",
+                "p999", "max");
+    PrintPercentiles("queueing delay", queueing);
+    PrintPercentiles("service time", service);
+    PrintPercentiles("latency", latency);
+    for (const auto& [size, values] : latency_by_size) {
+        PrintPercentiles("latency " + std::to_string(size) + "px", values);
+    }
+    return 0;
+}
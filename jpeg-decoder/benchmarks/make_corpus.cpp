@@ -0,0 +1,38 @@
+// Writes the synthetic scaling corpus to disk, to feed other decoders or tools
+// with exactly the images bench_scaling uses.
+//
+// Usage: make_corpus <output_dir> [max_size=16384]
+// Files are <output_dir>/<axis>/<spec>.jpg, the same bytes on every run.
+
+#include <jpeg_generator.hpp>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <output_dir> [max_size]\n";
+        return 1;
+    }
+    const std::filesystem::path output_dir = argv[1];
+    const size_t max_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16384;
+
+    for (const auto& axis : ScalingCorpus(max_size)) {
+        std::filesystem::create_directories(output_dir / axis.name);
+        for (const auto& spec : axis.specs) {
+            const auto path = output_dir / axis.name / (spec.Name() + ".jpg");
+            const auto data = GenerateJpeg(spec);
+            std::ofstream out(path, std::ios::binary);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if (!out) {
+                std::cerr << "Cannot write " << path << '\n';
+                return 1;
+            }
+            std::cout << path.string() << ' ' << data.size() << " bytes\n";
+        }
+    }
+    return 0;
+}
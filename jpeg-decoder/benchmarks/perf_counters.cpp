@@ -0,0 +1,128 @@
+#include "perf_counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr std::array<const char*, PerfCounters::kCount> kNames = {
+    "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"};
+
+#ifdef __linux__
+int OpenCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // More events than the PMU has registers are time-multiplexed, each one
+    // counts only part of the time and is scaled up in Stop.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+#endif
+
+}  // namespace
+
+PerfCounters::PerfCounters() {
+    fds_.fill(-1);
+#ifdef __linux__
+    fds_[kCycles] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds_[kInstructions] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds_[kBranchMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds_[kL1dMisses] = OpenCounter(
+        PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    fds_[kLlcMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::Available() const {
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfCounters::Start() {
+#ifdef __linux__
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void PerfCounters::Stop() {
+#ifdef __linux__
+    for (size_t i = 0; i < kCount; ++i) {
+        if (fds_[i] < 0) {
+            continue;
+        }
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+        // value, time enabled, time running.
+        uint64_t data[3] = {};
+        if (read(fds_[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+            continue;
+        }
+        values_[i] += data[2] == data[1] ? data[0]
+                                         : static_cast<uint64_t>(static_cast<double>(data[0]) *
+                                                                 data[1] / data[2]);
+    }
+#endif
+}
+
+std::optional<uint64_t> PerfCounters::Value(Counter counter) const {
+    if (fds_[counter] < 0) {
+        return std::nullopt;
+    }
+    return values_[counter];
+}
+
+void ReportPerfCounters(benchmark::State& state, const PerfCounters& counters,
+                        double items_per_iteration, const std::string& unit) {
+    const double items = items_per_iteration * static_cast<double>(state.iterations());
+    if (items == 0) {
+        return;
+    }
+    for (size_t i = 0; i < PerfCounters::kCount; ++i) {
+        if (const auto value = counters.Value(static_cast<PerfCounters::Counter>(i))) {
+            state.counters[std::string(kNames[i]) + "/" + unit] = *value / items;
+        }
+    }
+    const auto cycles = counters.Value(PerfCounters::kCycles);
+    const auto instructions = counters.Value(PerfCounters::kInstructions);
+    if (cycles && instructions && *cycles > 0) {
+        state.counters["IPC"] = static_cast<double>(*instructions) / *cycles;
+    }
+}
+
+void SetThroughputCounters(benchmark::State& state, size_t input_bytes, size_t pixels) {
+    const double iterations = static_cast<double>(state.iterations());
+    state.counters["MB"] =
+        benchmark::Counter(iterations * input_bytes / 1e6, benchmark::Counter::kIsRate);
+    state.counters["Mpx"] =
+        benchmark::Counter(iterations * pixels / 1e6, benchmark::Counter::kIsRate);
+    state.counters["ns/px"] = benchmark::Counter(
+        iterations * pixels / 1e9, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
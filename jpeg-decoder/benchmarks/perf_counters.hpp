@@ -0,0 +1,46 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Hardware counters of the calling thread through perf_event_open.
+//
+// Counters that cannot be opened (no PMU in a container or VM,
+// perf_event_paranoid, not Linux) are silently left out, so benchmarks
+// still run and only report wall time.
+class PerfCounters {
+public:
+    enum Counter { kCycles, kInstructions, kBranchMisses, kL1dMisses, kLlcMisses, kCount };
+
+    PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters();
+
+    bool Available() const;
+
+    // Counts between Start and Stop, accumulated over several pairs. Counters
+    // multiplexed by the kernel are scaled to the whole enabled time.
+    void Start();
+    void Stop();
+
+    std::optional<uint64_t> Value(Counter counter) const;
+
+private:
+    std::array<int, kCount> fds_;
+    std::array<uint64_t, kCount> values_{};
+};
+
+// Adds "<counter>/<unit>" user counters to |state|, normalized by
+// state.iterations() * |items_per_iteration|, plus IPC.
+void ReportPerfCounters(benchmark::State& state, const PerfCounters& counters,
+                        double items_per_iteration, const std::string& unit);
+
+// MB and Mpx per second of wall time and ns/px, the inverse rate.
+void SetThroughputCounters(benchmark::State& state, size_t input_bytes, size_t pixels);
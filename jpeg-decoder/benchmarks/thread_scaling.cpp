@@ -0,0 +1,169 @@
+// Thread-scaling report of decoder_faster at 1, 2, 4, ... N threads.
+//
+// Three modes, on a generated image (see jpeg_generator.hpp):
+//   strong/image  one image, decoded by JpegDecoder(threads).
+//   strong/batch  a fixed batch of images shared by the threads.
+//   weak/batch    a fixed number of images per thread.
+// For strong scaling speedup is T(1) / T(n); for weak scaling, where the work
+// grows with n, it is n * T(1) / T(n). Efficiency is speedup / n. Mpx/s/core
+// is the per-thread throughput, the number to size a worker fleet with.
+//
+// Every point is the best of |repeats| runs. Output is a table on stdout and,
+// if a path is given, the same rows as JSON.
+//
+// Usage: thread_scaling [max_threads] [image_size] [repeats] [output.json]
+
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+
+#include "bench_commons.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t kImagesPerThread = 4;
+
+struct Row {
+    std::string mode;
+    size_t threads;
+    double seconds;
+    size_t images;
+    double speedup, efficiency, mpx_per_second;
+};
+
+double BestOf(size_t repeats, const std::function<void()>& run) {
+    double best = 0;
+    for (size_t i = 0; i < repeats; ++i) {
+        const auto begin = std::chrono::steady_clock::now();
+        run();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        best = i == 0 ? elapsed.count() : std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void DecodeOne(JpegDecoder& decoder, const std::string& data, Image* image) {
+    MemoryBuf buf(data);
+    std::istream input(&buf);
+    decoder.Decode(input, image);
+}
+
+// Decodes |images| copies of |data| on |decoders.size()| threads, each thread
+// taking the next image until none are left.
+void DecodeBatch(std::vector<JpegDecoder>& decoders, const std::string& data, size_t images) {
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (auto& decoder : decoders) {
+        workers.emplace_back([&] {
+            Image image;
+            while (next.fetch_add(1) < images) {
+                DecodeOne(decoder, data, &image);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+std::vector<size_t> ThreadCounts(size_t max_threads) {
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const size_t max_threads =
+        argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    JpegSpec spec;
+    spec.width = spec.height = argc > 2 ? std::stoul(argv[2]) : 2048;
+    const size_t repeats = argc > 3 ? std::stoul(argv[3]) : 3;
+    const std::string output = argc > 4 ? argv[4] : "";
+
+    const std::string data = GenerateJpeg(spec);
+    const double mpx = spec.width * spec.height / 1e6;
+    std::cerr << "Image " << spec.Name() << ", " << data.size() << " bytes\n";
+
+    std::vector<Row> rows;
+    auto add_row = [&](const std::string& mode, size_t threads, double seconds, size_t images,
+                       bool weak) {
+        double base = seconds;
+        for (const auto& row : rows) {
+            if (row.mode == mode && row.threads == 1) {
+                base = row.seconds;
+            }
+        }
+        const double speedup = (weak ? threads : 1) * base / seconds;
+        rows.push_back({mode, threads, seconds, images, speedup, speedup / threads,
+                        images * mpx / seconds});
+    };
+
+    for (const size_t threads : ThreadCounts(max_threads)) {
+        JpegDecoder decoder(threads);
+        Image image;
+        DecodeOne(decoder, data, &image);
+        add_row("strong/image", threads,
+                BestOf(repeats, [&] { DecodeOne(decoder, data, &image); }), 1, false);
+
+        std::vector<JpegDecoder> decoders(threads);
+        const size_t batch = kImagesPerThread * max_threads;
+        add_row("strong/batch", threads,
+                BestOf(repeats, [&] { DecodeBatch(decoders, data, batch); }), batch, false);
+
+        const size_t weak_batch = kImagesPerThread * threads;
+        add_row("weak/batch", threads,
+                BestOf(repeats, [&] { DecodeBatch(decoders, data, weak_batch); }), weak_batch,
+                true);
+    }
+
+    // Group by mode, in the order the modes were measured.
+    std::vector<Row> grouped;
+    for (const auto& first : rows) {
+        if (first.threads != 1) {
+            continue;
+        }
+        std::copy_if(rows.begin(), rows.end(), std::back_inserter(grouped),
+                     [&](const Row& row) { return row.mode == first.mode; });
+    }
+    rows = std::move(grouped);
+
+    std::printf("%-14s %8s %10s %8s %9s %10s %10s %12s\n", "mode", "threads", "time_ms", "images",
+                "speedup", "efficiency", "Mpx/s", "Mpx/s/core");
+    for (const auto& row : rows) {
+        std::printf("%-14s %8zu %10.2f %8zu %9.2f %10.2f %10.2f %12.2f\n", row.mode.c_str(),
+                    row.threads, row.seconds * 1e3, row.images, row.speedup, row.efficiency,
+                    row.mpx_per_second, row.mpx_per_second / row.threads);
+    }
+
+    if (!output.empty()) {
+        std::ofstream out(output);
+        out << "{\"image\":\"" << spec.Name() << "\",\"rows\":[";
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const auto& row = rows[i];
+            out << (i ? "," : "") << "{\"mode\":\"" << row.mode << "\",\"threads\":" << row.threads
+                << ",\"seconds\":" << row.seconds << ",\"images\":" << row.images
+                << ",\"speedup\":" << row.speedup << ",\"efficiency\":" << row.efficiency
+                << ",\"mpx_per_second\":" << row.mpx_per_second << "}";
+        }
+        out << "]}\n";
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Decodes tests/*.jpg on a pool of threads with tracing enabled and writes the
+// timeline as Chrome trace JSON, to be opened in ui.perfetto.dev.
+//
+// Usage: trace_decoder [threads] [output.json] [rounds]
+
+#include <jpeg_decoder.h>
+#include <trace.h>
+
+#include "bench_commons.hpp"
+
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+    const size_t threads_cnt = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+    const std::string output = argc > 2 ? argv[2] : "trace_decoder.json";
+    const size_t rounds = argc > 3 ? std::stoul(argv[3]) : 1;
+
+    const auto images = LoadTestImages();
+    std::atomic<size_t> next{0};
+
+    // One decoder per thread.
+    std::vector<JpegDecoder> decoders(threads_cnt);
+    std::vector<std::thread> workers;
+    for (auto& decoder : decoders) {
+        workers.emplace_back([&] {
+            trace::ScopedEnable tracing;
+            for (size_t task; (task = next.fetch_add(1)) < images.size() * rounds;) {
+                MemoryBuf buf(images[task % images.size()].data);
+                std::istream input(&buf);
+                try {
+                    (void)decoder.Decode(input);
+                } catch (const std::exception&) {
+                    // Unsupported images still show up on the timeline.
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::ofstream out(output);
+    trace::Dump(out);
+    std::cerr << "Trace written to " << output << ", dropped events: " << trace::DroppedEvents()
+              << '\n';
+    return 0;
+}
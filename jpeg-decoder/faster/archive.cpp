@@ -0,0 +1,685 @@
+#include <jpeg_archive.h>
+#include <jpeg_decoder.h>
+
+#include "parsers.h"
+#include "range_coder.h"
+#include "scan_writer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+constexpr std::string_view kMagic = "JARC";
+constexpr uint8_t kVersion = 3;
+constexpr uint8_t kModeStored = 0, kModeModeled = 1;
+
+// What the scan writer needs from the segments before the scan, which are
+// kept verbatim.
+struct Head {
+    // Bytes up to the end of the SOS header.
+    size_t size = 0;
+    uint16_t width = 0, height = 0;
+    uint8_t h_max = 0, v_max = 0;
+    size_t components_cnt = 0;
+    std::array<uint8_t, kMaxScanChannels> ids{}, h{}, v{}, quant_ids{};
+    // Row-major, by id.
+    std::array<std::array<uint16_t, kBlockSz>, 4> quant_tables{};
+    std::array<bool, 4> quant_defined{};
+    ScanLayout layout;
+    // Per class (DC, AC) and id.
+    std::array<std::array<std::array<uint8_t, 16>, kBaselineTableIds>, 2> code_lengths{};
+    std::array<std::array<std::vector<uint8_t>, kBaselineTableIds>, 2> values;
+    std::array<std::array<bool, kBaselineTableIds>, 2> defined{};
+
+    HuffmanSpec Spec(size_t table_class, size_t id) const {
+        return {code_lengths[table_class][id], values[table_class][id]};
+    }
+};
+
+uint16_t ReadWord(std::string_view data, size_t pos) {
+    return static_cast<uint16_t>(static_cast<uint8_t>(data[pos]) << 8 |
+                                 static_cast<uint8_t>(data[pos + 1]));
+}
+
+// Reads the segments of |jpeg| up to the first SOS. Empty when that scan is not
+// a single baseline scan over all components with tables defined before it.
+std::optional<Head> ParseHead(std::string_view jpeg) {
+    if (jpeg.size() < 2 || ReadWord(jpeg, 0) != 0xffd8) {
+        return std::nullopt;
+    }
+    Head head;
+    bool has_frame = false;
+    size_t pos = 2;
+    while (true) {
+        if (pos >= jpeg.size() || static_cast<uint8_t>(jpeg[pos]) != 0xff) {
+            return std::nullopt;
+        }
+        while (pos < jpeg.size() && static_cast<uint8_t>(jpeg[pos]) == 0xff) {
+            ++pos;
+        }
+        if (pos + 3 > jpeg.size()) {
+            return std::nullopt;
+        }
+        const uint8_t marker = jpeg[pos];
+        const size_t length = ReadWord(jpeg, pos + 1);
+        const size_t begin = pos + 3, end = pos + 1 + length;
+        if (length < 2 || end > jpeg.size()) {
+            return std::nullopt;
+        }
+        const std::string_view data = jpeg.substr(begin, end - begin);
+        pos = end;
+
+        if (marker == 0xc0 || marker == 0xc1) {
+            if (has_frame || data.size() < 6 || static_cast<uint8_t>(data[0]) != 8) {
+                return std::nullopt;
+            }
+            has_frame = true;
+            head.height = ReadWord(data, 1);
+            head.width = ReadWord(data, 3);
+            head.components_cnt = static_cast<uint8_t>(data[5]);
+            if (head.width == 0 || head.height == 0 || head.components_cnt == 0 ||
+                head.components_cnt > kMaxScanChannels ||
+                data.size() != 6 + 3 * head.components_cnt) {
+                return std::nullopt;
+            }
+            for (size_t c = 0; c < head.components_cnt; ++c) {
+                const auto sampling = static_cast<uint8_t>(data[7 + 3 * c]);
+                head.ids[c] = data[6 + 3 * c];
+                head.h[c] = sampling >> 4;
+                head.v[c] = sampling & 0xf;
+                head.quant_ids[c] = data[8 + 3 * c];
+                if (head.h[c] == 0 || head.h[c] > 4 || head.v[c] == 0 || head.v[c] > 4 ||
+                    head.quant_ids[c] >= head.quant_tables.size()) {
+                    return std::nullopt;
+                }
+                head.h_max = std::max(head.h_max, head.h[c]);
+                head.v_max = std::max(head.v_max, head.v[c]);
+            }
+        } else if (marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8) {
+            // Progressive, lossless, hierarchical or arithmetic-coded.
+            return std::nullopt;
+        } else if (marker == 0xc4) {
+            for (size_t i = 0; i < data.size();) {
+                if (i + 17 > data.size()) {
+                    return std::nullopt;
+                }
+                const auto table = static_cast<uint8_t>(data[i]);
+                const size_t table_class = table >> 4, id = table & 0xf;
+                if (table_class > 1 || id >= kBaselineTableIds) {
+                    return std::nullopt;
+                }
+                size_t values_cnt = 0;
+                for (size_t length = 0; length < 16; ++length) {
+                    head.code_lengths[table_class][id][length] = data[i + 1 + length];
+                    values_cnt += static_cast<uint8_t>(data[i + 1 + length]);
+                }
+                if (values_cnt > kU8Cnt || i + 17 + values_cnt > data.size()) {
+                    return std::nullopt;
+                }
+                head.values[table_class][id].assign(data.begin() + i + 17,
+                                                    data.begin() + i + 17 + values_cnt);
+                head.defined[table_class][id] = true;
+                i += 17 + values_cnt;
+            }
+        } else if (marker == 0xdb) {
+            for (size_t i = 0; i < data.size();) {
+                const auto table = static_cast<uint8_t>(data[i]);
+                const size_t precision = table >> 4, id = table & 0xf;
+                const size_t size = precision == 0 ? kBlockSz : 2 * kBlockSz;
+                if (precision > 1 || id >= head.quant_tables.size() ||
+                    i + 1 + size > data.size()) {
+                    return std::nullopt;
+                }
+                for (size_t k = 0; k < kBlockSz; ++k) {
+                    const uint16_t value = precision == 0
+                                               ? static_cast<uint8_t>(data[i + 1 + k])
+                                               : ReadWord(data, i + 1 + 2 * k);
+                    if (value == 0) {
+                        return std::nullopt;
+                    }
+                    head.quant_tables[id][kZigZagToNatural[k]] = value;
+                }
+                head.quant_defined[id] = true;
+                i += 1 + size;
+            }
+        } else if (marker == 0xdd) {
+            if (data.size() != 2) {
+                return std::nullopt;
+            }
+            head.layout.restart_interval = ReadWord(data, 0);
+        } else if (marker == 0xda) {
+            const size_t channels = data.empty() ? 0 : static_cast<uint8_t>(data[0]);
+            if (!has_frame || channels != head.components_cnt ||
+                data.size() != 4 + 2 * channels) {
+                return std::nullopt;
+            }
+            for (size_t c = 0; c < channels; ++c) {
+                const auto tables = static_cast<uint8_t>(data[2 + 2 * c]);
+                const uint8_t dc = tables >> 4, ac = tables & 0xf;
+                // The scan writer codes components in frame order.
+                if (static_cast<uint8_t>(data[1 + 2 * c]) != head.ids[c] ||
+                    dc >= kBaselineTableIds || ac >= kBaselineTableIds ||
+                    !head.defined[0][dc] || !head.defined[1][ac] ||
+                    !head.quant_defined[head.quant_ids[c]]) {
+                    return std::nullopt;
+                }
+                head.layout.dc_ids[c] = dc;
+                head.layout.ac_ids[c] = ac;
+            }
+            const size_t tail = 1 + 2 * channels;
+            if (data[tail] != 0 || static_cast<uint8_t>(data[tail + 1]) != 63 ||
+                data[tail + 2] != 0) {
+                return std::nullopt;
+            }
+            head.size = pos;
+            return head;
+        }
+    }
+}
+
+// Coefficient layout of the frame in |head|, as DecodeCoefficients exports it.
+void SetLayout(const Head& head, JpegCoefficients* coefficients) {
+    coefficients->width = head.width;
+    coefficients->height = head.height;
+    coefficients->h_max = head.h_max;
+    coefficients->v_max = head.v_max;
+    const size_t mcus_w = (head.width + 8 * head.h_max - 1) / (8 * head.h_max);
+    const size_t mcus_h = (head.height + 8 * head.v_max - 1) / (8 * head.v_max);
+    coefficients->components.resize(head.components_cnt);
+    size_t offset = 0;
+    for (size_t c = 0; c < head.components_cnt; ++c) {
+        auto& component = coefficients->components[c];
+        component.id = head.ids[c];
+        component.h = head.h[c];
+        component.v = head.v[c];
+        component.quant_table = head.quant_tables[head.quant_ids[c]];
+        component.blocks_w = mcus_w * head.h[c];
+        component.blocks_h = mcus_h * head.v[c];
+        component.offset = offset;
+        offset += component.blocks_w * component.blocks_h * kBlockSz;
+    }
+}
+
+bool SameLayout(const JpegCoefficients& a, const JpegCoefficients& b) {
+    if (a.width != b.width || a.height != b.height || a.h_max != b.h_max ||
+        a.v_max != b.v_max || a.components.size() != b.components.size()) {
+        return false;
+    }
+    for (size_t c = 0; c < a.components.size(); ++c) {
+        const auto &x = a.components[c], &y = b.components[c];
+        if (x.id != y.id || x.h != y.h || x.v != y.v || x.blocks_w != y.blocks_w ||
+            x.blocks_h != y.blocks_h || x.offset != y.offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PutSize(std::string* out, size_t size) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out->push_back(static_cast<char>(size >> shift & 0xff));
+    }
+}
+
+size_t GetSize(std::string_view in, size_t pos) {
+    if (pos + 4 > in.size()) {
+        throw std::runtime_error("Truncated archive");
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        size = size << 8 | static_cast<uint8_t>(in[pos + i]);
+    }
+    return size;
+}
+
+// A baseline block takes at least two bits of scan: an empty DC and an EOB.
+constexpr size_t kMinBlockBits = 2;
+// Every block codes at least seven bits with the model (its nonzero count and
+// the DC zero flag), and the range coder charges at least 0.0056 bits for one:
+// a coded byte holds fewer than 203 blocks.
+constexpr size_t kMaxBlocksPerCodedByte = 256;
+
+// Bit lengths of magnitudes: the difference of two int16 is at most 65535.
+constexpr size_t kMaxLength = 16;
+// Buckets of neighbor magnitudes, of magnitudes within the block and of
+// remaining nonzero counts.
+constexpr size_t kMagnitudeBuckets = 8, kIntraBuckets = 8, kRemainingBuckets = 7;
+constexpr size_t kCountContexts = 28;
+
+// AC positions in coding order, as natural indices: first the 7x7 positions
+// with both frequencies nonzero, in zig-zag order, then the first row and
+// column, which are predicted from the neighboring block and that 7x7 part.
+constexpr size_t kInteriorCnt = 49, kAcCnt = kBlockSz - 1;
+constexpr std::array<uint8_t, kAcCnt> kCodingOrder = [] {
+    std::array<uint8_t, kAcCnt> order{};
+    size_t interior = 0, edge = kInteriorCnt;
+    for (size_t i = 1; i < kBlockSz; ++i) {
+        const uint8_t n = kZigZagToNatural[i];
+        if (n < 8 || n % 8 == 0) {
+            order[edge++] = n;
+        } else {
+            order[interior++] = n;
+        }
+    }
+    return order;
+}();
+
+// Positions grouped for the length and mantissa contexts: the 7x7 part by
+// diagonal, then the first row and the first column by frequency.
+constexpr size_t kBands = 13 + 14;
+constexpr std::array<uint8_t, kAcCnt> kBandOfIndex = [] {
+    std::array<uint8_t, kAcCnt> bands{};
+    for (size_t k = 0; k < kAcCnt; ++k) {
+        const size_t row = kCodingOrder[k] / 8, column = kCodingOrder[k] % 8;
+        if (row == 0) {
+            bands[k] = 13 + column - 1;
+        } else if (column == 0) {
+            bands[k] = 20 + row - 1;
+        } else {
+            bands[k] = row + column - 2;
+        }
+    }
+    return bands;
+}();
+
+// C_u(0) of the 8-point DCT scaled by 2^13; C_u(7) is (-1)^u C_u(0).
+constexpr std::array<int64_t, 8> kEdgeCosines = {2896, 4017, 3784, 3406, 2896, 2276, 1567, 799};
+
+// Rounded to the nearest and clamped to the range of the coefficients.
+int DivideRounded(int64_t numerator, int64_t denominator) {
+    const int64_t magnitude =
+        std::min<int64_t>((std::abs(numerator) + denominator / 2) / denominator, INT16_MAX);
+    return static_cast<int>(numerator < 0 ? -magnitude : magnitude);
+}
+
+// Value of the coefficient at |n| of the first row or column (DC included) for
+// which the pixels on both sides of the boundary with |neighbor| agree: the
+// block above for the first row, the one to the left for the first column.
+// Uses the rest of that row or column of |block|, which must be known.
+int PredictEdge(const int16_t* block, const int16_t* neighbor, const uint16_t* quant, size_t n,
+                bool from_above) {
+    const size_t step = from_above ? 8 : 1;
+    int64_t sum = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        const size_t at = n + i * step;
+        const int64_t weight = kEdgeCosines[i] * quant[at];
+        sum += (i % 2 ? -weight : weight) * neighbor[at];
+        if (i > 0) {
+            sum -= weight * block[at];
+        }
+    }
+    return DivideRounded(sum, kEdgeCosines[0] * quant[n]);
+}
+
+template <size_t N, size_t... Rest>
+struct ContextsOf {
+    using Type = std::array<typename ContextsOf<Rest...>::Type, N>;
+};
+
+template <size_t N>
+struct ContextsOf<N> {
+    using Type = std::array<BitProbability, N>;
+};
+
+// Probabilities indexed by context, dimension by dimension.
+template <size_t... Dims>
+using Contexts = typename ContextsOf<Dims...>::Type;
+
+// The probabilities of every context, for luma (0) and chroma (1).
+struct Model {
+    template <class T>
+    static void Fill(T& probabilities) {
+        if constexpr (std::is_same_v<T, BitProbability>) {
+            probabilities = kEvenProbability;
+        } else {
+            for (auto& item : probabilities) {
+                Fill(item);
+            }
+        }
+    }
+
+    Model() {
+        Reset();
+    }
+
+    void Reset() {
+        Fill(count);
+        Fill(zero);
+        Fill(ac_length);
+        Fill(ac_mantissa);
+        Fill(ac_sign);
+        Fill(dc_zero);
+        Fill(dc_length);
+        Fill(dc_mantissa);
+        Fill(dc_sign);
+    }
+
+    // Count of nonzero AC coefficients: a 6-level binary tree per context.
+    Contexts<2, kCountContexts, kBlockSz> count;
+    // By coding index, remaining nonzero count, the predicted magnitude and
+    // the magnitudes around it in the block.
+    Contexts<2, kAcCnt, kRemainingBuckets, kMagnitudeBuckets, 4> zero;
+    Contexts<2, kBands, kMagnitudeBuckets, kIntraBuckets, kMaxLength> ac_length;
+    // By band, then bit length, up to kMaxLength inclusive, and bit.
+    Contexts<2, kBands, (kMaxLength + 1) * kMaxLength> ac_mantissa;
+    // By the sign and magnitude of the prediction.
+    Contexts<2, kAcCnt, 3, kMagnitudeBuckets> ac_sign;
+    // By how far the predictions from above and from the left disagree.
+    Contexts<2, kMagnitudeBuckets + 1> dc_zero;
+    Contexts<2, kMagnitudeBuckets + 1, kMaxLength> dc_length;
+    Contexts<2, (kMaxLength + 1) * kMaxLength> dc_mantissa;
+    Contexts<2, kMagnitudeBuckets + 1> dc_sign;
+};
+
+size_t BitLength(unsigned value) {
+    size_t length = 0;
+    for (; value != 0; value >>= 1) {
+        ++length;
+    }
+    return length;
+}
+
+size_t Bucket(unsigned value, size_t buckets) {
+    return std::min(BitLength(value), buckets - 1);
+}
+
+// A nonzero |value| as its bit length in unary, the bits under the top one,
+// then its sign. Encoders pass the value, decoders get it back.
+template <class Coder>
+int CodeNonzero(Coder& coder, int value, BitProbability* lengths, BitProbability* mantissa,
+                BitProbability& sign) {
+    const unsigned magnitude = std::abs(value);
+    const size_t length = BitLength(magnitude);
+    size_t coded_length = 1;
+    while (coded_length < kMaxLength &&
+           coder.Bit(lengths[coded_length - 1], length > coded_length)) {
+        ++coded_length;
+    }
+    unsigned coded = 1;
+    for (size_t bit = coded_length - 1; bit-- > 0;) {
+        coded = coded << 1 |
+                coder.Bit(mantissa[coded_length * kMaxLength + bit], magnitude >> bit & 1);
+    }
+    return coder.Bit(sign, value < 0) ? -static_cast<int>(coded) : static_cast<int>(coded);
+}
+
+// Codes the coefficients of every block, in place: a decoder must start from
+// zeros. |counts| is scratch for the nonzero counts of one component.
+template <class Coder>
+void CodeCoefficients(Coder& coder, Model& model, JpegCoefficients& coefficients,
+                      std::vector<uint8_t>& counts) {
+    for (size_t c = 0; c < coefficients.components.size(); ++c) {
+        const size_t cls = c == 0 ? 0 : 1;
+        const size_t blocks_w = coefficients.components[c].blocks_w;
+        const size_t blocks_h = coefficients.components[c].blocks_h;
+        const uint16_t* quant = coefficients.components[c].quant_table.data();
+        counts.assign(blocks_w * blocks_h, 0);
+        for (size_t row = 0; row < blocks_h; ++row) {
+            for (size_t column = 0; column < blocks_w; ++column) {
+                int16_t* block = coefficients.Block(c, row, column);
+                const int16_t* above = row > 0 ? coefficients.Block(c, row - 1, column) : nullptr;
+                const int16_t* left = column > 0 ? coefficients.Block(c, row, column - 1) : nullptr;
+
+                size_t nonzero = 0;
+                for (size_t i = 1; i < kBlockSz; ++i) {
+                    nonzero += block[i] != 0;
+                }
+                size_t neighbors = 0;
+                if (above && left) {
+                    neighbors = (counts[(row - 1) * blocks_w + column] +
+                                 counts[row * blocks_w + column - 1] + 1) / 2;
+                } else if (above) {
+                    neighbors = counts[(row - 1) * blocks_w + column];
+                } else if (left) {
+                    neighbors = counts[row * blocks_w + column - 1];
+                }
+                const size_t count_context =
+                    neighbors < 16 ? neighbors : std::min<size_t>(16 + (neighbors - 16) / 4, 27);
+                auto& tree = model.count[cls][count_context];
+                size_t node = 1;
+                for (size_t bit = 6; bit-- > 0;) {
+                    node = node << 1 | coder.Bit(tree[node], nonzero >> bit & 1);
+                }
+                size_t remaining = node - kBlockSz;
+                counts[row * blocks_w + column] = static_cast<uint8_t>(remaining);
+
+                for (size_t k = 0; k < kAcCnt && remaining > 0; ++k) {
+                    const size_t n = kCodingOrder[k];
+                    // What the neighbors suggest: their coefficients at the
+                    // same position, or for the first row and column the value
+                    // that continues the neighbor across the boundary.
+                    int hint;
+                    unsigned magnitude;
+                    if (k >= kInteriorCnt && (n < 8 ? above : left)) {
+                        hint = n < 8 ? PredictEdge(block, above, quant, n, true)
+                                     : PredictEdge(block, left, quant, n, false);
+                        magnitude = 2 * std::abs(hint);
+                    } else {
+                        const int above_value = above ? above[n] : 0;
+                        const int left_value = left ? left[n] : 0;
+                        hint = above_value + left_value;
+                        magnitude = std::abs(above_value) + std::abs(left_value);
+                        if (!above != !left) {
+                            magnitude *= 2;
+                        }
+                    }
+                    const size_t magnitude_bucket = Bucket(magnitude, kMagnitudeBuckets);
+                    const size_t remaining_bucket = Bucket(remaining, kRemainingBuckets);
+                    // The neighboring frequencies that are already known: in
+                    // the 7x7 part the lower ones, on the first row or column
+                    // the lower one there and the next one inwards.
+                    const size_t v = n / 8, u = n % 8;
+                    unsigned intra;
+                    if (v == 0 || u == 0) {
+                        const unsigned inward = std::abs(block[v == 0 ? n + 8 : n + 1]);
+                        intra = inward + (std::max(u, v) >= 2
+                                              ? std::abs(block[v == 0 ? n - 1 : n - 8])
+                                              : inward);
+                    } else {
+                        const bool up = v >= 2, back = u >= 2;
+                        intra = (up ? std::abs(block[n - 8]) : 0) +
+                                (back ? std::abs(block[n - 1]) : 0);
+                        if (up != back) {
+                            intra *= 2;
+                        }
+                    }
+                    const size_t intra_bucket = Bucket(intra, kIntraBuckets);
+                    if (!coder.Bit(model.zero[cls][k][remaining_bucket][magnitude_bucket]
+                                             [std::min<size_t>(intra_bucket, 3)],
+                                   block[n] != 0)) {
+                        block[n] = 0;
+                        continue;
+                    }
+                    --remaining;
+                    block[n] = static_cast<int16_t>(CodeNonzero(
+                        coder, block[n],
+                        model.ac_length[cls][kBandOfIndex[k]][magnitude_bucket][intra_bucket]
+                            .data(),
+                        model.ac_mantissa[cls][kBandOfIndex[k]].data(),
+                        model.ac_sign[cls][k][hint < 0 ? 0 : (hint == 0 ? 1 : 2)]
+                                     [Bucket(std::abs(hint), kMagnitudeBuckets)]));
+                }
+
+                // DC continues the neighbors across the boundaries.
+                int prediction = 0;
+                size_t spread_bucket = kMagnitudeBuckets;
+                if (above && left) {
+                    const int from_above = PredictEdge(block, above, quant, 0, true);
+                    const int from_left = PredictEdge(block, left, quant, 0, false);
+                    prediction = (from_above + from_left) / 2;
+                    spread_bucket = Bucket(std::abs(from_above - from_left), kMagnitudeBuckets);
+                } else if (above) {
+                    prediction = PredictEdge(block, above, quant, 0, true);
+                } else if (left) {
+                    prediction = PredictEdge(block, left, quant, 0, false);
+                }
+                prediction = std::clamp(prediction, -2048, 2047);
+                int residual = block[0] - prediction;
+                if (coder.Bit(model.dc_zero[cls][spread_bucket], residual != 0)) {
+                    residual = CodeNonzero(coder, residual,
+                                           model.dc_length[cls][spread_bucket].data(),
+                                           model.dc_mantissa[cls].data(),
+                                           model.dc_sign[cls][spread_bucket]);
+                } else {
+                    residual = 0;
+                }
+                block[0] = static_cast<int16_t>(prediction + residual);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+class JpegArchiver::Impl {
+public:
+    void Compress(std::string_view jpeg, std::string* archive) {
+        archive->assign(kMagic);
+        archive->push_back(static_cast<char>(kVersion));
+        // Small files do not give the model enough to learn from.
+        if (TryModel(jpeg, archive) && archive->size() < kMagic.size() + 2 + jpeg.size()) {
+            return;
+        }
+        archive->resize(kMagic.size() + 1);
+        archive->push_back(static_cast<char>(kModeStored));
+        archive->append(jpeg);
+    }
+
+    void Decompress(std::string_view archive, std::string* jpeg) {
+        if (archive.substr(0, kMagic.size()) != kMagic || archive.size() < kMagic.size() + 2 ||
+            archive[kMagic.size()] != static_cast<char>(kVersion)) {
+            throw std::runtime_error("Not an archive");
+        }
+        size_t pos = kMagic.size() + 1;
+        const uint8_t mode = archive[pos++];
+        if (mode == kModeStored) {
+            jpeg->assign(archive.substr(pos));
+            return;
+        }
+        if (mode != kModeModeled) {
+            throw std::runtime_error("Unknown archive mode");
+        }
+        const size_t head_size = GetSize(archive, pos);
+        pos += 4;
+        if (head_size > archive.size() - pos) {
+            throw std::runtime_error("Truncated archive");
+        }
+        const auto head_bytes = archive.substr(pos, head_size);
+        pos += head_size;
+        const size_t tail_size = GetSize(archive, pos);
+        pos += 4;
+        if (tail_size > archive.size() - pos) {
+            throw std::runtime_error("Truncated archive");
+        }
+        const auto tail = archive.substr(pos, tail_size);
+        pos += tail_size;
+        const size_t scan_size = GetSize(archive, pos);
+        pos += 4;
+        const auto coded = archive.substr(pos);
+
+        const auto head = ParseHead(head_bytes);
+        if (!head || head->size != head_size) {
+            throw std::runtime_error("Bad archived header");
+        }
+        SetLayout(*head, &coefficients_);
+        // Checked before the blocks are allocated, as the decoder does with a
+        // scan: a header of a few bytes may promise gigabytes of them.
+        const auto& last = coefficients_.components.back();
+        const size_t blocks = last.offset / kBlockSz + last.blocks_w * last.blocks_h;
+        if (blocks > scan_size * 8 / kMinBlockBits ||
+            blocks > coded.size() * kMaxBlocksPerCodedByte) {
+            throw std::runtime_error("Archived scan is too short for its frame");
+        }
+        coefficients_.coefficients.assign(blocks * kBlockSz, 0);
+        RangeDecoder decoder(coded);
+        model_->Reset();
+        CodeCoefficients(decoder, *model_, coefficients_, counts_);
+
+        jpeg->assign(head_bytes);
+        try {
+            WriteScanData(coefficients_, head->layout, Specs(*head, 0), Specs(*head, 1), jpeg);
+        } catch (const std::invalid_argument&) {
+            throw std::runtime_error("Corrupted archive");
+        }
+        if (jpeg->size() != head_size + scan_size) {
+            throw std::runtime_error("Corrupted archive");
+        }
+        jpeg->append(tail);
+    }
+
+private:
+    static std::array<HuffmanSpec, kBaselineTableIds> Specs(const Head& head,
+                                                           size_t table_class) {
+        std::array<HuffmanSpec, kBaselineTableIds> specs;
+        for (size_t id = 0; id < kBaselineTableIds; ++id) {
+            specs[id] = head.Spec(table_class, id);
+        }
+        return specs;
+    }
+
+    // Mode 1 when the scan of |jpeg| comes out of the scan writer byte for byte.
+    bool TryModel(std::string_view jpeg, std::string* archive) {
+        const auto head = ParseHead(jpeg);
+        if (!head) {
+            return false;
+        }
+        try {
+            decoder_.DecodeCoefficients(jpeg, &coefficients_);
+            SetLayout(*head, &expected_layout_);
+            if (!SameLayout(coefficients_, expected_layout_)) {
+                return false;
+            }
+            // The tables Decompress will find in the header.
+            for (size_t c = 0; c < coefficients_.components.size(); ++c) {
+                coefficients_.components[c].quant_table =
+                    expected_layout_.components[c].quant_table;
+            }
+            scan_.clear();
+            WriteScanData(coefficients_, head->layout, Specs(*head, 0), Specs(*head, 1), &scan_);
+        } catch (const std::exception&) {
+            return false;
+        }
+        if (jpeg.substr(head->size, scan_.size()) != scan_) {
+            return false;
+        }
+        const auto tail = jpeg.substr(head->size + scan_.size());
+        archive->push_back(static_cast<char>(kModeModeled));
+        PutSize(archive, head->size);
+        archive->append(jpeg.substr(0, head->size));
+        PutSize(archive, tail.size());
+        archive->append(tail);
+        PutSize(archive, scan_.size());
+
+        RangeEncoder encoder(archive);
+        model_->Reset();
+        CodeCoefficients(encoder, *model_, coefficients_, counts_);
+        encoder.Flush();
+        return true;
+    }
+
+    JpegDecoder decoder_;
+    JpegCoefficients coefficients_, expected_layout_;
+    std::string scan_;
+    std::unique_ptr<Model> model_ = std::make_unique<Model>();
+    std::vector<uint8_t> counts_;
+};
+
+JpegArchiver::JpegArchiver() : impl_(std::make_unique<Impl>()) {
+}
+
+JpegArchiver::JpegArchiver(JpegArchiver&&) noexcept = default;
+JpegArchiver& JpegArchiver::operator=(JpegArchiver&&) noexcept = default;
+JpegArchiver::~JpegArchiver() = default;
+
+void JpegArchiver::Compress(std::string_view jpeg, std::string* archive) {
+    impl_->Compress(jpeg, archive);
+}
+
+void JpegArchiver::Decompress(std::string_view archive, std::string* jpeg) {
+    impl_->Decompress(archive, jpeg);
+}
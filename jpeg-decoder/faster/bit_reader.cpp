@@ -1,4 +1,5 @@
 #include "bit_reader.h"
+#include "stats.h"
 
 #include <glog/logging.h>
 
@@ -13,19 +14,26 @@ uint16_t BitReader::ReadBits(uint8_t bits_cnt) {
     while (bits_cnt-- > 0) {
         if (buffer_size_ == 0) {
             char tmp;
-            if (!in_.read(&tmp, sizeof(buffer_))) {
+            if (!in_->read(&tmp, sizeof(buffer_))) {
                 DLOG(ERROR) << "Failed to read\n";
                 throw std::runtime_error("EOF");
             }
             buffer_ = static_cast<unsigned char>(tmp);
             buffer_size_ = kCharSz;
+            if constexpr (kCollectStats) {
+                ++bits_bytes_read_;
+            }
 
             if (buffer_ == 0xff) {
                 char next_char = 0;
-                in_.read(&next_char, 1);
-                if (!in_ || next_char != 0x00) {
+                in_->read(&next_char, 1);
+                if (!*in_ || next_char != 0x00) {
                     throw std::runtime_error("Encountered marker instead of 0xFF");
                 }
+                if constexpr (kCollectStats) {
+                    ++bits_bytes_read_;
+                    ++stuffed_bytes_;
+                }
             }
 
             // DLOG(INFO) << "Read one byte: 0x" << std::hex << (static_cast<uint16_t>(buffer_) &
@@ -59,11 +67,65 @@ uint8_t BitReader::ReadByte() const {
     }
 
     char data;
-    in_.read(&data, sizeof(data));
+    in_->read(&data, sizeof(data));
 
     return static_cast<uint8_t>(data);
 }
 
+void BitReader::ReadBytes(char* out, size_t size) {
+    if (buffer_size_ != 0) {
+        throw std::runtime_error("Bits not aligned");
+    }
+    if (!in_->read(out, static_cast<std::streamsize>(size))) {
+        throw std::runtime_error("EOF");
+    }
+}
+
+void BitReader::Skip(size_t size) {
+    if (buffer_size_ != 0) {
+        throw std::runtime_error("Bits not aligned");
+    }
+    in_->ignore(static_cast<std::streamsize>(size));
+    if (in_->gcount() != static_cast<std::streamsize>(size)) {
+        throw std::runtime_error("EOF");
+    }
+}
+
+std::string_view BitReader::ReadView(size_t size) {
+    if (buffer_size_ != 0) {
+        throw std::runtime_error("Bits not aligned");
+    }
+    auto* memory = dynamic_cast<MemoryStreamBuf*>(in_->rdbuf());
+    if (memory == nullptr) {
+        throw std::logic_error("Views need a MemoryStreamBuf input");
+    }
+    return memory->Take(size);
+}
+
+std::optional<std::string_view> BitReader::RemainingView() const {
+    if (buffer_size_ != 0) {
+        throw std::runtime_error("Bits not aligned");
+    }
+    if (const auto* memory = dynamic_cast<const MemoryStreamBuf*>(in_->rdbuf())) {
+        return memory->Remaining();
+    }
+    return std::nullopt;
+}
+
+bool BitReader::SkipPast(Word marker) {
+    if (buffer_size_ != 0) {
+        throw std::runtime_error("Bits not aligned");
+    }
+    using Traits = std::istream::traits_type;
+    Traits::int_type prev = Traits::eof();
+    for (auto c = in_->get(); !Traits::eq_int_type(c, Traits::eof()); prev = c, c = in_->get()) {
+        if (prev == (marker >> kCharSz) && c == (marker & 0xff)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 Word BitReader::ReadWord() {
     Word result = 0;
     result |= ReadByte();
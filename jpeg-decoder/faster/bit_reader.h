@@ -2,18 +2,52 @@
 
 #include <cstdint>
 #include <istream>
+#include <optional>
+#include <stdexcept>
+#include <streambuf>
+#include <string_view>
 
 using Word = uint16_t;
 
+// Read-only streambuf over a memory buffer. A BitReader on top of it hands out
+// views of the buffer (see ReadView) instead of copying bytes out.
+class MemoryStreamBuf : public std::streambuf {
+public:
+    void Reset(std::string_view data) {
+        char* begin = const_cast<char*>(data.data());  // NOLINT
+        setg(begin, begin, begin + data.size());
+    }
+
+    // The next |size| bytes, skipped over.
+    std::string_view Take(size_t size) {
+        if (static_cast<size_t>(egptr() - gptr()) < size) {
+            throw std::runtime_error("EOF");
+        }
+        const std::string_view view(gptr(), size);
+        gbump(static_cast<int>(size));
+        return view;
+    }
+
+    // Everything not read yet.
+    std::string_view Remaining() const {
+        return {gptr(), static_cast<size_t>(egptr() - gptr())};
+    }
+};
+
 class BitReader {
 public:
-    BitReader() = delete;
+    BitReader() = default;
     BitReader(const BitReader&) = delete;
     BitReader& operator=(const BitReader&) = delete;
     BitReader(BitReader&&) = default;
-    BitReader& operator=(BitReader&&) = delete;
+    BitReader& operator=(BitReader&&) = default;
 
-    explicit BitReader(std::istream& in) : in_(in) {
+    explicit BitReader(std::istream& in) : in_(&in) {
+    }
+
+    // Starts reading |in| from scratch, as if freshly constructed.
+    void Reset(std::istream& in) {
+        *this = BitReader(in);
     }
 
     uint16_t ReadBits(uint8_t bits_cnt = 1);
@@ -23,11 +57,35 @@ public:
 
     Word ReadWord();
 
+    // Bulk reads of segment payloads, they throw on EOF.
+    void ReadBytes(char* out, size_t size);
+    void Skip(size_t size);
+    // |size| bytes as a view into the input, which must be read through a
+    // MemoryStreamBuf. Valid as long as the input buffer is.
+    std::string_view ReadView(size_t size);
+    // The rest of the input if it is read through a MemoryStreamBuf.
+    std::optional<std::string_view> RemainingView() const;
+    // Skips bytes up to and including the first |marker|. Returns false if the
+    // input ends before it.
+    bool SkipPast(Word marker);
+
     void Align();
 
+    // Bytes loaded by ReadBits and how many of them were 0xFF 0x00 stuffing.
+    // Counted only when decoder stats are enabled.
+    size_t BitsBytesRead() const {
+        return bits_bytes_read_;
+    }
+
+    size_t StuffedBytes() const {
+        return stuffed_bytes_;
+    }
+
 private:
     static constexpr size_t kCharSz = sizeof(unsigned char) * 8;
-    std::istream& in_;
+    std::istream* in_ = nullptr;
     unsigned char buffer_{0};
     size_t buffer_size_{0};
+    size_t bits_bytes_read_{0};
+    size_t stuffed_bytes_{0};
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Appends entropy-coded data to a string, most significant bit first. Every
+// 0xFF byte is followed by a stuffed 0x00, as BitReader expects.
+class BitWriter {
+public:
+    explicit BitWriter(std::string* out) : out_(out) {
+    }
+
+    // The |count| (at most 24) lowest bits of |bits|.
+    void Write(uint32_t bits, uint8_t count) {
+        buffer_ = (buffer_ << count) | (bits & ((1u << count) - 1));
+        size_ += count;
+        while (size_ >= 8) {
+            size_ -= 8;
+            const auto byte = static_cast<char>((buffer_ >> size_) & 0xff);
+            out_->push_back(byte);
+            if (byte == '\xff') {
+                out_->push_back('\0');
+            }
+        }
+    }
+
+    // Pads the last byte with ones, so that the scan may end there.
+    void Flush() {
+        if (size_ > 0) {
+            Write(0x7f, 8 - size_);
+        }
+    }
+
+private:
+    std::string* out_;
+    uint32_t buffer_ = 0;
+    uint8_t size_ = 0;
+};
@@ -1,30 +1,80 @@
 #include <cmath>
+#include <decode_stats.h>
 #include <decoder.h>
 #include <glog/logging.h>
+#include <jpeg_decoder.h>
+#include <trace.h>
 
+#include "exif.h"
 #include "fft.h"
 #include "parsers.h"
+#include "stages.h"
+#include "stats.h"
+#include "worker_pool.h"
 
-void Mult(std::vector<int16_t> &one, const std::vector<uint16_t> &two) {
-    if (one.size() != two.size()) {
-        // DLOG(ERROR) << "Cannot multiply on quantum matrix\n"
-        //             << one.size() << " != " << two.size() << '\n';
-        throw std::runtime_error("Cannot multiply on quantum matrix");
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+namespace {
+
+// Where pixel (y, x) of a |height| x |width| image goes in its upright version
+// for EXIF |orientation|: 2 mirrors, 3 rotates by 180, 4 flips, 5 transposes,
+// 6 rotates clockwise, 7 transverses and 8 rotates counterclockwise.
+std::pair<size_t, size_t> OrientedPosition(uint8_t orientation, size_t y, size_t x,
+                                           size_t height, size_t width) {
+    switch (orientation) {
+        case 2:
+            return {y, width - 1 - x};
+        case 3:
+            return {height - 1 - y, width - 1 - x};
+        case 4:
+            return {height - 1 - y, x};
+        case 5:
+            return {x, y};
+        case 6:
+            return {x, height - 1 - y};
+        case 7:
+            return {width - 1 - x, height - 1 - y};
+        case 8:
+            return {width - 1 - x, y};
+        default:
+            return {y, x};
+    }
+}
+
+// Orientations 5..8 swap the axes.
+void SetOrientedSize(Image &ans, uint8_t orientation, size_t width, size_t height) {
+    if (orientation >= 5) {
+        std::swap(width, height);
     }
-    for (size_t i = 0; i < one.size(); ++i) {
-        one[i] *= two[i];
+    if (ans.Width() != width || ans.Height() != height) {
+        ans.SetSize(width, height);
     }
 }
 
-RGB YCbCrToRGB(const std::vector<int16_t> &channels) {
-    if (channels.empty()) {
-        // DLOG(ERROR) << "Channels is empty\n";
-        throw std::invalid_argument("Channels is empty");
+void SetOrientedPixel(Image &ans, uint8_t orientation, size_t y, size_t x, size_t height,
+                      size_t width, RGB pixel) {
+    if (orientation == 1) {
+        ans.SetPixel(y, x, pixel);
+    } else {
+        const auto [oriented_y, oriented_x] = OrientedPosition(orientation, y, x, height, width);
+        ans.SetPixel(oriented_y, oriented_x, pixel);
+    }
+}
+
+}  // namespace
+
+void Mult(int16_t *block, const std::array<uint16_t, kBlockSz> &table) {
+    for (size_t i = 0; i < kBlockSz; ++i) {
+        block[i] *= table[i];
     }
+}
 
-    const int y = channels[0] << 10;
-    const int cb = (channels.size() > 1) ? channels[1] - 128 : 0;
-    const int cr = (channels.size() > 2) ? channels[2] - 128 : 0;
+RGB YCbCrToRGB(int16_t y_value, int16_t cb_value, int16_t cr_value) {
+    const int y = y_value << 10;
+    const int cb = cb_value - 128;
+    const int cr = cr_value - 128;
 
     const int r_ans = y + 1402 * cr;
     const int g_ans = y - 344 * cb - 714 * cr;
@@ -48,95 +98,164 @@ RGB YCbCrToRGB(const std::vector<int16_t> &channels) {
     return ans;
 }
 
-void Quantization(const RawImage &raw_image, ImageData &image_data) {
-    const auto &meta = raw_image.metadata;
+void Quantization(const RawImage &raw_image, ImageData &image_data, uint16_t mcu_row_begin,
+                  uint16_t mcu_row_end) {
     const auto &quantum_tables = raw_image.quantum_tables;
-    const size_t channels_cnt = image_data.channel_ids.size();
 
-    for (size_t i = 0; i < channels_cnt; ++i) {
-        const auto channel_id = image_data.channel_ids[i];
-        const auto &channel_meta = meta.GetMetaByChannelId(channel_id);
+    for (size_t i = 0; i < image_data.ChannelsCount(); ++i) {
+        const auto &channel_meta = image_data.channels[i];
         const auto &quantum_table = quantum_tables[channel_meta.quant_id].value().data;
-        auto &channels_matrix = image_data.channel_matrix[i];
-        for (size_t j = 0; j < channels_matrix.size(); ++j) {
-            Mult(channels_matrix[j], quantum_table);
+        const size_t row_blocks = image_data.BlocksInMcuRow(i);
+        for (size_t j = mcu_row_begin * row_blocks; j < mcu_row_end * row_blocks; ++j) {
+            Mult(image_data.Block(i, j), quantum_table);
         }
     }
 }
 
-void IDCT(ImageData &image_data) {
-    const size_t channels_cnt = image_data.channel_ids.size();
-    std::vector<double> input_arr(64), output(64);
-    auto calc = DctCalculator(8, &input_arr, &output);
-    for (size_t i = 0; i < channels_cnt; ++i) {
-        auto &channels_matrix = image_data.channel_matrix[i];
-        for (size_t j = 0; j < channels_matrix.size(); ++j) {
-            for (size_t k = 0; k < channels_matrix[j].size(); ++k) {
-                input_arr[k] = static_cast<double>(channels_matrix[j][k]);
+#ifdef DECODER_FAST_START
+namespace {
+
+constexpr size_t kBlockSide = 8;
+
+// Taylor series, std::cos is not constexpr. Good to 1e-15 on [-pi, pi].
+constexpr double ConstexprCos(double x) {
+    constexpr double kPi = 3.141592653589793;
+    while (x > kPi) {
+        x -= 2 * kPi;
+    }
+    double term = 1, sum = 1;
+    for (int n = 1; n < 20; ++n) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+// kIdctBasis[x][u] = C(u) / 2 * cos((2x + 1) u pi / 16), C(0) = 1 / sqrt(2), C(u) = 1:
+// the same transform DctCalculator computes with FFTW, without a plan to build.
+constexpr auto kIdctBasis = [] {
+    constexpr double kPi = 3.141592653589793;
+    constexpr double kHalfInvSqrtTwo = 0.35355339059327373;
+    std::array<std::array<double, kBlockSide>, kBlockSide> basis{};
+    for (size_t x = 0; x < kBlockSide; ++x) {
+        for (size_t u = 0; u < kBlockSide; ++u) {
+            basis[x][u] = (u == 0 ? kHalfInvSqrtTwo : 0.5) *
+                          ConstexprCos(static_cast<double>((2 * x + 1) * u) * kPi / 16);
+        }
+    }
+    return basis;
+}();
+
+// Separable 8x8 IDCT: rows, then columns.
+void InverseDct(int16_t *block) {
+    double rows[kBlockSz];
+    for (size_t v = 0; v < kBlockSide; ++v) {
+        for (size_t x = 0; x < kBlockSide; ++x) {
+            double sum = 0;
+            for (size_t u = 0; u < kBlockSide; ++u) {
+                sum += kIdctBasis[x][u] * block[v * kBlockSide + u];
             }
-            calc.Inverse();
-            for (size_t k = 0; k < output.size(); ++k) {
-                channels_matrix[j][k] = static_cast<int16_t>(std::round(output[k]));
+            rows[v * kBlockSide + x] = sum;
+        }
+    }
+    for (size_t y = 0; y < kBlockSide; ++y) {
+        for (size_t x = 0; x < kBlockSide; ++x) {
+            double sum = 0;
+            for (size_t v = 0; v < kBlockSide; ++v) {
+                sum += kIdctBasis[y][v] * rows[v * kBlockSide + x];
             }
+            block[y * kBlockSide + x] = static_cast<int16_t>(std::round(sum));
         }
     }
 }
 
-void Rationing(ImageData &image_data) {
-    const size_t channels_cnt = image_data.channel_ids.size();
-    for (size_t i = 0; i < channels_cnt; ++i) {
-        auto &channels_matrix = image_data.channel_matrix[i];
-        for (size_t j = 0; j < channels_matrix.size(); ++j) {
-            for (size_t k = 0; k < channels_matrix[j].size(); ++k) {
-                channels_matrix[j][k] =
-                    std::min<int16_t>(std::max<int16_t>(0, channels_matrix[j][k] + 128), 255);
+}  // namespace
+
+void IDCT(ImageData &image_data, StagesContext &, uint16_t mcu_row_begin,
+          uint16_t mcu_row_end) {
+    for (size_t i = 0; i < image_data.ChannelsCount(); ++i) {
+        const size_t row_blocks = image_data.BlocksInMcuRow(i);
+        for (size_t j = mcu_row_begin * row_blocks; j < mcu_row_end * row_blocks; ++j) {
+            InverseDct(image_data.Block(i, j));
+        }
+    }
+}
+#else
+void IDCT(ImageData &image_data, StagesContext &context, uint16_t mcu_row_begin,
+          uint16_t mcu_row_end) {
+    auto &input_arr = context.idct_input;
+    const auto &output = context.idct_output;
+    for (size_t i = 0; i < image_data.ChannelsCount(); ++i) {
+        const size_t row_blocks = image_data.BlocksInMcuRow(i);
+        for (size_t j = mcu_row_begin * row_blocks; j < mcu_row_end * row_blocks; ++j) {
+            int16_t *block = image_data.Block(i, j);
+            for (size_t k = 0; k < kBlockSz; ++k) {
+                input_arr[k] = static_cast<double>(block[k]);
+            }
+            context.dct.Inverse();
+            for (size_t k = 0; k < kBlockSz; ++k) {
+                block[k] = static_cast<int16_t>(std::round(output[k]));
             }
         }
     }
 }
+#endif
 
-void GetAns(const ImageData &image_data, const ImageMetadata &meta, Image &ans) {
-    const size_t channels_cnt = image_data.channel_ids.size();
-    uint8_t h_max = 0, v_max = 0;
-    std::vector<ChannelMetadata> channel_metadata(channels_cnt);
-    std::vector<std::pair<uint16_t, uint16_t>> scaling(channels_cnt);
-    for (size_t c = 0; c < channels_cnt; ++c) {
-        h_max = std::max(h_max, meta.channels[c].h);
-        v_max = std::max(v_max, meta.channels[c].v);
-        const uint8_t channel_id = image_data.channel_ids[c];
-        channel_metadata[c] = meta.GetMetaByChannelId(channel_id);
-        scaling[c] = std::make_pair(v_max / channel_metadata[c].v, h_max / channel_metadata[c].h);
+void Rationing(ImageData &image_data, uint16_t mcu_row_begin, uint16_t mcu_row_end) {
+    for (size_t i = 0; i < image_data.ChannelsCount(); ++i) {
+        const size_t row_blocks = image_data.BlocksInMcuRow(i);
+        for (size_t j = mcu_row_begin * row_blocks; j < mcu_row_end * row_blocks; ++j) {
+            int16_t *block = image_data.Block(i, j);
+            for (size_t k = 0; k < kBlockSz; ++k) {
+                block[k] = std::min<int16_t>(std::max<int16_t>(0, block[k] + 128), 255);
+            }
+        }
     }
+}
 
-    std::vector buffer(channels_cnt, std::vector<int16_t>(64 * h_max * v_max));
+void GetAns(const ImageData &image_data, const ImageMetadata &meta, StagesContext &context,
+            uint16_t mcu_row_begin, uint16_t mcu_row_end, Image &ans, uint8_t orientation) {
+    const size_t channels_cnt = image_data.ChannelsCount();
+    if (channels_cnt == 0) {
+        // DLOG(ERROR) << "Channels is empty\n";
+        throw std::invalid_argument("Channels is empty");
+    }
+    const uint8_t h_max = image_data.h_max, v_max = image_data.v_max;
     const uint16_t mcu_h_sz = 8 * v_max, mcu_w_sz = 8 * h_max;
-    std::vector<size_t> now_block(channels_cnt, 0);
-    std::vector<int16_t> channels_values(channels_cnt);
-    for (size_t mcu_y = 0; mcu_y < image_data.mcu_h; ++mcu_y) {
+    const size_t mcu_sz = static_cast<size_t>(mcu_h_sz) * mcu_w_sz;
+
+    auto &buffer = context.mcu_samples;
+    buffer.resize(channels_cnt * mcu_sz);
+    for (size_t mcu_y = mcu_row_begin; mcu_y < mcu_row_end; ++mcu_y) {
         for (uint16_t mcu_x = 0; mcu_x < image_data.mcu_w; ++mcu_x) {
-            const uint16_t mcu_y_start = mcu_y * mcu_h_sz, mcu_x_start = mcu_x * mcu_w_sz;
+            const size_t mcu_y_start = mcu_y * mcu_h_sz, mcu_x_start = mcu_x * mcu_w_sz;
 
             for (size_t c = 0; c < channels_cnt; ++c) {
-                const auto &channel_meta = channel_metadata[c];
+                const auto &channel_meta = image_data.channels[c];
                 const uint8_t h = channel_meta.h, v = channel_meta.v;
-                const auto &[v_scale, h_scale] = scaling[c];
+                const size_t v_scale = v_max / v, h_scale = h_max / h;
+                const size_t first_block = (mcu_y * image_data.mcu_w + mcu_x) * h * v;
+                int16_t *samples = buffer.data() + c * mcu_sz;
 
                 for (size_t block_v = 0; block_v < v; ++block_v) {
                     for (size_t block_h = 0; block_h < h; ++block_h) {
-                        const auto &block = image_data.channel_matrix[c][now_block[c]++];
-                        const size_t block_y_start = mcu_y_start + block_v * 8 * v_scale;
-                        const size_t block_x_start = mcu_x_start + block_h * 8 * h_scale;
+                        const int16_t *block =
+                            image_data.Block(c, first_block + block_v * h + block_h);
+                        const size_t block_y_start = block_v * 8 * v_scale;
+                        const size_t block_x_start = block_h * 8 * h_scale;
 
                         for (uint8_t local_y = 0; local_y < 8; ++local_y) {
                             for (uint8_t local_x = 0; local_x < 8; ++local_x) {
-                                const size_t value = block[local_y * 8 + local_x];
+                                const int16_t value = block[local_y * 8 + local_x];
                                 const size_t real_y = block_y_start + local_y * v_scale;
                                 const size_t real_x = block_x_start + local_x * h_scale;
 
                                 for (size_t delta_y = 0; delta_y < v_scale; ++delta_y) {
                                     for (size_t delta_x = 0; delta_x < h_scale; ++delta_x) {
-                                        buffer[c][(real_y + delta_y - mcu_y_start) * mcu_w_sz +
-                                                  real_x + delta_x - mcu_x_start] = value;
+                                        const size_t y = real_y + delta_y, x = real_x + delta_x;
+                                        if (y < mcu_h_sz && x < mcu_w_sz) {
+                                            samples[y * mcu_w_sz + x] = value;
+                                        }
                                     }
                                 }
                             }
@@ -145,46 +264,399 @@ void GetAns(const ImageData &image_data, const ImageMetadata &meta, Image &ans)
                 }
             }
 
-            for (size_t delta_y = 0; delta_y < 8 * v_max; ++delta_y) {
-                for (size_t delta_x = 0; delta_x < 8 * h_max; ++delta_x) {
-                    const size_t ind = delta_y * mcu_w_sz + delta_x;
-                    for (size_t c = 0; c < channels_cnt; ++c) {
-                        channels_values[c] = buffer[c][ind];
-                    }
-                    const size_t y = mcu_y_start + delta_y;
+            for (size_t delta_y = 0; delta_y < mcu_h_sz; ++delta_y) {
+                const size_t y = mcu_y_start + delta_y;
+                if (y >= meta.height) {
+                    break;
+                }
+                for (size_t delta_x = 0; delta_x < mcu_w_sz; ++delta_x) {
                     const size_t x = mcu_x_start + delta_x;
-                    if (y < meta.height && x < meta.width) {
-                        ans.SetPixel(y, x, YCbCrToRGB(channels_values));
+                    if (x >= meta.width) {
+                        break;
+                    }
+                    const size_t ind = delta_y * mcu_w_sz + delta_x;
+                    RGB pixel;
+                    if (channels_cnt >= 3) {
+                        pixel = YCbCrToRGB(buffer[ind], buffer[mcu_sz + ind],
+                                           buffer[2 * mcu_sz + ind]);
+                    } else if (channels_cnt == 2) {
+                        pixel = YCbCrToRGB(buffer[ind], buffer[mcu_sz + ind]);
+                    } else {
+                        pixel = YCbCrToRGB(buffer[ind]);
                     }
+                    SetOrientedPixel(ans, orientation, y, x, meta.height, meta.width, pixel);
                 }
             }
         }
     }
 }
 
-Image Decode(std::istream &input) {
-    // DLOG(INFO) << "Starting decoder\n";
-    auto parser = Parser(input);
+namespace {
+
+// One pixel per 8x8 block of the full image: DC / 8 is the mean of the
+// block after IDCT. Chroma blocks cover h_max / h by v_max / v pixels.
+void GetDcPreview(const RawImage &raw_image, uint8_t orientation, Image &ans) {
+    const auto &image_data = raw_image.data;
+    const size_t channels_cnt = image_data.ChannelsCount();
+    if (channels_cnt == 0) {
+        throw std::invalid_argument("Channels is empty");
+    }
+    const size_t height = (raw_image.metadata.height + 7) / 8;
+    const size_t width = (raw_image.metadata.width + 7) / 8;
+    SetOrientedSize(ans, orientation, width, height);
+
+    int16_t samples[3] = {128, 128, 128};
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            for (size_t c = 0; c < std::min<size_t>(channels_cnt, 3); ++c) {
+                const auto &channel = image_data.channels[c];
+                const size_t block_y = y * channel.v / image_data.v_max;
+                const size_t block_x = x * channel.h / image_data.h_max;
+                const size_t mcu = block_y / channel.v * image_data.mcu_w + block_x / channel.h;
+                const size_t index = mcu * channel.h * channel.v +
+                                     block_y % channel.v * channel.h + block_x % channel.h;
+                const uint16_t quant = raw_image.quantum_tables[channel.quant_id].value().data[0];
+                const long dc = std::lround(image_data.Block(c, index)[0] * quant / 8.0);
+                samples[c] = static_cast<int16_t>(std::clamp<long>(dc + 128, 0, 255));
+            }
+            SetOrientedPixel(ans, orientation, y, x, height, width,
+                             YCbCrToRGB(samples[0], samples[1], samples[2]));
+        }
+    }
+}
+
+// Blocks go from the MCU order of ImageData to raster order per component.
+void ExportCoefficients(const RawImage &raw_image, JpegCoefficients *coefficients) {
+    const auto &image_data = raw_image.data;
+    coefficients->width = raw_image.metadata.width;
+    coefficients->height = raw_image.metadata.height;
+    coefficients->h_max = image_data.h_max;
+    coefficients->v_max = image_data.v_max;
+    coefficients->components.resize(image_data.ChannelsCount());
+
+    size_t offset = 0;
+    for (size_t c = 0; c < image_data.ChannelsCount(); ++c) {
+        const auto &channel = image_data.channels[c];
+        auto &component = coefficients->components[c];
+        component.id = channel.channel_id;
+        component.h = channel.h;
+        component.v = channel.v;
+        component.quant_table = raw_image.quantum_tables[channel.quant_id].value().data;
+        component.blocks_w = static_cast<size_t>(image_data.mcu_w) * channel.h;
+        component.blocks_h = static_cast<size_t>(image_data.mcu_h) * channel.v;
+        component.offset = offset;
+        offset += component.blocks_w * component.blocks_h * kBlockSz;
+    }
+    coefficients->coefficients.resize(offset);
 
-    const auto raw_image = parser.ReadRawImage();
+    for (size_t c = 0; c < image_data.ChannelsCount(); ++c) {
+        const auto &component = coefficients->components[c];
+        const size_t h = component.h, v = component.v;
+        for (size_t row = 0; row < component.blocks_h; ++row) {
+            for (size_t column = 0; column < component.blocks_w; ++column) {
+                const size_t mcu = row / v * image_data.mcu_w + column / h;
+                const int16_t *block = image_data.Block(c, mcu * h * v + row % v * h + column % h);
+                std::copy_n(block, kBlockSz, coefficients->Block(c, row, column));
+            }
+        }
+    }
+}
 
-    const auto &meta = raw_image.metadata;
+}  // namespace
 
-    Image ans(meta.width, raw_image.metadata.height);
+class JpegDecoder::Impl {
+public:
+    // Contexts are created here, not in worker threads, see JpegDecoder(size_t).
+    explicit Impl(size_t threads) : pool_(CheckThreads(threads) - 1), worker_stats_(threads) {
+        for (size_t i = 0; i < threads; ++i) {
+            contexts_.push_back(std::make_unique<StagesContext>());
+        }
+        // Scans of one component each are independent, with threads to spare
+        // they are decoded side by side once all of them are located.
+        parser_.SetDeferScans(threads > 1);
+    }
 
-    ans.SetComment(raw_image.comment);
+    void Decode(std::string_view input, Image *ans, std::vector<JpegSegment> *segments,
+                DecodeStats *stats) {
+        memory_buf_.Reset(input);
+        std::istream stream(&memory_buf_);
+        Decode(stream, ans, segments, stats);
+    }
 
-    ImageData image_data = raw_image.data;
+    void SetApplyExifOrientation(bool apply) {
+        apply_orientation_ = apply;
+        parser_.SetReadOrientation(apply);
+    }
 
-    Quantization(raw_image, image_data);
-    ;
+    void DecodeThumbnail(std::string_view input, Image *ans) {
+        if (const auto exif = Exif::Find(input)) {
+            if (const auto thumbnail = exif->Thumbnail(); !thumbnail.empty()) {
+                try {
+                    // The thumbnail has no EXIF of its own, the orientation is the image's.
+                    memory_buf_.Reset(thumbnail);
+                    std::istream stream(&memory_buf_);
+                    Decode(stream, ans, nullptr, nullptr,
+                           apply_orientation_ ? exif->Orientation() : 1);
+                    return;
+                } catch (const std::exception &) {
+                    // A broken thumbnail is no reason to fail, the image itself may be fine.
+                }
+            }
+        }
+        memory_buf_.Reset(input);
+        std::istream stream(&memory_buf_);
+        parser_.Reset(stream);
+        parser_.ReadRawImage(&raw_image_);
+        DecodePendingScans(nullptr);
+        GetDcPreview(raw_image_, apply_orientation_ ? raw_image_.orientation : 1, *ans);
+        ans->SetComment(raw_image_.comment);
+    }
+
+    void DecodeCoefficients(std::istream &input, JpegCoefficients *coefficients,
+                            std::vector<JpegSegment> *segments = nullptr) {
+        TRACE_SCOPE("decode_coefficients");
+        parser_.Reset(input, nullptr, segments);
+        parser_.ReadRawImage(&raw_image_);
+        DecodePendingScans(nullptr);
+        ExportCoefficients(raw_image_, coefficients);
+    }
 
-    IDCT(image_data);
+    void DecodeCoefficients(std::string_view input, JpegCoefficients *coefficients,
+                            std::vector<JpegSegment> *segments) {
+        memory_buf_.Reset(input);
+        std::istream stream(&memory_buf_);
+        DecodeCoefficients(stream, coefficients, segments);
+    }
 
-    Rationing(image_data);
+    // |orientation| overrides the EXIF one of the input.
+    void Decode(std::istream &input, Image *ans, std::vector<JpegSegment> *segments,
+                DecodeStats *stats, std::optional<uint8_t> orientation = std::nullopt) {
+        parser_.Reset(input, stats, segments);
+        DecodeWith(ans, stats, orientation, [&] {
+            parser_.ReadRawImage(&raw_image_);
+            return true;
+        });
+    }
 
-    GetAns(image_data, meta, ans);
+    // Next frame of a Motion-JPEG stream, false at its end.
+    bool DecodeFrame(std::istream &input, Image *ans, DecodeStats *stats) {
+        parser_.Reset(input, stats);
+        return DecodeWith(ans, stats, std::nullopt,
+                          [&] { return parser_.ReadNextRawImage(&raw_image_); });
+    }
 
-    // DLOG(INFO) << "Finished decoder\n";
+    void SetKeepTables(bool keep) {
+        parser_.SetKeepTables(keep);
+    }
+
+private:
+    static size_t CheckThreads(size_t threads) {
+        if (threads == 0) {
+            throw std::invalid_argument("Zero threads");
+        }
+        return threads;
+    }
+
+    // Parses an image with |read|, which returns false if there is none, and
+    // writes its pixels to |ans|.
+    template <class Read>
+    bool DecodeWith(Image *ans, DecodeStats *stats, std::optional<uint8_t> orientation,
+                    Read read) {
+        // DLOG(INFO) << "Starting decoder\n";
+        TRACE_SCOPE("decode");
+        [[maybe_unused]] size_t allocations_before = 0;
+        if constexpr (kCollectStats) {
+            if (stats != nullptr) {
+                *stats = DecodeStats{};
+                allocations_before = AllocationsCount();
+            }
+        }
+
+        {
+            StageTimer timer(stats, &DecodeStats::Stages::markers);
+            TRACE_SCOPE("markers");
+            if (!read()) {
+                return false;
+            }
+        }
+        if constexpr (kCollectStats) {
+            if (stats != nullptr) {
+                // The markers time includes the scans read inline, keep only the marker parsing.
+                stats->time.markers -= stats->time.entropy;
+            }
+        }
+        DecodePendingScans(stats);
+
+        const auto &meta = raw_image_.metadata;
+        auto &image_data = raw_image_.data;
+
+        if (!orientation) {
+            orientation = apply_orientation_ ? raw_image_.orientation : 1;
+        }
+        SetOrientedSize(*ans, *orientation, meta.width, meta.height);
+        ans->SetComment(raw_image_.comment);
+
+        {
+            StageTimer timer(stats, &DecodeStats::Stages::dequantization);
+            ForEachRows("dequantization", [&](uint16_t begin, uint16_t end, StagesContext &) {
+                Quantization(raw_image_, image_data, begin, end);
+            });
+        }
+
+        {
+            StageTimer timer(stats, &DecodeStats::Stages::idct);
+            ForEachRows("idct", [&](uint16_t begin, uint16_t end, StagesContext &context) {
+                IDCT(image_data, context, begin, end);
+            });
+        }
+
+        {
+            StageTimer timer(stats, &DecodeStats::Stages::level_shift);
+            ForEachRows("level_shift", [&](uint16_t begin, uint16_t end, StagesContext &) {
+                Rationing(image_data, begin, end);
+            });
+        }
+
+        {
+            StageTimer timer(stats, &DecodeStats::Stages::color);
+            ForEachRows("color", [&](uint16_t begin, uint16_t end, StagesContext &context) {
+                GetAns(image_data, meta, context, begin, end, *ans, *orientation);
+            });
+        }
+
+        if constexpr (kCollectStats) {
+            if (stats != nullptr) {
+                stats->allocations = AllocationsCount() - allocations_before;
+            }
+        }
+
+        // DLOG(INFO) << "Finished decoder\n";
+        return true;
+    }
+
+    // Decodes the scans the parser deferred, scan i on worker i % threads.
+    void DecodePendingScans(DecodeStats *stats) {
+        const size_t scans = parser_.PendingScansCount();
+        if (scans == 0) {
+            return;
+        }
+        StageTimer timer(stats, &DecodeStats::Stages::entropy);
+        TRACE_SCOPE("entropy");
+        const size_t workers_cnt = std::min(scans, pool_.Size());
+        RunTraced(workers_cnt, [&](size_t i) {
+            TRACE_SCOPE("scan");
+            worker_stats_[i] = DecodeStats{};
+            for (size_t scan = i; scan < scans; scan += workers_cnt) {
+                parser_.DecodePendingScan(scan, &raw_image_,
+                                          stats != nullptr ? &worker_stats_[i] : nullptr);
+            }
+        });
+        if constexpr (kCollectStats) {
+            if (stats != nullptr) {
+                for (size_t i = 0; i < workers_cnt; ++i) {
+                    const auto &worker = worker_stats_[i];
+                    stats->blocks += worker.blocks;
+                    stats->dc_only_blocks += worker.dc_only_blocks;
+                    stats->eob_position_sum += worker.eob_position_sum;
+                    stats->scan_bytes += worker.scan_bytes;
+                    stats->stuffed_bytes += worker.stuffed_bytes;
+                }
+            }
+        }
+    }
+
+    // Splits the MCU rows into one contiguous slice per context and runs |fn|
+    // on them, the first slice on the calling thread. Slices touch disjoint
+    // blocks and output rows. |name| must be a string literal, it is traced.
+    template <class F>
+    void ForEachRows(const char *name, F fn) {
+        const uint16_t rows = raw_image_.data.mcu_h;
+        const size_t slices = std::min<size_t>(contexts_.size(), rows);
+        if (slices <= 1) {
+            TRACE_SCOPE(name);
+            fn(0, rows, *contexts_[0]);
+            return;
+        }
+        RunTraced(slices, [&](size_t i) {
+            TRACE_SCOPE(name);
+            fn(rows * i / slices, rows * (i + 1) / slices, *contexts_[i]);
+        });
+    }
+
+    // Runs |fn| on the pool, tracing the workers if the calling thread is traced.
+    template <class F>
+    void RunTraced(size_t tasks, F fn) {
+        const bool traced = trace::IsEnabled();
+        pool_.Run(tasks, [&](size_t i) {
+            trace::ScopedEnable tracing(traced);
+            fn(i);
+        });
+    }
+
+    Parser parser_;
+    RawImage raw_image_;
+    MemoryStreamBuf memory_buf_;
+    bool apply_orientation_ = false;
+    std::vector<std::unique_ptr<StagesContext>> contexts_;
+    // Threads besides the calling one, started with the decoder.
+    WorkerPool pool_;
+    std::vector<DecodeStats> worker_stats_;
+};
+
+JpegDecoder::JpegDecoder(size_t threads) : impl_(std::make_unique<Impl>(threads)) {
+}
+
+void JpegDecoder::Decode(std::istream &input, Image *image, DecodeStats *stats) {
+    impl_->Decode(input, image, nullptr, stats);
+}
+
+Image JpegDecoder::Decode(std::istream &input, DecodeStats *stats) {
+    Image ans;
+    impl_->Decode(input, &ans, nullptr, stats);
     return ans;
 }
+
+void JpegDecoder::Decode(std::string_view input, Image *image,
+                         std::vector<JpegSegment> *segments, DecodeStats *stats) {
+    impl_->Decode(input, image, segments, stats);
+}
+
+void JpegDecoder::SetApplyExifOrientation(bool apply) {
+    impl_->SetApplyExifOrientation(apply);
+}
+
+void JpegDecoder::DecodeThumbnail(std::string_view input, Image *image) {
+    impl_->DecodeThumbnail(input, image);
+}
+
+void JpegDecoder::DecodeCoefficients(std::istream &input, JpegCoefficients *coefficients) {
+    impl_->DecodeCoefficients(input, coefficients);
+}
+
+void JpegDecoder::DecodeCoefficients(std::string_view input, JpegCoefficients *coefficients,
+                                     std::vector<JpegSegment> *segments) {
+    impl_->DecodeCoefficients(input, coefficients, segments);
+}
+
+JpegDecoder::JpegDecoder(JpegDecoder &&) noexcept = default;
+
+JpegDecoder &JpegDecoder::operator=(JpegDecoder &&) noexcept = default;
+
+JpegDecoder::~JpegDecoder() = default;
+
+MjpegDecoder::MjpegDecoder(std::istream &input, size_t threads)
+    : input_(&input), decoder_(threads) {
+    decoder_.impl_->SetKeepTables(true);
+}
+
+bool MjpegDecoder::NextFrame(Image *image, DecodeStats *stats) {
+    return decoder_.impl_->DecodeFrame(*input_, image, stats);
+}
+
+Image Decode(std::istream &input) {
+    return Decode(input, nullptr);
+}
+
+Image Decode(std::istream &input, DecodeStats *stats) {
+    return JpegDecoder().Decode(input, stats);
+}
@@ -0,0 +1,697 @@
+#include <jpeg_encoder.h>
+
+#include "bit_writer.h"
+#include "parsers.h"
+#include "scan_writer.h"
+#include "standard_tables.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint8_t kSoi = 0xd8, kEoi = 0xd9, kSof0 = 0xc0, kSof1 = 0xc1, kDht = 0xc4,
+                  kDqt = 0xdb, kSos = 0xda;
+// Blocks of all components in one MCU of an interleaved scan.
+constexpr size_t kMaxBlocksInMcu = 10;
+constexpr uint8_t kEob = 0x00, kZrl = 0xf0, kRst0 = 0xd0;
+// Table 0 for the first component, 1 for the others, no restarts.
+constexpr ScanLayout kDefaultLayout = {{0, 1, 1, 1}, {0, 1, 1, 1}, 0};
+
+// Code and length of every symbol of a table, 0 length for the unused ones.
+struct HuffmanCodes {
+    std::array<uint16_t, kU8Cnt> code{};
+    std::array<uint8_t, kU8Cnt> length{};
+};
+
+// Canonical codes of Annex C, as HuffmanTree::Build assigns them.
+constexpr HuffmanCodes BuildCodes(const HuffmanSpec& spec) {
+    HuffmanCodes codes;
+    uint32_t code = 0;
+    size_t value_index = 0;
+    for (size_t length = 1; length <= spec.code_lengths.size(); ++length) {
+        for (uint8_t i = 0; i < spec.code_lengths[length - 1]; ++i, ++code) {
+            const uint8_t value = spec.values[value_index++];
+            codes.code[value] = static_cast<uint16_t>(code);
+            codes.length[value] = static_cast<uint8_t>(length);
+        }
+        code <<= 1;
+    }
+    return codes;
+}
+
+constexpr HuffmanCodes kDcCodes[] = {BuildCodes(standard_tables::kDcLuminance),
+                                     BuildCodes(standard_tables::kDcChrominance)};
+constexpr HuffmanCodes kAcCodes[] = {BuildCodes(standard_tables::kAcLuminance),
+                                     BuildCodes(standard_tables::kAcChrominance)};
+
+void PutByte(std::string* out, uint8_t value) {
+    out->push_back(static_cast<char>(value));
+}
+
+void PutWord(std::string* out, uint16_t value) {
+    PutByte(out, value >> 8);
+    PutByte(out, value & 0xff);
+}
+
+void PutMarker(std::string* out, uint8_t marker) {
+    PutByte(out, 0xff);
+    PutByte(out, marker);
+}
+
+// Marker and length of a segment with |size| bytes of payload.
+void PutSegmentHeader(std::string* out, uint8_t marker, size_t size) {
+    PutMarker(out, marker);
+    PutWord(out, static_cast<uint16_t>(size + 2));
+}
+
+void PutHuffmanTable(std::string* out, uint8_t table_class, uint8_t table_id,
+                     const HuffmanSpec& spec) {
+    PutSegmentHeader(out, kDht, 1 + spec.code_lengths.size() + spec.values.size());
+    PutByte(out, table_class << 4 | table_id);
+    for (const uint8_t count : spec.code_lengths) {
+        PutByte(out, count);
+    }
+    for (const uint8_t value : spec.values) {
+        PutByte(out, value);
+    }
+}
+
+// Bits needed for |value|: its magnitude category.
+uint8_t Category(int value) {
+    unsigned magnitude = value < 0 ? -value : value;
+    uint8_t bits = 0;
+    while (magnitude != 0) {
+        ++bits;
+        magnitude >>= 1;
+    }
+    return bits;
+}
+
+// Largest magnitude categories of 8-bit baseline: DC differences and AC values.
+constexpr uint8_t kMaxDcCategory = 11, kMaxAcCategory = 10;
+
+// Writes the symbols of a scan with the codes of its tables.
+class SymbolWriter {
+public:
+    using Tables = std::array<const HuffmanCodes*, kBaselineTableIds>;
+
+    SymbolWriter(std::string* out, const Tables& dc_codes, const Tables& ac_codes)
+        : out_(out), writer_(out), dc_codes_(dc_codes), ac_codes_(ac_codes) {
+    }
+
+    void Dc(size_t table, uint8_t symbol) {
+        Put(*dc_codes_[table], symbol);
+    }
+
+    void Ac(size_t table, uint8_t symbol) {
+        Put(*ac_codes_[table], symbol);
+    }
+
+    void Bits(uint32_t bits, uint8_t count) {
+        writer_.Write(bits, count);
+    }
+
+    void Flush() {
+        writer_.Flush();
+    }
+
+    // Ends an interval: the bits so far padded to a byte, then RSTn.
+    void Restart(size_t index) {
+        writer_.Flush();
+        PutMarker(out_, kRst0 + index % 8);
+    }
+
+private:
+    void Put(const HuffmanCodes& codes, uint8_t symbol) {
+        if (codes.length[symbol] == 0) {
+            throw std::invalid_argument("No Huffman code for a coefficient");
+        }
+        writer_.Write(codes.code[symbol], codes.length[symbol]);
+    }
+
+    std::string* out_;
+    BitWriter writer_;
+    Tables dc_codes_, ac_codes_;
+};
+
+// Counts the symbols of a scan per table, for BuildOptimalTable.
+struct SymbolCounter {
+    void Dc(size_t table, uint8_t symbol) {
+        ++dc_counts[table][symbol];
+    }
+
+    void Ac(size_t table, uint8_t symbol) {
+        ++ac_counts[table][symbol];
+    }
+
+    void Bits(uint32_t, uint8_t) {
+    }
+
+    void Restart(size_t) {
+    }
+
+    std::array<std::array<uint32_t, kU8Cnt>, kBaselineTableIds> dc_counts{}, ac_counts{};
+};
+
+// Negative values go out as value - 1 in |category| bits.
+uint32_t ValueBits(int value) {
+    return static_cast<uint32_t>(value < 0 ? value - 1 : value);
+}
+
+template <class Emitter>
+void EncodeBlock(Emitter& out, const int16_t* block, int16_t& prev_dc, size_t dc_table,
+                 size_t ac_table) {
+    const int diff = block[0] - prev_dc;
+    prev_dc = block[0];
+    const uint8_t dc_category = Category(diff);
+    if (dc_category > kMaxDcCategory) {
+        throw std::invalid_argument("DC difference out of range");
+    }
+    out.Dc(dc_table, dc_category);
+    out.Bits(ValueBits(diff), dc_category);
+
+    uint8_t run = 0;
+    for (size_t i = 1; i < kBlockSz; ++i) {
+        const int value = block[kZigZagToNatural[i]];
+        if (value == 0) {
+            ++run;
+            continue;
+        }
+        for (; run > 15; run -= 16) {
+            out.Ac(ac_table, kZrl);
+        }
+        const uint8_t category = Category(value);
+        if (category > kMaxAcCategory) {
+            throw std::invalid_argument("Coefficient out of range");
+        }
+        out.Ac(ac_table, run << 4 | category);
+        out.Bits(ValueBits(value), category);
+        run = 0;
+    }
+    if (run > 0) {
+        out.Ac(ac_table, kEob);
+    }
+}
+
+// The single scan over all components, interleaved unless there is one.
+template <class Emitter>
+void EncodeScan(const JpegCoefficients& coefficients, const ScanLayout& layout, Emitter& out) {
+    const auto& components = coefficients.components;
+    std::array<int16_t, kMaxScanChannels> prev_dc{};
+    size_t mcus = 0, restarts = 0;
+    // Called before every MCU: a restart resets the DC predictions.
+    auto next_mcu = [&] {
+        if (layout.restart_interval != 0 && mcus != 0 && mcus % layout.restart_interval == 0) {
+            out.Restart(restarts++);
+            prev_dc.fill(0);
+        }
+        ++mcus;
+    };
+    if (components.size() == 1) {
+        // A single component is not interleaved: only the blocks it covers are
+        // coded, and each of them is an MCU.
+        const auto& component = components[0];
+        const size_t width = (coefficients.width * component.h + coefficients.h_max - 1) /
+                             coefficients.h_max;
+        const size_t height = (coefficients.height * component.v + coefficients.v_max - 1) /
+                              coefficients.v_max;
+        for (size_t row = 0; row < (height + 7) / 8; ++row) {
+            for (size_t column = 0; column < (width + 7) / 8; ++column) {
+                next_mcu();
+                EncodeBlock(out, coefficients.Block(0, row, column), prev_dc[0],
+                            layout.dc_ids[0], layout.ac_ids[0]);
+            }
+        }
+        return;
+    }
+    const size_t mcu_w = 8 * coefficients.h_max, mcu_h = 8 * coefficients.v_max;
+    const size_t mcus_w = (coefficients.width + mcu_w - 1) / mcu_w;
+    const size_t mcus_h = (coefficients.height + mcu_h - 1) / mcu_h;
+    for (size_t mcu_y = 0; mcu_y < mcus_h; ++mcu_y) {
+        for (size_t mcu_x = 0; mcu_x < mcus_w; ++mcu_x) {
+            next_mcu();
+            for (size_t c = 0; c < components.size(); ++c) {
+                const size_t h = components[c].h, v = components[c].v;
+                for (size_t y = 0; y < v; ++y) {
+                    for (size_t x = 0; x < h; ++x) {
+                        EncodeBlock(out, coefficients.Block(c, mcu_y * v + y, mcu_x * h + x),
+                                    prev_dc[c], layout.dc_ids[c], layout.ac_ids[c]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Huffman table built for one image; its spec points into |values|.
+struct OptimalTable {
+    HuffmanSpec Spec() const {
+        return {code_lengths, {values.data(), values_cnt}};
+    }
+
+    std::array<uint8_t, 16> code_lengths{};
+    std::array<uint8_t, kU8Cnt> values{};
+    size_t values_cnt = 0;
+};
+
+// Code lengths from symbol counts by Annex K.2, limited to 16 bits, as
+// libjpeg's jpeg_gen_optimal_table builds them. A pseudo-symbol with count 1
+// takes the all-ones code, which a table may not use, and is dropped at the end.
+OptimalTable BuildOptimalTable(const std::array<uint32_t, kU8Cnt>& counts) {
+    constexpr size_t kSymbols = kU8Cnt + 1;
+    std::array<uint64_t, kSymbols> frequencies;
+    std::copy(counts.begin(), counts.end(), frequencies.begin());
+    frequencies[kU8Cnt] = 1;
+    std::array<size_t, kSymbols> code_size{};
+    // Next symbol in the same subtree, kSymbols for none.
+    std::array<size_t, kSymbols> others;
+    others.fill(kSymbols);
+
+    while (true) {
+        // The two least frequent subtrees, on ties the later symbol.
+        size_t c1 = kSymbols, c2 = kSymbols;
+        for (size_t i = 0; i < kSymbols; ++i) {
+            if (frequencies[i] != 0 && (c1 == kSymbols || frequencies[i] <= frequencies[c1])) {
+                c1 = i;
+            }
+        }
+        for (size_t i = 0; i < kSymbols; ++i) {
+            if (frequencies[i] != 0 && i != c1 &&
+                (c2 == kSymbols || frequencies[i] <= frequencies[c2])) {
+                c2 = i;
+            }
+        }
+        if (c2 == kSymbols) {
+            break;
+        }
+        frequencies[c1] += frequencies[c2];
+        frequencies[c2] = 0;
+        for (++code_size[c1]; others[c1] != kSymbols; ++code_size[c1]) {
+            c1 = others[c1];
+        }
+        others[c1] = c2;
+        for (++code_size[c2]; others[c2] != kSymbols; ++code_size[c2]) {
+            c2 = others[c2];
+        }
+    }
+
+    std::array<uint32_t, kSymbols> bits{};
+    for (const size_t size : code_size) {
+        if (size != 0) {
+            ++bits[size];
+        }
+    }
+    // Pairs of too long codes become one shorter code and a split of a code
+    // from the deepest level that still has some (Annex K, figure K.3).
+    for (size_t length = kSymbols - 1; length > 16; --length) {
+        while (bits[length] > 0) {
+            size_t shorter = length - 2;
+            while (bits[shorter] == 0) {
+                --shorter;
+            }
+            bits[length] -= 2;
+            ++bits[length - 1];
+            bits[shorter + 1] += 2;
+            --bits[shorter];
+        }
+    }
+    size_t longest = 16;
+    while (longest > 0 && bits[longest] == 0) {
+        --longest;
+    }
+    if (longest > 0) {
+        --bits[longest];
+    }
+
+    OptimalTable table;
+    for (size_t length = 1; length <= 16; ++length) {
+        table.code_lengths[length - 1] = static_cast<uint8_t>(bits[length]);
+    }
+    // Symbols by their unlimited code size, which orders them as the limited one does.
+    for (size_t size = 1; size < kSymbols; ++size) {
+        for (size_t symbol = 0; symbol < kU8Cnt; ++symbol) {
+            if (code_size[symbol] == size) {
+                table.values[table.values_cnt++] = static_cast<uint8_t>(symbol);
+            }
+        }
+    }
+    return table;
+}
+
+constexpr size_t kBlockSide = 8;
+
+// Quality scaling of libjpeg's jpeg_set_quality, clamped to baseline steps.
+QuantumTable ScaleQuantTable(const std::array<uint8_t, kBlockSz>& base, uint8_t table_id,
+                             int quality) {
+    const int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    QuantumTable table;
+    table.table_id = table_id;
+    for (size_t i = 0; i < kBlockSz; ++i) {
+        table.data[i] = std::clamp((base[i] * scale + 50) / 100, 1, 255);
+    }
+    return table;
+}
+
+// Row and column scales of the AAN forward DCT: sqrt(2) * cos(k * pi / 16), 1 for k = 0.
+constexpr float kAanScale[kBlockSide] = {1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+                                         1.0f, 0.785694958f, 0.541196100f, 0.275899379f};
+
+// What ForwardDct output is multiplied by to get quantized coefficients.
+std::array<float, kBlockSz> DctScale(const QuantumTable& table) {
+    std::array<float, kBlockSz> scale;
+    for (size_t v = 0; v < kBlockSide; ++v) {
+        for (size_t u = 0; u < kBlockSide; ++u) {
+            const size_t i = v * kBlockSide + u;
+            scale[i] = 1.0f / (table.data[i] * kAanScale[v] * kAanScale[u] * 8);
+        }
+    }
+    return scale;
+}
+
+using FloatBlock = float[kBlockSide][kBlockSide];
+
+// The 1-D AAN DCT of libjpeg's jfdctflt.c down every column of |data|. The
+// columns are independent lanes with unit stride, so the compiler runs the
+// loop as SIMD: 4 or 8 columns per instruction.
+void ForwardDctColumns(FloatBlock& data) {
+    for (size_t i = 0; i < kBlockSide; ++i) {
+        const float tmp0 = data[0][i] + data[7][i], tmp7 = data[0][i] - data[7][i];
+        const float tmp1 = data[1][i] + data[6][i], tmp6 = data[1][i] - data[6][i];
+        const float tmp2 = data[2][i] + data[5][i], tmp5 = data[2][i] - data[5][i];
+        const float tmp3 = data[3][i] + data[4][i], tmp4 = data[3][i] - data[4][i];
+
+        const float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        const float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+        data[0][i] = tmp10 + tmp11;
+        data[4][i] = tmp10 - tmp11;
+        const float z1 = (tmp12 + tmp13) * 0.707106781f;
+        data[2][i] = tmp13 + z1;
+        data[6][i] = tmp13 - z1;
+
+        const float odd10 = tmp4 + tmp5, odd11 = tmp5 + tmp6, odd12 = tmp6 + tmp7;
+        const float z5 = (odd10 - odd12) * 0.382683433f;
+        const float z2 = 0.541196100f * odd10 + z5;
+        const float z4 = 1.306562965f * odd12 + z5;
+        const float z3 = odd11 * 0.707106781f;
+        const float z11 = tmp7 + z3, z13 = tmp7 - z3;
+        data[5][i] = z13 + z2;
+        data[3][i] = z13 - z2;
+        data[1][i] = z11 + z4;
+        data[7][i] = z11 - z4;
+    }
+}
+
+void Transpose(FloatBlock& data) {
+    for (size_t y = 0; y < kBlockSide; ++y) {
+        for (size_t x = y + 1; x < kBlockSide; ++x) {
+            std::swap(data[y][x], data[x][y]);
+        }
+    }
+}
+
+// |samples| are level-shifted to -128..127 and get overwritten.
+void ForwardDct(FloatBlock& samples, const std::array<float, kBlockSz>& scale, int16_t* block) {
+    ForwardDctColumns(samples);
+    Transpose(samples);
+    ForwardDctColumns(samples);
+    // samples[u][v] is now the coefficient of horizontal frequency u.
+    for (size_t v = 0; v < kBlockSide; ++v) {
+        for (size_t u = 0; u < kBlockSide; ++u) {
+            block[v * kBlockSide + u] =
+                static_cast<int16_t>(std::lround(samples[u][v] * scale[v * kBlockSide + u]));
+        }
+    }
+}
+
+}  // namespace
+
+void EncodeCoefficients(const JpegCoefficients& coefficients, std::string* output,
+                        const EncodeOptions& options) {
+    const auto& components = coefficients.components;
+    if (components.empty() || components.size() > kMaxScanChannels) {
+        throw std::invalid_argument("Bad components count");
+    }
+    if (coefficients.width == 0 || coefficients.height == 0) {
+        throw std::invalid_argument("Empty image");
+    }
+    const size_t mcu_w = 8 * coefficients.h_max, mcu_h = 8 * coefficients.v_max;
+    if (mcu_w == 0 || mcu_h == 0) {
+        throw std::invalid_argument("Zero sampling factor");
+    }
+    const size_t mcus_w = (coefficients.width + mcu_w - 1) / mcu_w;
+    const size_t mcus_h = (coefficients.height + mcu_h - 1) / mcu_h;
+
+    size_t blocks_in_mcu = 0;
+    bool wide_quant = false;
+    for (const auto& component : components) {
+        if (component.h == 0 || component.v == 0 || component.h > coefficients.h_max ||
+            component.v > coefficients.v_max || coefficients.h_max % component.h != 0 ||
+            coefficients.v_max % component.v != 0) {
+            throw std::invalid_argument("Bad sampling factors");
+        }
+        if (component.blocks_w < mcus_w * component.h ||
+            component.blocks_h < mcus_h * component.v ||
+            component.offset + component.blocks_w * component.blocks_h * kBlockSz >
+                coefficients.coefficients.size()) {
+            throw std::invalid_argument("Component smaller than the image");
+        }
+        blocks_in_mcu += component.h * component.v;
+        for (const uint16_t quant : component.quant_table) {
+            if (quant == 0) {
+                throw std::invalid_argument("Zero quantization step");
+            }
+            wide_quant |= quant > 0xff;
+        }
+    }
+    if (components.size() > 1 && blocks_in_mcu > kMaxBlocksInMcu) {
+        throw std::invalid_argument("Too many blocks in MCU");
+    }
+    for (const auto& segment : options.segments) {
+        if ((segment.marker < 0xe0 || segment.marker > 0xef) && segment.marker != 0xfe) {
+            throw std::invalid_argument("Segment is not APPn or COM");
+        }
+        if (segment.data.size() > 0xffff - 2) {
+            throw std::invalid_argument("Segment too long");
+        }
+    }
+
+    const size_t huffman_tables = std::min<size_t>(components.size(), 2);
+    std::array<HuffmanSpec, 2> dc_specs = {standard_tables::kDcLuminance,
+                                           standard_tables::kDcChrominance};
+    std::array<HuffmanSpec, 2> ac_specs = {standard_tables::kAcLuminance,
+                                           standard_tables::kAcChrominance};
+    SymbolWriter::Tables dc_codes = {&kDcCodes[0], &kDcCodes[1]};
+    SymbolWriter::Tables ac_codes = {&kAcCodes[0], &kAcCodes[1]};
+    std::array<OptimalTable, 2> dc_tables, ac_tables;
+    std::array<HuffmanCodes, 2> dc_optimal, ac_optimal;
+    if (options.optimize_huffman) {
+        // First pass: the symbol counts of the very scan written below.
+        SymbolCounter counter;
+        EncodeScan(coefficients, kDefaultLayout, counter);
+        for (size_t table = 0; table < huffman_tables; ++table) {
+            dc_tables[table] = BuildOptimalTable(counter.dc_counts[table]);
+            ac_tables[table] = BuildOptimalTable(counter.ac_counts[table]);
+            dc_specs[table] = dc_tables[table].Spec();
+            ac_specs[table] = ac_tables[table].Spec();
+            dc_optimal[table] = BuildCodes(dc_specs[table]);
+            ac_optimal[table] = BuildCodes(ac_specs[table]);
+            dc_codes[table] = &dc_optimal[table];
+            ac_codes[table] = &ac_optimal[table];
+        }
+    }
+
+    // Components with equal quantization tables share one.
+    std::array<uint8_t, kMaxScanChannels> quant_ids{};
+    uint8_t quant_tables = 0;
+    for (size_t c = 0; c < components.size(); ++c) {
+        quant_ids[c] = quant_tables;
+        for (size_t prev = 0; prev < c; ++prev) {
+            if (components[prev].quant_table == components[c].quant_table) {
+                quant_ids[c] = quant_ids[prev];
+                break;
+            }
+        }
+        if (quant_ids[c] == quant_tables) {
+            ++quant_tables;
+        }
+    }
+
+    output->clear();
+    PutMarker(output, kSoi);
+    for (const auto& segment : options.segments) {
+        PutSegmentHeader(output, segment.marker, segment.data.size());
+        output->append(segment.data);
+    }
+
+    // Ids are given in order of first use, so each table is written with the first component.
+    uint8_t written_tables = 0;
+    for (size_t c = 0; c < components.size(); ++c) {
+        if (quant_ids[c] != written_tables) {
+            continue;
+        }
+        ++written_tables;
+        const uint8_t precision = wide_quant ? 1 : 0;
+        PutSegmentHeader(output, kDqt, 1 + kBlockSz * (precision + 1));
+        PutByte(output, precision << 4 | quant_ids[c]);
+        for (size_t i = 0; i < kBlockSz; ++i) {
+            const uint16_t quant = components[c].quant_table[kZigZagToNatural[i]];
+            if (wide_quant) {
+                PutWord(output, quant);
+            } else {
+                PutByte(output, quant);
+            }
+        }
+    }
+
+    PutSegmentHeader(output, wide_quant ? kSof1 : kSof0, 6 + 3 * components.size());
+    PutByte(output, 8);
+    PutWord(output, coefficients.height);
+    PutWord(output, coefficients.width);
+    PutByte(output, components.size());
+    for (size_t c = 0; c < components.size(); ++c) {
+        PutByte(output, components[c].id);
+        PutByte(output, components[c].h << 4 | components[c].v);
+        PutByte(output, quant_ids[c]);
+    }
+
+    for (size_t table = 0; table < huffman_tables; ++table) {
+        PutHuffmanTable(output, 0, table, dc_specs[table]);
+        PutHuffmanTable(output, 1, table, ac_specs[table]);
+    }
+
+    PutSegmentHeader(output, kSos, 4 + 2 * components.size());
+    PutByte(output, components.size());
+    for (size_t c = 0; c < components.size(); ++c) {
+        const uint8_t table = c == 0 ? 0 : 1;
+        PutByte(output, components[c].id);
+        PutByte(output, table << 4 | table);
+    }
+    PutByte(output, 0);
+    PutByte(output, 63);
+    PutByte(output, 0);
+
+    SymbolWriter writer(output, dc_codes, ac_codes);
+    EncodeScan(coefficients, kDefaultLayout, writer);
+    writer.Flush();
+    PutMarker(output, kEoi);
+}
+
+void WriteScanData(const JpegCoefficients& coefficients, const ScanLayout& layout,
+                   const std::array<HuffmanSpec, kBaselineTableIds>& dc_specs,
+                   const std::array<HuffmanSpec, kBaselineTableIds>& ac_specs,
+                   std::string* output) {
+    std::array<HuffmanCodes, kBaselineTableIds> dc_tables, ac_tables;
+    SymbolWriter::Tables dc_codes, ac_codes;
+    for (size_t table = 0; table < kBaselineTableIds; ++table) {
+        dc_tables[table] = BuildCodes(dc_specs[table]);
+        ac_tables[table] = BuildCodes(ac_specs[table]);
+        dc_codes[table] = &dc_tables[table];
+        ac_codes[table] = &ac_tables[table];
+    }
+    SymbolWriter writer(output, dc_codes, ac_codes);
+    EncodeScan(coefficients, layout, writer);
+    writer.Flush();
+}
+
+std::array<uint16_t, JpegCoefficients::kBlockSz> QualityQuantTable(int quality,
+                                                                   bool chrominance) {
+    if (quality < 1 || quality > 100) {
+        throw std::invalid_argument("Quality must be in 1..100");
+    }
+    return ScaleQuantTable(chrominance ? standard_tables::kChrominanceQuant
+                                       : standard_tables::kLuminanceQuant,
+                           chrominance ? 1 : 0, quality)
+        .data;
+}
+
+JpegEncoder::JpegEncoder(int quality, ChromaSubsampling subsampling)
+    : subsampling_(subsampling) {
+    if (quality < 1 || quality > 100) {
+        throw std::invalid_argument("Quality must be in 1..100");
+    }
+    const auto luminance = ScaleQuantTable(standard_tables::kLuminanceQuant, 0, quality);
+    const auto chrominance = ScaleQuantTable(standard_tables::kChrominanceQuant, 1, quality);
+    luminance_scale_ = DctScale(luminance);
+    chrominance_scale_ = DctScale(chrominance);
+
+    const uint8_t sampling = subsampling == ChromaSubsampling::k420 ? 2 : 1;
+    coefficients_.h_max = coefficients_.v_max = sampling;
+    coefficients_.components.resize(3);
+    for (uint8_t c = 0; c < 3; ++c) {
+        auto& component = coefficients_.components[c];
+        component.id = c + 1;
+        component.h = component.v = c == 0 ? sampling : 1;
+        component.quant_table = c == 0 ? luminance.data : chrominance.data;
+    }
+}
+
+void JpegEncoder::Encode(const Image& image, std::string* output) {
+    const size_t width = image.Width(), height = image.Height();
+    if (width == 0 || height == 0 || width > 0xffff || height > 0xffff) {
+        throw std::invalid_argument("Bad image size");
+    }
+    const size_t sampling = subsampling_ == ChromaSubsampling::k420 ? 2 : 1;
+    const size_t mcu_side = kBlockSide * sampling;
+    const size_t mcus_w = (width + mcu_side - 1) / mcu_side;
+    const size_t mcus_h = (height + mcu_side - 1) / mcu_side;
+    coefficients_.width = static_cast<uint16_t>(width);
+    coefficients_.height = static_cast<uint16_t>(height);
+    size_t offset = 0;
+    for (auto& component : coefficients_.components) {
+        component.blocks_w = mcus_w * component.h;
+        component.blocks_h = mcus_h * component.v;
+        component.offset = offset;
+        offset += component.blocks_w * component.blocks_h * kBlockSz;
+    }
+    coefficients_.coefficients.resize(offset);
+
+    // Level-shifted Y, Cb and Cr of one MCU, edge pixels repeated past the image.
+    float planes[3][2 * kBlockSide][2 * kBlockSide];
+    FloatBlock samples;
+    for (size_t mcu_y = 0; mcu_y < mcus_h; ++mcu_y) {
+        for (size_t mcu_x = 0; mcu_x < mcus_w; ++mcu_x) {
+            for (size_t y = 0; y < mcu_side; ++y) {
+                const size_t image_y = std::min(mcu_y * mcu_side + y, height - 1);
+                for (size_t x = 0; x < mcu_side; ++x) {
+                    const size_t image_x = std::min(mcu_x * mcu_side + x, width - 1);
+                    const RGB pixel = image.GetPixel(image_y, image_x);
+                    planes[0][y][x] = 0.299f * pixel.r + 0.587f * pixel.g + 0.114f * pixel.b - 128;
+                    planes[1][y][x] = -0.168736f * pixel.r - 0.331264f * pixel.g + 0.5f * pixel.b;
+                    planes[2][y][x] = 0.5f * pixel.r - 0.418688f * pixel.g - 0.081312f * pixel.b;
+                }
+            }
+
+            for (size_t block_y = 0; block_y < sampling; ++block_y) {
+                for (size_t block_x = 0; block_x < sampling; ++block_x) {
+                    for (size_t y = 0; y < kBlockSide; ++y) {
+                        for (size_t x = 0; x < kBlockSide; ++x) {
+                            samples[y][x] =
+                                planes[0][block_y * kBlockSide + y][block_x * kBlockSide + x];
+                        }
+                    }
+                    ForwardDct(samples, luminance_scale_,
+                               coefficients_.Block(0, mcu_y * sampling + block_y,
+                                                   mcu_x * sampling + block_x));
+                }
+            }
+            // Chroma is the mean of each sampling x sampling square.
+            for (size_t c = 1; c < 3; ++c) {
+                for (size_t y = 0; y < kBlockSide; ++y) {
+                    for (size_t x = 0; x < kBlockSide; ++x) {
+                        float sum = 0;
+                        for (size_t dy = 0; dy < sampling; ++dy) {
+                            for (size_t dx = 0; dx < sampling; ++dx) {
+                                sum += planes[c][y * sampling + dy][x * sampling + dx];
+                            }
+                        }
+                        samples[y][x] = sum / (sampling * sampling);
+                    }
+                }
+                ForwardDct(samples, chrominance_scale_, coefficients_.Block(c, mcu_y, mcu_x));
+            }
+        }
+    }
+    EncodeCoefficients(coefficients_, output);
+}
@@ -0,0 +1,140 @@
+#include "exif.h"
+
+namespace {
+
+constexpr uint8_t kApp1 = 0xe1, kSos = 0xda, kEoi = 0xd9;
+constexpr std::string_view kExifHeader("Exif\0\0", 6);
+
+constexpr uint16_t kTagOrientation = 0x0112;
+constexpr uint16_t kTagThumbnailOffset = 0x0201, kTagThumbnailLength = 0x0202;
+constexpr uint16_t kTypeShort = 3, kTypeLong = 4;
+constexpr size_t kIfdEntrySz = 12;
+
+// Markers without a length field: TEM, RSTn, SOI.
+bool IsStandalone(uint8_t marker) {
+    return marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8);
+}
+
+}  // namespace
+
+std::optional<Exif> Exif::Find(std::string_view jpeg) {
+    size_t pos = 2;
+    while (pos + 4 <= jpeg.size()) {
+        if (static_cast<uint8_t>(jpeg[pos]) != 0xff) {
+            return std::nullopt;
+        }
+        const auto marker = static_cast<uint8_t>(jpeg[pos + 1]);
+        if (marker == 0xff) {
+            ++pos;
+            continue;
+        }
+        if (marker == kSos || marker == kEoi) {
+            return std::nullopt;
+        }
+        if (IsStandalone(marker)) {
+            pos += 2;
+            continue;
+        }
+        const size_t sz = (static_cast<uint8_t>(jpeg[pos + 2]) << 8) |
+                          static_cast<uint8_t>(jpeg[pos + 3]);
+        if (sz < 2 || pos + 2 + sz > jpeg.size()) {
+            return std::nullopt;
+        }
+        if (marker == kApp1) {
+            if (auto exif = FromSegment(jpeg.substr(pos + 4, sz - 2))) {
+                return exif;
+            }
+        }
+        pos += 2 + sz;
+    }
+    return std::nullopt;
+}
+
+std::optional<Exif> Exif::FromSegment(std::string_view app1) {
+    if (app1.substr(0, kExifHeader.size()) != kExifHeader) {
+        return std::nullopt;
+    }
+    return Exif(app1.substr(kExifHeader.size()));
+}
+
+Exif::Exif(std::string_view tiff) : tiff_(tiff) {
+    if (tiff_.substr(0, 2) == "II") {
+        little_endian_ = true;
+    } else if (tiff_.substr(0, 2) != "MM") {
+        return;
+    }
+    if (Read16(2) == 42) {
+        first_ifd_ = Read32(4);
+    }
+}
+
+std::string_view Exif::Thumbnail() const {
+    if (!first_ifd_) {
+        return {};
+    }
+    const auto ifd1 = NextIfd(*first_ifd_);
+    if (!ifd1 || *ifd1 == 0) {
+        return {};
+    }
+    const auto offset = FindTag(*ifd1, kTagThumbnailOffset);
+    const auto length = FindTag(*ifd1, kTagThumbnailLength);
+    if (!offset || !length || *offset > tiff_.size() || *length > tiff_.size() - *offset) {
+        return {};
+    }
+    return tiff_.substr(*offset, *length);
+}
+
+uint8_t Exif::Orientation() const {
+    if (!first_ifd_) {
+        return 1;
+    }
+    const auto orientation = FindTag(*first_ifd_, kTagOrientation);
+    return orientation && *orientation >= 1 && *orientation <= 8 ? *orientation : 1;
+}
+
+std::optional<uint16_t> Exif::Read16(size_t pos) const {
+    if (pos > tiff_.size() || tiff_.size() - pos < 2) {
+        return std::nullopt;
+    }
+    const auto b0 = static_cast<uint8_t>(tiff_[pos]), b1 = static_cast<uint8_t>(tiff_[pos + 1]);
+    return little_endian_ ? (b1 << 8 | b0) : (b0 << 8 | b1);
+}
+
+std::optional<uint32_t> Exif::Read32(size_t pos) const {
+    const auto first = Read16(pos), second = Read16(pos + 2);
+    if (!first || !second) {
+        return std::nullopt;
+    }
+    return little_endian_ ? (static_cast<uint32_t>(*second) << 16 | *first)
+                          : (static_cast<uint32_t>(*first) << 16 | *second);
+}
+
+std::optional<uint32_t> Exif::NextIfd(uint32_t ifd) const {
+    const auto count = Read16(ifd);
+    if (!count) {
+        return std::nullopt;
+    }
+    return Read32(ifd + 2 + size_t{*count} * kIfdEntrySz);
+}
+
+std::optional<uint32_t> Exif::FindTag(uint32_t ifd, uint16_t tag) const {
+    const auto count = Read16(ifd);
+    if (!count) {
+        return std::nullopt;
+    }
+    for (size_t i = 0; i < *count; ++i) {
+        const size_t entry = ifd + 2 + i * kIfdEntrySz;
+        if (Read16(entry) != tag || Read32(entry + 4) != 1u) {
+            continue;
+        }
+        const auto type = Read16(entry + 2);
+        if (type == kTypeShort) {
+            return Read16(entry + 8);
+        }
+        if (type == kTypeLong) {
+            return Read32(entry + 8);
+        }
+        return std::nullopt;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Read-only view of the EXIF block of a JPEG: the TIFF structure stored in an
+// APP1 segment after "Exif\0\0". Nothing is copied, every lookup is bounds
+// checked and a malformed block reads as if the tag was absent.
+class Exif {
+public:
+    // The EXIF block among the segments before the first scan, walked by their
+    // lengths without decoding anything. Empty if there is none.
+    static std::optional<Exif> Find(std::string_view jpeg);
+
+    // The EXIF block of an APP1 payload, empty if it is some other APP1.
+    static std::optional<Exif> FromSegment(std::string_view app1);
+
+    explicit Exif(std::string_view tiff);
+
+    // The JPEG thumbnail of IFD1, empty if there is none or it is out of bounds.
+    std::string_view Thumbnail() const;
+
+    // Orientation tag of IFD0, 1..8 as in the TIFF spec, 1 (upright) if absent.
+    uint8_t Orientation() const;
+
+private:
+    std::optional<uint16_t> Read16(size_t pos) const;
+    std::optional<uint32_t> Read32(size_t pos) const;
+    // Offset of the IFD after |ifd|.
+    std::optional<uint32_t> NextIfd(uint32_t ifd) const;
+    // Value of a SHORT or LONG tag with a single value.
+    std::optional<uint32_t> FindTag(uint32_t ifd, uint16_t tag) const;
+
+    std::string_view tiff_;
+    bool little_endian_ = false;
+    std::optional<uint32_t> first_ifd_;
+};
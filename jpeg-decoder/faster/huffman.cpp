@@ -1,130 +1,108 @@
 #include "include/huffman.h"
 
 #include <memory>
-#include <numeric>
-#include <optional>
+#include <stdexcept>
 #include <glog/logging.h>
 
-std::ostream &operator<<(std::ostream &of, const std::vector<uint8_t> &vec) {
-    for (const auto val : vec) {
-        of << static_cast<int>(val) << ' ';
-    }
-    return of;
-}
-
+// Nodes live in one vector and refer to each other by index. Build only clears
+// it, so rebuilding a tree of the same or smaller size does not allocate.
 class HuffmanTree::Impl {
 public:
     Impl() = default;
 
-    bool AddNode(const uint8_t code_length, uint8_t value) const {
-        return AddNodeImpl(code_length, value, root_);
+    void Reset() {
+        nodes_.clear();
+        nodes_.emplace_back();
+        state_ = kRoot;
     }
 
-    void Reset() {
-        root_ = state_ = std::make_shared<Node>();
+    // Adds a leaf with |value| at the path spelled by the |length| lowest bits of |code|.
+    void AddCode(uint32_t code, uint8_t length, uint8_t value) {
+        int32_t now = kRoot;
+        for (uint8_t depth = length; depth-- > 0;) {
+            if (nodes_[now].IsTerminal()) {
+                throw std::invalid_argument("Something went wrong in node adding");
+            }
+            const bool bit = (code >> depth) & 1;
+            if (nodes_[now].children[bit] == kNone) {
+                const auto child = static_cast<int32_t>(nodes_.size());
+                nodes_.emplace_back();
+                nodes_[now].children[bit] = child;
+            }
+            now = nodes_[now].children[bit];
+        }
+        nodes_[now].value = value;
     }
 
     bool Move(bool bit, int &value) {
-        if (state_ == nullptr) {
+        if (state_ == kNone) {
             throw std::invalid_argument("State is nullptr");
         }
 
-        std::shared_ptr<Node> need;
-        if (!bit) {
-            need = state_->left;
-        } else {
-            need = state_->right;
-        }
-
+        const int32_t need = nodes_[state_].children[bit];
         state_ = need;
-        if (need == nullptr) {
+        if (need == kNone) {
             // DLOG(ERROR) << "You are trying to move in nullptr\n";
             return false;
         }
-        if (!need->IsTerminal()) {
+        if (!nodes_[need].IsTerminal()) {
             return false;
         }
-        state_ = root_;
-        value = need->value.value();
+        state_ = kRoot;
+        value = nodes_[need].value;
         return true;
     }
 
 private:
-    struct Node {
-        explicit Node(std::optional<uint8_t> value = std::nullopt) : value(value) {
-        }
+    static constexpr int32_t kNone = -1, kRoot = 0;
 
+    struct Node {
         bool IsTerminal() const {
-            return value != std::nullopt;
+            return value != kNone;
         }
-        std::optional<uint8_t> value;
-        std::shared_ptr<Node> left{nullptr}, right{nullptr};
-    };
 
-    std::shared_ptr<Node> root_, state_;
+        int32_t children[2] = {kNone, kNone};
+        int16_t value = kNone;
+    };
 
-    static bool AddNodeImpl(uint8_t code_length, uint8_t value, const std::shared_ptr<Node> &now) {
-        if (now->IsTerminal()) {
-            return false;
-        }
-        if (code_length == 1) {
-            if (now->left == nullptr) {
-                now->left = std::make_shared<Node>(value);
-                return true;
-            }
-            if (now->right == nullptr) {
-                now->right = std::make_shared<Node>(value);
-                return true;
-            }
-            return false;
-        }
-        if (now->left == nullptr) {
-            now->left = std::make_shared<Node>();
-        }
-        if (AddNodeImpl(code_length - 1, value, now->left)) {
-            return true;
-        }
-        if (now->right == nullptr) {
-            now->right = std::make_shared<Node>();
-        }
-        if (AddNodeImpl(code_length - 1, value, now->right)) {
-            return true;
-        }
-        return false;
-    }
+    std::vector<Node> nodes_;
+    int32_t state_ = kNone;
 };
 
 HuffmanTree::HuffmanTree() : impl_(std::make_unique<Impl>()) {
 }
 
+// Codes are assigned canonically (JPEG Annex C): consecutive codes within a
+// length, shifted left when moving to the next length.
 void HuffmanTree::Build(const std::vector<uint8_t> &code_lengths,
                         const std::vector<uint8_t> &values) {
     // DLOG(INFO) << "Start building Huffman Tree\n";
 
+    constexpr size_t kMaxCodeLength = 16;
+    if (code_lengths.size() > kMaxCodeLength) {
+        throw std::invalid_argument("Too big code length");
+    }
+
     impl_->Reset();
-    std::vector<uint8_t> code_lengths_new = code_lengths;
-    size_t now_length = 1;
-    for (const uint8_t value : values) {
-        while (code_lengths_new[now_length - 1] == 0 && now_length <= code_lengths.size()) {
-            ++now_length;
-        }
-        if (now_length > std::min<size_t>(16, code_lengths.size())) {
-            // DLOG(ERROR) << "Bad code lengths\nCodes lengths: " << code_lengths
-            //             << "\nValues cnt: " << values.size() << '\n';
-            throw std::invalid_argument("Too big code length");
-        }
-        --code_lengths_new[now_length - 1];
-        if (!impl_->AddNode(now_length, value)) {
-            // DLOG(ERROR) << "Cannot add a node\nCodes lengths: " << code_lengths
-            //             << "\nValues cnt: " << values.size() << '\n';
-            throw std::invalid_argument("Something went wrong in node adding");
+    size_t value_index = 0;
+    uint32_t code = 0;
+    for (size_t length = 1; length <= code_lengths.size(); ++length) {
+        for (uint8_t i = 0; i < code_lengths[length - 1]; ++i, ++code) {
+            if (value_index == values.size()) {
+                throw std::invalid_argument("Too big code length sum");
+            }
+            if (code >= (1u << length)) {
+                // DLOG(ERROR) << "Cannot add a node\nCodes lengths: " << code_lengths
+                //             << "\nValues cnt: " << values.size() << '\n';
+                throw std::invalid_argument("Something went wrong in node adding");
+            }
+            impl_->AddCode(code, length, values[value_index++]);
         }
+        code <<= 1;
     }
 
-    if (std::reduce(code_lengths_new.begin(), code_lengths_new.end()) > 0) {
-        // DLOG(ERROR) << "Big lenghts sum\nCodes lengths: " << code_lengths
-        //             << "\nValues cnt: " << values.size() << '\n';
-        throw std::invalid_argument("Too big code length sum");
+    if (value_index != values.size()) {
+        throw std::invalid_argument("Too big code length");
     }
 
     // DLOG(INFO) << "Finished building Huffman Tree\n";
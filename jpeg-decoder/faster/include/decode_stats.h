@@ -0,0 +1,42 @@
+#pragma once
+
+#include <image.h>
+
+#include <chrono>
+#include <cstddef>
+#include <istream>
+
+// Where the time of a single Decode call went.
+struct DecodeStats {
+    struct Stages {
+        // Everything outside of the entropy-coded data: markers, tables, headers.
+        std::chrono::nanoseconds markers{0};
+        std::chrono::nanoseconds entropy{0};
+        std::chrono::nanoseconds dequantization{0};
+        std::chrono::nanoseconds idct{0};
+        std::chrono::nanoseconds level_shift{0};
+        // Upsampling and YCbCr -> RGB conversion, they run as one pass.
+        std::chrono::nanoseconds color{0};
+    };
+
+    Stages time;
+    size_t blocks = 0;
+    // Blocks whose first AC symbol is EOB.
+    size_t dc_only_blocks = 0;
+    // Sum over blocks of the number of coefficients decoded before EOB (1..64).
+    size_t eob_position_sum = 0;
+    // Entropy-coded bytes, including the 0x00 bytes stuffed after 0xFF.
+    size_t scan_bytes = 0;
+    size_t stuffed_bytes = 0;
+    // Heap allocations made by the process while decoding.
+    size_t allocations = 0;
+
+    double AverageEobPosition() const {
+        return blocks == 0 ? 0.0 : static_cast<double>(eob_position_sum) / blocks;
+    }
+};
+
+// Decode(input) that also fills |stats| when it is not null. Stats are collected
+// only if decoder_faster is configured with -DDECODER_STATS=ON, otherwise every
+// hook compiles to nothing and |stats| is left untouched.
+Image Decode(std::istream& input, DecodeStats* stats);
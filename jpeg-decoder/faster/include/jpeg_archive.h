@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Lossless recompression of JPEG files for storage. Compress entropy-decodes
+// a baseline file and codes its coefficients again with an adaptive binary
+// arithmetic coder. Each block codes its 7x7 high-frequency part first, with
+// contexts from the same positions in the blocks above and to the left and from
+// the coefficients already coded; then its first row and column, whose values
+// and signs are predicted so that the pixels continue smoothly across the
+// boundaries with those blocks; then DC, predicted the same way. Headers
+// before the scan and whatever follows it are kept verbatim. Decompress gives
+// back the exact bytes of the input.
+//
+// Files the model does not cover are stored as they are: progressive or
+// arithmetic-coded ones, several scans, scans that the encoder of
+// jpeg_encoder.h does not reproduce bit for bit (for example, padding with
+// zero bits), anything that is not a JPEG, and files the model would not
+// make smaller.
+//
+// Archive layout: "JARC", a version byte, then a mode byte. Mode 0 is followed
+// by the stored file. Mode 1 is followed by the header size (4 bytes, big
+// endian), the header, the tail size, the tail, the size of the scan it
+// rebuilds, and then the coded coefficients up to the end.
+// Not thread-safe: use one JpegArchiver per thread.
+class JpegArchiver {
+public:
+    JpegArchiver();
+
+    JpegArchiver(JpegArchiver&&) noexcept;
+    JpegArchiver& operator=(JpegArchiver&&) noexcept;
+
+    void Compress(std::string_view jpeg, std::string* archive);
+
+    // Throws std::runtime_error on input that is not a valid archive.
+    void Decompress(std::string_view archive, std::string* jpeg);
+
+    ~JpegArchiver();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
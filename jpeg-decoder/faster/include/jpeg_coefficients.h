@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Quantized DCT coefficients of a baseline JPEG as the entropy decoder leaves
+// them, before dequantization and IDCT. All blocks live in one flat buffer,
+// so moving the whole thing copies nothing.
+struct JpegCoefficients {
+    static constexpr size_t kBlockSz = 64;
+
+    struct Component {
+        uint8_t id = 0, h = 0, v = 0;
+        // Row-major, out of zig-zag order, like every block below.
+        std::array<uint16_t, kBlockSz> quant_table{};
+        // Size of the MCU grid in blocks of this component. Blocks beyond
+        // ceil(ceil(width * h / h_max) / 8) columns (likewise for rows) are
+        // the padding the encoder added to fill the last MCUs.
+        size_t blocks_w = 0, blocks_h = 0;
+        // Where the first block is in |coefficients|.
+        size_t offset = 0;
+    };
+
+    int16_t* Block(size_t component, size_t row, size_t column) {
+        const auto& c = components[component];
+        return coefficients.data() + c.offset + (row * c.blocks_w + column) * kBlockSz;
+    }
+
+    const int16_t* Block(size_t component, size_t row, size_t column) const {
+        const auto& c = components[component];
+        return coefficients.data() + c.offset + (row * c.blocks_w + column) * kBlockSz;
+    }
+
+    uint16_t width = 0, height = 0;
+    uint8_t h_max = 0, v_max = 0;
+    // In frame order.
+    std::vector<Component> components;
+    // Component by component, blocks in raster order, 64 values per block.
+    std::vector<int16_t> coefficients;
+};
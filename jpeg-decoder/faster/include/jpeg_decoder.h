@@ -0,0 +1,96 @@
+#pragma once
+
+#include <decode_stats.h>
+#include <image.h>
+#include <jpeg_coefficients.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// APPn or COM segment of an in-memory input: its marker (0xe0..0xef or 0xfe)
+// and its payload without the length field, pointing into the input buffer.
+struct JpegSegment {
+    uint8_t marker;
+    std::string_view data;
+};
+
+// Decoder that keeps its Huffman trees, coefficient buffers and scratch memory
+// between calls. After the first image of a given size and layout, decoding
+// another one like it into the same Image makes no heap allocations.
+// Not thread-safe: use one JpegDecoder per thread.
+class JpegDecoder {
+public:
+    // With |threads| > 1 dequantization, IDCT and color conversion of one image
+    // run on that many threads, split by MCU rows. Entropy decoding of an
+    // interleaved scan stays sequential, but the scans of an in-memory input
+    // with one scan per component are decoded concurrently. The threads are
+    // started once, with the decoder, and kept until it is destroyed.
+    // Construct decoders on one thread at a time: the constructor plans the
+    // FFTW transforms, and planning FFTW is not thread-safe.
+    explicit JpegDecoder(size_t threads = 1);
+
+    JpegDecoder(JpegDecoder&&) noexcept;
+    JpegDecoder& operator=(JpegDecoder&&) noexcept;
+
+    // With |apply| the EXIF orientation of the input is applied while the
+    // pixels are written, so images come out upright with no extra pass;
+    // orientations 5..8 swap width and height. Off by default.
+    void SetApplyExifOrientation(bool apply);
+
+    // Decodes into |image|, its pixels are reused when the size matches.
+    // |stats| may be null, see decode_stats.h.
+    void Decode(std::istream& input, Image* image, DecodeStats* stats = nullptr);
+
+    Image Decode(std::istream& input, DecodeStats* stats = nullptr);
+
+    // Decodes an in-memory JPEG without copying its metadata: with |segments|
+    // every APPn and COM segment is returned there as a view into |input|,
+    // without it APPn segments are skipped by length.
+    void Decode(std::string_view input, Image* image, std::vector<JpegSegment>* segments = nullptr,
+                DecodeStats* stats = nullptr);
+
+    // Small preview of an in-memory JPEG for grid views: the EXIF thumbnail
+    // when the file has a usable one, otherwise the image at 1/8 scale, one
+    // pixel per block from its DC coefficient, with no IDCT.
+    void DecodeThumbnail(std::string_view input, Image* image);
+
+    // Quantized DCT coefficients of the input with no pixel work at all. The
+    // buffers of |coefficients| are reused, so decoding another image of the
+    // same layout into it makes no allocations.
+    // With |segments| the APPn and COM segments are returned as in Decode.
+    void DecodeCoefficients(std::istream& input, JpegCoefficients* coefficients);
+    void DecodeCoefficients(std::string_view input, JpegCoefficients* coefficients,
+                            std::vector<JpegSegment>* segments = nullptr);
+
+    ~JpegDecoder();
+
+private:
+    friend class MjpegDecoder;
+
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Decoder of a Motion-JPEG stream, as IP cameras send it: complete JPEG frames
+// one after another, often without DHT. Frames use the standard Huffman tables
+// of ITU T.81 Annex K unless some frame defined others, and the tables of one
+// frame stay for the next ones. Bytes between frames (container chunk headers,
+// padding) are skipped. As with JpegDecoder, a frame of an already seen size
+// and layout is decoded with no heap allocations and no table setup.
+class MjpegDecoder {
+public:
+    // |input| must outlive the decoder. See JpegDecoder for |threads|.
+    explicit MjpegDecoder(std::istream& input, size_t threads = 1);
+
+    // Decodes the next frame into |image|. Returns false at the end of the
+    // stream, throws on a broken frame.
+    bool NextFrame(Image* image, DecodeStats* stats = nullptr);
+
+private:
+    std::istream* input_;
+    JpegDecoder decoder_;
+};
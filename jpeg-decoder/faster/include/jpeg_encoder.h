@@ -0,0 +1,59 @@
+#pragma once
+
+#include <image.h>
+#include <jpeg_coefficients.h>
+#include <jpeg_decoder.h>
+
+#include <span>
+#include <string>
+
+struct EncodeOptions {
+    // Huffman tables built for the image from a first pass that counts its
+    // symbols (Annex K.2), as jpegtran -optimize does, instead of the standard
+    // ones. Same coefficients, usually a few percent fewer bytes.
+    bool optimize_huffman = false;
+    // APPn and COM segments written right after SOI, in this order.
+    std::span<const JpegSegment> segments = {};
+};
+
+// Writes |coefficients| as a JPEG into |output|, replacing its contents: the
+// segments of |options|, the quantization tables of the components, Huffman
+// tables 0 for the first component and 1 for the others, the standard ones of
+// ITU T.81 Annex K unless optimized, and a single scan, interleaved unless
+// there is one component.
+// Throws std::invalid_argument on a layout baseline JPEG cannot hold.
+void EncodeCoefficients(const JpegCoefficients& coefficients, std::string* output,
+                        const EncodeOptions& options = {});
+
+// The Annex K.1 luminance or chrominance quantization table, row-major, scaled
+// for |quality| 1..100 the way libjpeg's jpeg_set_quality does.
+std::array<uint16_t, JpegCoefficients::kBlockSz> QualityQuantTable(int quality,
+                                                                   bool chrominance);
+
+enum class ChromaSubsampling { k444, k420 };
+
+// Baseline YCbCr encoder: color conversion, forward DCT and quantization into
+// coefficients, then EncodeCoefficients. The coefficient buffer is kept between
+// calls, so encoding another image of the same size into an |output| with
+// enough capacity makes no heap allocations.
+// Not thread-safe: use one JpegEncoder per thread.
+class JpegEncoder {
+public:
+    // |quality| 1..100 scales the Annex K quantization tables as libjpeg does,
+    // so files come out like those of cjpeg -quality with the same value.
+    explicit JpegEncoder(int quality = 75,
+                         ChromaSubsampling subsampling = ChromaSubsampling::k420);
+
+    void Encode(const Image& image, std::string* output);
+
+    // Coefficients of the last encoded image.
+    const JpegCoefficients& Coefficients() const {
+        return coefficients_;
+    }
+
+private:
+    ChromaSubsampling subsampling_;
+    // Reciprocals of the quantization steps with the scale of the forward DCT folded in.
+    std::array<float, JpegCoefficients::kBlockSz> luminance_scale_, chrominance_scale_;
+    JpegCoefficients coefficients_;
+};
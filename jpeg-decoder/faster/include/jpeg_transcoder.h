@@ -0,0 +1,92 @@
+#pragma once
+
+#include <jpeg_coefficients.h>
+#include <jpeg_decoder.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lossless transforms, as jpegtran names them.
+enum class JpegTransform {
+    kFlipHorizontal,
+    kFlipVertical,
+    kTranspose,   // Across the top-left to bottom-right diagonal.
+    kTransverse,  // Across the top-right to bottom-left diagonal.
+    kRotate90,    // Clockwise.
+    kRotate180,
+    kRotate270
+};
+
+// Moves, transposes and negates the blocks of |input| into |output|, which is
+// reused. A flipped edge can only stay exact when it ends on an MCU boundary,
+// so a partial MCU there is dropped, as jpegtran -trim does; an image smaller
+// than one MCU along a flipped axis throws std::invalid_argument.
+void TransformCoefficients(const JpegCoefficients& input, JpegTransform transform,
+                           JpegCoefficients* output);
+
+// The |width| x |height| region at (|x|, |y|). The offsets must be multiples of
+// the MCU size and the region must lie in the image, else std::invalid_argument.
+void CropCoefficients(const JpegCoefficients& input, size_t x, size_t y, size_t width,
+                      size_t height, JpegCoefficients* output);
+
+// Quantizes every component again with its table in |quant_tables|, row-major,
+// rounding to nearest and halves away from zero. Steps finer than the current
+// ones are left as they are: they cannot bring back what was already rounded
+// off and would only make the file larger. |output| may be |input|.
+void RequantizeCoefficients(
+    const JpegCoefficients& input,
+    std::span<const std::array<uint16_t, JpegCoefficients::kBlockSz>> quant_tables,
+    JpegCoefficients* output);
+
+// Places |tiles|, row-major with |columns| per row, side by side in one image.
+// They must have the same sampling and quantization tables, the same height
+// along a row and the same width along a column, and every tile but those of
+// the last row and column must end on an MCU boundary. Otherwise, or for an
+// image wider or taller than 65535, std::invalid_argument. DC is stored as is
+// and differences are taken again when the result is entropy-coded.
+void StitchCoefficients(std::span<const JpegCoefficients> tiles, size_t columns,
+                        JpegCoefficients* output);
+
+// Lossless transforms of in-memory JPEGs: entropy decoding into coefficients,
+// the block permutation, then EncodeCoefficients (jpeg_encoder.h). Buffers are
+// kept between calls. Transform and Crop keep only the image, APPn and COM
+// segments (with an EXIF orientation that may no longer hold) are dropped, as by
+// Stitch.
+// Not thread-safe: use one JpegTranscoder per thread.
+class JpegTranscoder {
+public:
+    void Transform(std::string_view input, JpegTransform transform, std::string* output);
+
+    void Crop(std::string_view input, size_t x, size_t y, size_t width, size_t height,
+              std::string* output);
+
+    // One JPEG out of a grid of tiles, see StitchCoefficients.
+    void Stitch(std::span<const std::string_view> tiles, size_t columns, std::string* output);
+
+    // Re-entropy-codes |input| with Huffman tables built for it. Coefficients,
+    // quantization tables and APPn/COM segments stay as they are, so the pixels
+    // do too. A multi-scan input comes out as a single scan.
+    void Optimize(std::string_view input, std::string* output);
+
+    // Lower quality variant of |input| without IDCT, color conversion or FDCT:
+    // its coefficients requantized with the tables of QualityQuantTable
+    // (jpeg_encoder.h), luminance for the first component, chrominance for the
+    // others. APPn and COM segments are kept.
+    void Requantize(std::string_view input, int quality, std::string* output);
+
+    // Optimized tables for Transform, Crop and Requantize as well. Off by default.
+    void SetOptimizeHuffman(bool optimize);
+
+private:
+    JpegDecoder decoder_;
+    JpegCoefficients input_, output_;
+    std::vector<JpegCoefficients> tiles_;
+    std::vector<JpegSegment> segments_;
+    std::vector<std::array<uint16_t, JpegCoefficients::kBlockSz>> quant_tables_;
+    bool optimize_huffman_ = false;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Opt-in timeline of decoding tasks, dumped as Chrome trace JSON that opens in
+// ui.perfetto.dev or chrome://tracing.
+//
+// Tracing is enabled per thread, so a server can trace a sample of its
+// requests: a traced scope costs two clock reads and a store, an untraced one
+// a thread-local load. The decoder traces its worker threads along with the
+// thread that called it. Every thread records into its own ring of
+// kThreadCapacity events (1.5 MB) without locks; Dump drains the rings while
+// the threads keep recording, and events overwritten before that are counted
+// as dropped.
+namespace trace {
+
+constexpr size_t kThreadCapacity = 1 << 16;
+
+// Enables or disables tracing on the calling thread.
+void Enable(bool enabled);
+
+// Writes the events recorded since the last Dump or Clear and forgets them.
+void Dump(std::ostream& out);
+
+// Forgets the events recorded so far.
+void Clear();
+
+// Events overwritten before a Dump or Clear reached them, since the start.
+size_t DroppedEvents();
+
+namespace detail {
+
+extern constinit thread_local bool enabled;
+
+int64_t Now();
+
+void Record(const char* name, int64_t begin, int64_t end);
+
+}  // namespace detail
+
+inline bool IsEnabled() {
+    return detail::enabled;
+}
+
+// Enables or disables tracing on the calling thread for its lifetime, then
+// restores the previous state: for one request, or for a task run on behalf
+// of a traced thread.
+class ScopedEnable {
+public:
+    explicit ScopedEnable(bool enabled = true) : previous_(IsEnabled()) {
+        Enable(enabled);
+    }
+
+    ScopedEnable(const ScopedEnable&) = delete;
+    ScopedEnable& operator=(const ScopedEnable&) = delete;
+
+    ~ScopedEnable() {
+        Enable(previous_);
+    }
+
+private:
+    bool previous_;
+};
+
+// Records its lifetime as one event. |name| must be a string literal.
+class Scope {
+public:
+    explicit Scope(const char* name) : name_(name), begin_(IsEnabled() ? detail::Now() : -1) {
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    ~Scope() {
+        if (begin_ >= 0) {
+            detail::Record(name_, begin_, detail::Now());
+        }
+    }
+
+private:
+    const char* name_;
+    int64_t begin_;
+};
+
+}  // namespace trace
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
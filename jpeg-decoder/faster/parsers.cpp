@@ -1,8 +1,17 @@
 #include "parsers.h"
+#include "exif.h"
+#include "standard_tables.h"
+#include "stats.h"
 
 #include <glog/logging.h>
+#include <trace.h>
 
-constexpr uint8_t kLowestByteMask = 0xf, kBlockSz = 64;
+#include <algorithm>
+
+constexpr uint8_t kLowestByteMask = 0xf;
+constexpr uint8_t kApp1 = 0xe1;
+// The standard allows 1..4, larger ones only make tiny inputs expensive.
+constexpr uint8_t kMaxSamplingFactor = 4;
 
 uint16_t GetPairHash(uint8_t a, bool b) {
     return (static_cast<uint16_t>(a) << 1) | b;
@@ -17,23 +26,8 @@ const ChannelMetadata& ImageMetadata::GetMetaByChannelId(uint8_t channel_id) con
     throw std::runtime_error("No meta for channel");
 }
 
-template <typename T>
-std::vector<T> GetZigZag(const std::vector<T>& data) {
-    if (data.size() != kBlockSz) {
-        // DLOG(ERROR) << "Bad block size for zig-zag: " << data.size() << "\n";
-        throw std::runtime_error("Bad block size for zig-zag");
-    }
-
-    constexpr uint8_t kZigZagMap[kBlockSz] = {
-        0,  1,  5,  6,  14, 15, 27, 28, 2,  4,  7,  13, 16, 26, 29, 42, 3,  8,  12, 17, 25, 30,
-        41, 43, 9,  11, 18, 24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38,
-        46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63};
-
-    std::vector<T> ans(kBlockSz);
-    for (size_t i = 0; i < data.size(); ++i) {
-        ans[i] = data[kZigZagMap[i]];
-    }
-    return ans;
+size_t ImageMetadata::GetIndexByChannelId(uint8_t channel_id) const {
+    return &GetMetaByChannelId(channel_id) - channels.data();
 }
 
 ImageMetadata::ImageMetadata(uint8_t precision, uint8_t channels_cnt, uint16_t height,
@@ -50,111 +44,136 @@ ImageMetadata::ImageMetadata(uint8_t precision, uint8_t channels_cnt, uint16_t h
     }
 }
 
-constexpr std::array<std::optional<Parser::MarkerType>, kU16Cnt> Parser::GetMarkerArr() {
-    std::array<std::optional<MarkerType>, kU16Cnt> ans;
-    ans[0xffd8] = MarkerType::BeginFile;
-    ans[0xffd9] = MarkerType::EndFile;
-    ans[0xfffe] = MarkerType::Comment;
-    ans[0xffdb] = MarkerType::Quant;
-    ans[0xffc0] = MarkerType::Meta;
-    ans[0xffc4] = MarkerType::Huffman;
-    ans[0xffda] = MarkerType::Data;
-    ans[0xffe0] = MarkerType::APPn;
-    ans[0xffe1] = MarkerType::APPn;
-    ans[0xffe2] = MarkerType::APPn;
-    ans[0xffe3] = MarkerType::APPn;
-    ans[0xffe4] = MarkerType::APPn;
-    ans[0xffe5] = MarkerType::APPn;
-    ans[0xffe6] = MarkerType::APPn;
-    ans[0xffe7] = MarkerType::APPn;
-    ans[0xffe8] = MarkerType::APPn;
-    ans[0xffe9] = MarkerType::APPn;
-    ans[0xffea] = MarkerType::APPn;
-    ans[0xffeb] = MarkerType::APPn;
-    ans[0xffec] = MarkerType::APPn;
-    ans[0xffed] = MarkerType::APPn;
-    ans[0xffee] = MarkerType::APPn;
-    ans[0xffef] = MarkerType::APPn;
+constexpr std::array<std::optional<Parser::MarkerType>, kU8Cnt> Parser::GetMarkerArr() {
+    std::array<std::optional<MarkerType>, kU8Cnt> ans;
+    ans[0xd8] = MarkerType::BeginFile;
+    ans[0xd9] = MarkerType::EndFile;
+    ans[0xfe] = MarkerType::Comment;
+    ans[0xdb] = MarkerType::Quant;
+    ans[0xc0] = MarkerType::Meta;
+    // Extended sequential with Huffman coding, baseline but for 16-bit quantization tables.
+    ans[0xc1] = MarkerType::Meta;
+    ans[0xc4] = MarkerType::Huffman;
+    ans[0xda] = MarkerType::Data;
+    ans[0xdd] = MarkerType::RestartInterval;
+    ans[0xe0] = MarkerType::APPn;
+    ans[0xe1] = MarkerType::APPn;
+    ans[0xe2] = MarkerType::APPn;
+    ans[0xe3] = MarkerType::APPn;
+    ans[0xe4] = MarkerType::APPn;
+    ans[0xe5] = MarkerType::APPn;
+    ans[0xe6] = MarkerType::APPn;
+    ans[0xe7] = MarkerType::APPn;
+    ans[0xe8] = MarkerType::APPn;
+    ans[0xe9] = MarkerType::APPn;
+    ans[0xea] = MarkerType::APPn;
+    ans[0xeb] = MarkerType::APPn;
+    ans[0xec] = MarkerType::APPn;
+    ans[0xed] = MarkerType::APPn;
+    ans[0xee] = MarkerType::APPn;
+    ans[0xef] = MarkerType::APPn;
     return ans;
 }
 
-const std::array<std::optional<Parser::MarkerType>, kU16Cnt> Parser::kWordToMarkerType =
-    GetMarkerArr();
+// constinit: filled at compile time, nothing runs at startup.
+constinit const std::array<std::optional<Parser::MarkerType>, kU8Cnt>
+    Parser::kMarkerTypeByLowByte = GetMarkerArr();
 
 RawImage Parser::ReadRawImage() {
+    RawImage image;
+    ReadRawImage(&image);
+    return image;
+}
+
+void Parser::ReadRawImage(RawImage* image) {
     // DLOG(INFO) << "Start reading raw image\n";
 
     if (ReadMarkerType() != MarkerType::BeginFile) {
         // DLOG(ERROR) << "No begin marker\n";
         throw std::runtime_error("No begin marker");
     }
+    ReadImage(image);
+}
 
-    std::array<std::optional<QuantumTable>, kU8Cnt> quantum_tables;
-    std::string comment;
-    std::optional<ImageData> image_data;
-    std::optional<ImageMetadata> metadata;
-    std::array<std::optional<HuffmanTree>, kU8Cnt * 2> huffman_trees;
+bool Parser::ReadNextRawImage(RawImage* image) {
+    constexpr Word kSoi = 0xffd8;
+    if (!bit_reader_.SkipPast(kSoi)) {
+        return false;
+    }
+    ReadImage(image);
+    return true;
+}
+
+void Parser::ReadImage(RawImage* image) {
+    image->comment.clear();
+    image->orientation = 1;
+    if (segments_ != nullptr) {
+        segments_->clear();
+    }
+    if (!keep_tables_) {
+        image->quantum_tables.fill(std::nullopt);
+        huffman_defined_.fill(false);
+    }
+    huffman_in_image_ = 0;
+    quant_in_image_ = 0;
+    restart_interval_ = 0;
+    scans_in_image_ = 0;
+    scanned_channels_.reset();
+    pending_scans_cnt_ = 0;
+    bool has_image_data = false, has_metadata = false;
 
     MarkerType marker;
     while ((marker = ReadMarkerType()) != MarkerType::EndFile) {
         if (marker == MarkerType::Meta) {
-            if (metadata.has_value()) {
+            if (has_metadata) {
                 // DLOG(ERROR) << "Two SOF markers\n";
                 throw std::runtime_error("Two SOF markers");
             }
-            metadata = ReadImageMeta();
+            ReadImageMeta(&image->metadata);
+            has_metadata = true;
         } else if (marker == MarkerType::Comment) {
-            comment = ReadComment();
+            ReadComment(&image->comment);
         } else if (marker == MarkerType::Quant) {
-            std::vector<QuantumTable> quantum_table = ReadQuantTable();
-            for (size_t i = 0; i < quantum_table.size(); ++i) {
-                uint8_t table_id = quantum_table[i].table_id;
-                if (quantum_tables[table_id].has_value()) {
-                    // DLOG(ERROR) << "Two or more quantum tables with one id\n";
-                    throw std::runtime_error("Two or more quantum tables with one id");
-                }
-                quantum_tables[table_id] = std::move(quantum_table[i]);
-            }
+            ReadQuantTable(&image->quantum_tables);
         } else if (marker == MarkerType::Huffman) {
-            std::vector<Huffman> huffman_tree = ReadHuffmanTree();
-            for (size_t i = 0; i < huffman_tree.size(); ++i) {
-                uint8_t tree_id = huffman_tree[i].table_id;
-                bool is_dc = huffman_tree[i].is_dc;
-                const uint16_t hash = GetPairHash(tree_id, is_dc);
-                if (huffman_trees[hash].has_value()) {
-                    // DLOG(ERROR) << "Two or more huffman trees with one id\n";
-                    throw std::runtime_error("Two or more huffman trees with one id");
-                }
-                huffman_trees[hash] = std::move(huffman_tree[i].tree);
-            }
+            ReadHuffmanTree();
+        } else if (marker == MarkerType::RestartInterval) {
+            ReadRestartInterval();
         } else if (marker == MarkerType::Data) {
-            if (!metadata.has_value()) {
+            if (!has_metadata) {
                 // DLOG(ERROR) << "No metadata before reading image data\n";
                 throw std::runtime_error("No metadata before reading image data");
             }
-            image_data = ReadImageData(huffman_trees, metadata.value());
+            StageTimer timer(stats_, &DecodeStats::Stages::entropy);
+            TRACE_SCOPE("entropy");
+            ReadImageData(image->metadata, &image->data);
+            has_image_data = true;
             bit_reader_.Align();
         } else if (marker == MarkerType::BeginFile) {
             // DLOG(ERROR) << "Begin marker in bad place\n";
             throw std::runtime_error("Begin marker in bad place");
         } else if (marker == MarkerType::APPn) {
-            ReadComment();
+            ReadAppSegment(&image->orientation);
         }
     }
 
-    if (!image_data.has_value() || !metadata.has_value()) {
-        // DLOG_IF(ERROR, !image_data.has_value()) << "No image data in file\n";
-        // DLOG_IF(ERROR, !metadata.has_value()) << "No metadata in file\n";
+    if (!has_image_data || !has_metadata) {
+        // DLOG_IF(ERROR, !has_image_data) << "No image data in file\n";
+        // DLOG_IF(ERROR, !has_metadata) << "No metadata in file\n";
         throw std::runtime_error("No image/meta data in file");
     }
+    if (scanned_channels_.count() != image->metadata.channels.size()) {
+        // DLOG(ERROR) << "Some channels are in no scan\n";
+        throw std::runtime_error("Channel without scan");
+    }
     // DLOG(INFO) << "Finished reading raw image\n";
-    return RawImage(std::move(image_data.value()), metadata.value(), comment, quantum_tables);
 }
 
 Parser::MarkerType Parser::ReadMarkerType() {
     const Word word = bit_reader_.ReadWord();
-    if (kWordToMarkerType[word].has_value()) {
-        return kWordToMarkerType[word].value();
+    if ((word >> 8) == 0xff && kMarkerTypeByLowByte[word & 0xff].has_value()) {
+        marker_ = word & 0xff;
+        return kMarkerTypeByLowByte[word & 0xff].value();
     }
     // DLOG(ERROR) << "Unknown marker " << std::hex << word << '\n';
     throw std::runtime_error("Unknown marker");
@@ -176,60 +195,83 @@ uint8_t Parser::ReadFromHuffmanTree(HuffmanTree* tree) {
     return ans;
 }
 
-std::vector<int16_t> Parser::ReadBlock(HuffmanTree* dc_tree, HuffmanTree* ac_tree,
-                                       int16_t& prev_dc) {
-    std::vector<int16_t> matrix;
-    matrix.reserve(kBlockSz);
+void Parser::ReadBlock(HuffmanTree* dc_tree, HuffmanTree* ac_tree, int16_t& prev_dc,
+                       int16_t* block) {
+    std::fill_n(block, kBlockSz, 0);
 
-    if (const uint8_t dc_sz = ReadFromHuffmanTree(dc_tree); dc_sz == 0) {
-        matrix.push_back(prev_dc);
-    } else {
-        const int16_t diff_dc = bit_reader_.ReadBitsSigned(dc_sz);
-        prev_dc += diff_dc;
-        matrix.push_back(prev_dc);
+    if (const uint8_t dc_sz = ReadFromHuffmanTree(dc_tree); dc_sz != 0) {
+        prev_dc += bit_reader_.ReadBitsSigned(dc_sz);
     }
+    block[0] = prev_dc;
 
-    while (matrix.size() < kBlockSz) {
+    size_t position = 1;
+    size_t eob_position = kBlockSz;
+    while (position < kBlockSz) {
         const uint8_t mask = ReadFromHuffmanTree(ac_tree);
         if (mask == 0) {
-            matrix.resize(kBlockSz, 0);
+            eob_position = position;
             break;
         }
         const uint8_t zeros_cnt = mask >> 4;
         const uint8_t ac_sz = mask & kLowestByteMask;
-        for (uint8_t i = 0; i < zeros_cnt; ++i) {
-            matrix.push_back(0);
-        }
-
-        if (ac_sz != 0 || zeros_cnt == 15) {
-            matrix.push_back(bit_reader_.ReadBitsSigned(ac_sz));
-        } else {
+        if (ac_sz == 0 && zeros_cnt != 15) {
             // DLOG(ERROR) << "Empty ac coef\n";
             throw std::runtime_error("Empty ac coef");
         }
+
+        position += zeros_cnt;
+        if (position >= kBlockSz) {
+            // DLOG(ERROR) << "Coefficient position: " << position << " >= " << kBlockSz << '\n';
+            throw std::runtime_error("Too many blocks in matrix");
+        }
+        block[kZigZagToNatural[position++]] = bit_reader_.ReadBitsSigned(ac_sz);
     }
 
-    if (matrix.size() != kBlockSz) {
-        // DLOG(ERROR) << "Matrix sz: " << matrix.size() << " != " << static_cast<int>(kBlockSz)
-        // << '\n';
-        throw std::runtime_error("Too many blocks in matrix");
+    if constexpr (kCollectStats) {
+        if (stats_ != nullptr) {
+            ++stats_->blocks;
+            stats_->dc_only_blocks += eob_position == 1;
+            stats_->eob_position_sum += eob_position;
+        }
     }
-    return GetZigZag(matrix);
 }
 
-std::string Parser::ReadComment() {
+void Parser::ReadComment(std::string* comment) {
     // DLOG(INFO) << "Start reading comment\n";
-    auto sz = ReadSz();
-    std::string comment;
-    comment.reserve(sz);
-    while (sz-- > 0) {
-        comment += bit_reader_.ReadByte();
+    const auto sz = ReadSz();
+    if (segments_ != nullptr) {
+        const auto view = bit_reader_.ReadView(sz);
+        segments_->push_back({marker_, view});
+        comment->assign(view);
+    } else {
+        comment->resize(sz);
+        bit_reader_.ReadBytes(comment->data(), sz);
     }
     // DLOG(INFO) << "Finish reading comment\n Comment: " << '\n';
-    return comment;
 }
 
-ImageMetadata Parser::ReadImageMeta() {
+void Parser::ReadAppSegment(uint8_t* orientation) {
+    const auto sz = ReadSz();
+    const bool is_exif_candidate = read_orientation_ && marker_ == kApp1;
+    std::string_view payload;
+    if (segments_ != nullptr) {
+        payload = bit_reader_.ReadView(sz);
+        segments_->push_back({marker_, payload});
+    } else if (is_exif_candidate) {
+        exif_buffer_.resize(sz);
+        bit_reader_.ReadBytes(exif_buffer_.data(), sz);
+        payload = exif_buffer_;
+    } else {
+        bit_reader_.Skip(sz);
+    }
+    if (is_exif_candidate) {
+        if (const auto exif = Exif::FromSegment(payload)) {
+            *orientation = exif->Orientation();
+        }
+    }
+}
+
+void Parser::ReadImageMeta(ImageMetadata* meta) {
     // DLOG(INFO) << "Start reading image metadata\n";
     auto sz = ReadSz();
 
@@ -248,6 +290,14 @@ ImageMetadata Parser::ReadImageMeta() {
         // DLOG(ERROR) << "Empty image\n";
         throw std::runtime_error("Empty image");
     }
+    if (precision != 8) {
+        // DLOG(ERROR) << "Sample precision " << int(precision) << '\n';
+        throw std::runtime_error("Only 8-bit samples are supported");
+    }
+    if (channels_cnt == 0) {
+        // DLOG(ERROR) << "No channels\n";
+        throw std::runtime_error("No channels");
+    }
 
     if (sz != channels_cnt * 3) {
         // DLOG_IF(ERROR, sz < channels_cnt * 3) << "Too little image metadata size: " << sz
@@ -257,27 +307,35 @@ ImageMetadata Parser::ReadImageMeta() {
         //     '\n';
         throw std::runtime_error("Bad metadata size");
     }
-    std::vector<ChannelMetadata> channels_info;
-    channels_info.reserve(channels_cnt);
+    meta->precision = precision;
+    meta->channels_cnt = channels_cnt;
+    meta->height = height;
+    meta->width = width;
+    meta->channels.clear();
     for (uint8_t c = 0; c < channels_cnt; ++c) {
         uint8_t id = bit_reader_.ReadByte();
         const uint8_t hv = bit_reader_.ReadByte();
         uint8_t h = hv >> 4, v = hv & kLowestByteMask;
+        if (h > kMaxSamplingFactor || v > kMaxSamplingFactor) {
+            // DLOG(ERROR) << "Sampling factor above 4: " << int(h) << 'x' << int(v) << '\n';
+            throw std::runtime_error("Too big sampling factor");
+        }
         uint8_t quant_id = bit_reader_.ReadByte();
-        channels_info.emplace_back(id, h, v, quant_id);
+        if (quant_id >= kQuantTablesCnt) {
+            // DLOG(ERROR) << "Quantization table id " << int(quant_id) << '\n';
+            throw std::runtime_error("Bad quantum table id");
+        }
+        meta->channels.emplace_back(id, h, v, quant_id);
     }
     // DLOG(INFO) << "Finish reading image metadata\n";
-    return ImageMetadata(precision, channels_cnt, height, width, channels_info);
 }
 
-std::vector<QuantumTable> Parser::ReadQuantTable() {
+void Parser::ReadQuantTable(
+    std::array<std::optional<QuantumTable>, kQuantTablesCnt>* quantum_tables) {
     // DLOG(INFO) << "Start reading quantum table\n";
 
     auto sz = ReadSz();
 
-    std::vector<QuantumTable> ans;
-    ans.reserve(sz / kBlockSz + 1);
-    std::vector<uint16_t> data(kBlockSz);
     while (sz > 0) {
         if (sz-- < 1) {
             // DLOG(ERROR) << "Too small quantum section size: " << sz << '\n';
@@ -299,6 +357,15 @@ std::vector<QuantumTable> Parser::ReadQuantTable() {
             throw std::runtime_error("Bad quantum size");
         }
         sz -= kBlockSz * value_len;
+
+        if (quant_in_image_ & (1u << quant_id)) {
+            // DLOG(ERROR) << "Two or more quantum tables with one id\n";
+            throw std::runtime_error("Two or more quantum tables with one id");
+        }
+        quant_in_image_ |= 1u << quant_id;
+        auto& table = (*quantum_tables)[quant_id];
+        table.emplace();
+        table->table_id = quant_id;
         for (size_t i = 0; i < kBlockSz; ++i) {
             uint16_t val;
             if (value_len == 1) {
@@ -306,27 +373,21 @@ std::vector<QuantumTable> Parser::ReadQuantTable() {
             } else {
                 val = bit_reader_.ReadWord();
             }
-            data[i] = val;
+            table->data[kZigZagToNatural[i]] = val;
         }
-
-        if (data.size() != kBlockSz) {
-            // DLOG(ERROR) << "Quantum table size not is 64\nReal size: " << data.size() << '\n';
-            throw std::runtime_error("Quantum table size not is 64");
-        }
-
-        ans.emplace_back(quant_id, GetZigZag(data));
     }
 
     // DLOG(INFO) << "Finished reading quantum tables" << '\n';
-    return ans;
 }
 
-std::vector<Huffman> Parser::ReadHuffmanTree() {
+void Parser::ReadHuffmanTree() {
     // DLOG(INFO) << "Start reading Huffman tree\n";
 
     auto sz = ReadSz();
 
-    std::vector<Huffman> ans;
+    // A later DHT may redefine a table between scans, one segment may not
+    // define it twice.
+    uint32_t in_segment = 0;
     while (sz > 0) {
         if (sz-- < 17) {
             // DLOG(ERROR) << "Too small huffman section size: " << sz << '\n';
@@ -336,8 +397,18 @@ std::vector<Huffman> Parser::ReadHuffmanTree() {
         const bool is_dc = (mask >> 4) == 0;
         const uint8_t table_id = mask & kLowestByteMask;
 
+        const uint16_t hash = GetPairHash(table_id, is_dc);
+        if (in_segment & (1u << hash)) {
+            // DLOG(ERROR) << "Two or more huffman trees with one id\n";
+            throw std::runtime_error("Two or more huffman trees with one id");
+        }
+        in_segment |= 1u << hash;
+        huffman_in_image_ |= 1u << hash;
+
+        auto& code_lengths = code_lengths_[hash];
+        auto& values = huffman_values_[hash];
+        code_lengths.resize(16);
         unsigned sum_lengths = 0;
-        std::vector<uint8_t> code_lengths(16);
         for (size_t i = 0; i < code_lengths.size(); ++i, --sz) {
             code_lengths[i] = bit_reader_.ReadByte();
             sum_lengths += code_lengths[i];
@@ -349,21 +420,69 @@ std::vector<Huffman> Parser::ReadHuffmanTree() {
             throw std::runtime_error("Bad Huffman table size");
         }
 
-        std::vector<uint8_t> values(sum_lengths);
+        values.resize(sum_lengths);
         for (unsigned i = 0; i < sum_lengths; ++i, --sz) {
             values[i] = bit_reader_.ReadByte();
         }
 
-        auto tree = HuffmanTree();
-        tree.Build(code_lengths, values);
-        ans.emplace_back(is_dc, table_id, std::move(tree));
+        // A table that fails to build is not defined.
+        huffman_defined_[hash] = false;
+        if (!huffman_trees_[hash].has_value()) {
+            huffman_trees_[hash].emplace();
+        }
+        huffman_trees_[hash]->Build(code_lengths, values);
+        huffman_defined_[hash] = true;
     }
     // DLOG(INFO) << "Finished reading Huffman tree\n";
-    return ans;
 }
 
-ImageData Parser::ReadImageData(std::array<std::optional<HuffmanTree>, kU8Cnt * 2>& huffman_trees,
-                                const ImageMetadata& meta) {
+HuffmanTree* Parser::GetHuffmanTree(uint8_t table_id, bool is_dc) {
+    const uint16_t hash = GetPairHash(table_id, is_dc);
+    if (!huffman_defined_[hash]) {
+        // Only an image with no DHT at all is decoded with the standard tables,
+        // one that defines some but not the tables its scan refers to is broken.
+        const HuffmanSpec* spec = nullptr;
+        if (huffman_in_image_ != 0) {
+            // DLOG(ERROR) << "No huffman tree " << int(table_id) << '\n';
+            throw std::runtime_error("No huffman table found");
+        } else if (table_id == 0) {
+            spec = is_dc ? &standard_tables::kDcLuminance : &standard_tables::kAcLuminance;
+        } else if (table_id == 1) {
+            spec = is_dc ? &standard_tables::kDcChrominance : &standard_tables::kAcChrominance;
+        } else {
+            // DLOG(ERROR) << "No huffman tree " << int(table_id) << '\n';
+            throw std::runtime_error("No huffman table found");
+        }
+        code_lengths_[hash].assign(spec->code_lengths.begin(), spec->code_lengths.end());
+        huffman_values_[hash].assign(spec->values.begin(), spec->values.end());
+        if (!huffman_trees_[hash].has_value()) {
+            huffman_trees_[hash].emplace();
+        }
+        huffman_trees_[hash]->Build(code_lengths_[hash], huffman_values_[hash]);
+        huffman_defined_[hash] = true;
+    }
+    return &huffman_trees_[hash].value();
+}
+
+void Parser::ReadRestartInterval() {
+    if (ReadSz() != 2) {
+        // DLOG(ERROR) << "DRI section size is not 2\n";
+        throw std::runtime_error("Bad DRI size");
+    }
+    restart_interval_ = bit_reader_.ReadWord();
+}
+
+// Entropy-coded segments end byte-aligned, followed by RST0..RST7 cyclically.
+void Parser::ReadRestartMarker(uint16_t index) {
+    constexpr Word kRst0 = 0xffd0;
+    bit_reader_.Align();
+    if (bit_reader_.ReadWord() != kRst0 + index % 8) {
+        // DLOG(ERROR) << "Expected RST" << index % 8 << '\n';
+        throw std::runtime_error("Bad restart marker");
+    }
+}
+
+void Parser::ReadImageData(const ImageMetadata& meta, ImageData* data) {
     // DLOG(INFO) << "Start reading image data\n";
     auto sz = ReadSz();
 
@@ -381,31 +500,37 @@ ImageData Parser::ReadImageData(std::array<std::optional<HuffmanTree>, kU8Cnt *
     }
     sz -= channels_cnt * 2;
 
-    std::vector<uint8_t> channel_ids(channels_cnt);
-    std::vector<HuffmanTree*> dc_trees(channels_cnt);
-    std::vector<HuffmanTree*> ac_trees(channels_cnt);
+    if (channels_cnt == 0) {
+        // DLOG(ERROR) << "Scan without channels\n";
+        throw std::runtime_error("Empty scan");
+    }
+    if (channels_cnt > kMaxScanChannels) {
+        // DLOG(ERROR) << "Scan of " << int(channels_cnt) << " channels\n";
+        throw std::runtime_error("Too many channels in scan");
+    }
+
+    if (scans_in_image_++ == 0) {
+        StartImageData(meta, data);
+    }
 
+    Scan scan;
+    scan.channels_cnt = channels_cnt;
+    scan.restart_interval = restart_interval_;
     for (uint8_t c = 0; c < channels_cnt; ++c) {
-        channel_ids[c] = bit_reader_.ReadByte();
+        const uint8_t channel_id = bit_reader_.ReadByte();
         const uint8_t mask = bit_reader_.ReadByte();
-        const uint8_t dc_id = mask >> 4, ac_id = mask & kLowestByteMask;
-
-        const uint16_t hash_dc = GetPairHash(dc_id, true);
-        const uint16_t hash_ac = GetPairHash(ac_id, false);
-        if (!huffman_trees[hash_dc].has_value()) {
-            // DLOG(ERROR) << "No dc huffman tree found for channel: " << static_cast<int>(c) <<
-            // '\n';
-            throw std::runtime_error("No huffman table found");
+        scan.dc_ids[c] = mask >> 4;
+        scan.ac_ids[c] = mask & kLowestByteMask;
+
+        scan.dc_trees[c] = GetHuffmanTree(scan.dc_ids[c], true);
+        scan.ac_trees[c] = GetHuffmanTree(scan.ac_ids[c], false);
+        const size_t index = meta.GetIndexByChannelId(channel_id);
+        if (scanned_channels_[index]) {
+            // DLOG(ERROR) << "Channel " << int(channel_id) << " in two scans\n";
+            throw std::runtime_error("Channel in two scans");
         }
-
-        if (!huffman_trees[hash_ac].has_value()) {
-            // DLOG(ERROR) << "No ac huffman tree found for channel: " << static_cast<int>(c) <<
-            // "\n";
-            throw std::runtime_error("No huffman table found");
-        }
-
-        dc_trees[c] = &huffman_trees[hash_dc].value();
-        ac_trees[c] = &huffman_trees[hash_ac].value();
+        scanned_channels_.set(index);
+        scan.channels[c] = index;
     }
 
     if (sz < 3) {
@@ -425,49 +550,180 @@ ImageData Parser::ReadImageData(std::array<std::optional<HuffmanTree>, kU8Cnt *
         (void)bit_reader_.ReadByte();
     }
 
-    uint8_t h_max = 0, v_max = 0;
-    for (size_t i = 0; i < meta.channels.size(); ++i) {
-        h_max = std::max(h_max, meta.channels[i].h);
-        v_max = std::max(v_max, meta.channels[i].v);
+    if (channels_cnt == 1) {
+        // A one-component scan is never interleaved: its blocks go in raster
+        // order over the component, whatever its sampling factors.
+        const auto& channel = data->channels[scan.channels[0]];
+        const size_t width = (meta.width * channel.h + data->h_max - 1) / data->h_max;
+        const size_t height = (meta.height * channel.v + data->v_max - 1) / data->v_max;
+        scan.blocks_w = (width + 7) / 8;
+        scan.blocks_h = (height + 7) / 8;
     }
 
+    // DLOG(INFO) << "Ended reading meta in image data\nChannels cnt: "
+    //            << static_cast<int>(channels_cnt) << "\nMCU_H: " << data->mcu_h
+    //            << "\nMCU_W: " << data->mcu_w << '\n';
+
+    // Every component is in exactly one scan: a scan of all of them is the
+    // only one of its frame and has nothing to run alongside.
+    if (defer_scans_ && channels_cnt < data->ChannelsCount() && bit_reader_.RemainingView()) {
+        DeferScan(scan);
+    } else {
+        DecodeScan(scan, data);
+    }
+    // DLOG(INFO) << "Finished reading image data\n";
+}
+
+void Parser::StartImageData(const ImageMetadata& meta, ImageData* data) {
+    uint8_t h_max = 0, v_max = 0;
+    for (const auto& channel : meta.channels) {
+        if (channel.h == 0 || channel.v == 0) {
+            // DLOG(ERROR) << "WHY SAMPLING FACTOR IS ZERO?!";
+            throw std::runtime_error("sampling factor is zero");
+        }
+        h_max = std::max(h_max, channel.h);
+        v_max = std::max(v_max, channel.v);
+    }
     if (h_max == 0 || v_max == 0) {
         // DLOG(ERROR) << "WHY SAMPLING FACTOR IS ZERO?!";
         throw std::runtime_error("sampling factor is zero");
     }
 
-    const uint16_t mcu_h = (meta.height + 8 * v_max - 1) / (8 * v_max);
-    const uint16_t mcu_w = (meta.width + 8 * h_max - 1) / (8 * h_max);
+    data->channels = meta.channels;
+    data->h_max = h_max;
+    data->v_max = v_max;
+    data->mcu_h = (meta.height + 8 * v_max - 1) / (8 * v_max);
+    data->mcu_w = (meta.width + 8 * h_max - 1) / (8 * h_max);
 
-    // DLOG(INFO) << "Ended reading meta in image data\nChannels cnt: "
-    //            << static_cast<int>(channels_cnt) << "\nMCU_H: " << mcu_h << "\nMCU_W: " << mcu_w
-    //            << '\n';
+    if (data->channel_blocks.size() < data->ChannelsCount()) {
+        data->channel_blocks.resize(data->ChannelsCount());
+    }
+    // Buffers grow row by row as scans are decoded, so a header promising a
+    // huge image costs memory only for the rows the scans really have.
+    for (size_t c = 0; c < data->ChannelsCount(); ++c) {
+        data->channel_blocks[c].clear();
+    }
+}
 
-    std::vector<int16_t> prev_dc(channels_cnt, 0);
-    std::vector<std::vector<std::vector<int16_t>>> channel_matrix(channels_cnt);
-    std::vector<ChannelMetadata> channel_metadata(channels_cnt);
-    for (uint8_t c = 0; c < channels_cnt; ++c) {
-        const uint8_t channel_id = channel_ids[c];
-        channel_metadata[c] = meta.GetMetaByChannelId(channel_id);
-        const size_t h = channel_metadata[c].h, v = channel_metadata[c].v;
-        channel_matrix[c].reserve(h * v * mcu_h * mcu_w);
-    }
-    for (uint16_t mcu_y = 0; mcu_y < mcu_h; ++mcu_y) {
-        for (uint16_t mcu_x = 0; mcu_x < mcu_w; ++mcu_x) {
-            for (uint8_t c = 0; c < channels_cnt; ++c) {
-                const auto& channel_meta = channel_metadata[c];
-                const uint8_t h = channel_meta.h, v = channel_meta.v;
-
-                for (uint8_t block_v = 0; block_v < v; ++block_v) {
-                    for (uint8_t block_h = 0; block_h < h; ++block_h) {
-                        auto block = ReadBlock(dc_trees[c], ac_trees[c], prev_dc[c]);
-                        channel_matrix[c].push_back(std::move(block));
-                    }
+void Parser::DeferScan(const Scan& scan) {
+    if (pending_scans_.size() == pending_scans_cnt_) {
+        pending_scans_.emplace_back();
+    }
+    auto& pending = pending_scans_[pending_scans_cnt_++];
+    pending.scan = scan;
+    for (uint8_t c = 0; c < scan.channels_cnt; ++c) {
+        const uint16_t hashes[] = {GetPairHash(scan.dc_ids[c], true),
+                                   GetPairHash(scan.ac_ids[c], false)};
+        for (size_t k = 0; k < 2; ++k) {
+            auto& tree = pending.trees[2 * c + k];
+            if (!tree.has_value()) {
+                tree.emplace();
+            }
+            tree->Build(code_lengths_[hashes[k]], huffman_values_[hashes[k]]);
+        }
+    }
+
+    // Entropy-coded data ends at the first marker that is not RSTn, a 0xFF
+    // inside of it is always followed by a stuffed 0x00.
+    const auto rest = *bit_reader_.RemainingView();
+    size_t size = rest.size();
+    for (size_t pos = rest.find('\xff'); pos != std::string_view::npos && pos + 1 < rest.size();
+         pos = rest.find('\xff', pos + 1)) {
+        const auto next = static_cast<uint8_t>(rest[pos + 1]);
+        if (next != 0x00 && (next < 0xd0 || next > 0xd7)) {
+            size = pos;
+            break;
+        }
+    }
+    pending.data = bit_reader_.ReadView(size);
+}
+
+void Parser::DecodePendingScan(size_t index, RawImage* image, DecodeStats* stats) {
+    auto& pending = pending_scans_.at(index);
+    Scan scan = pending.scan;
+    for (uint8_t c = 0; c < scan.channels_cnt; ++c) {
+        scan.dc_trees[c] = &pending.trees[2 * c].value();
+        scan.ac_trees[c] = &pending.trees[2 * c + 1].value();
+    }
+
+    MemoryStreamBuf buffer;
+    buffer.Reset(pending.data);
+    std::istream input(&buffer);
+    Parser worker(input, stats);
+    worker.DecodeScan(scan, &image->data);
+}
+
+void Parser::DecodeScan(const Scan& scan, ImageData* data) {
+    const size_t scan_bytes_before = bit_reader_.BitsBytesRead();
+    const size_t stuffed_bytes_before = bit_reader_.StuffedBytes();
+
+    if (scan.channels_cnt == 1) {
+        DecodeComponentScan(scan, data);
+    } else {
+        DecodeInterleavedScan(scan, data);
+    }
+
+    if constexpr (kCollectStats) {
+        if (stats_ != nullptr) {
+            stats_->scan_bytes += bit_reader_.BitsBytesRead() - scan_bytes_before;
+            stats_->stuffed_bytes += bit_reader_.StuffedBytes() - stuffed_bytes_before;
+        }
+    }
+}
+
+void Parser::DecodeInterleavedScan(const Scan& scan, ImageData* data) {
+    std::array<int16_t, kMaxScanChannels> prev_dc{};
+    std::array<size_t, kMaxScanChannels> now_block{};
+    size_t mcu_index = 0;
+    uint16_t restarts = 0;
+    for (uint16_t mcu_y = 0; mcu_y < data->mcu_h; ++mcu_y) {
+        for (uint8_t c = 0; c < scan.channels_cnt; ++c) {
+            const size_t channel = scan.channels[c];
+            data->channel_blocks[channel].resize((mcu_y + 1) * data->BlocksInMcuRow(channel) *
+                                                 kBlockSz);
+        }
+        for (uint16_t mcu_x = 0; mcu_x < data->mcu_w; ++mcu_x, ++mcu_index) {
+            if (scan.restart_interval != 0 && mcu_index != 0 &&
+                mcu_index % scan.restart_interval == 0) {
+                ReadRestartMarker(restarts++);
+                prev_dc.fill(0);
+            }
+            for (uint8_t c = 0; c < scan.channels_cnt; ++c) {
+                const size_t channel = scan.channels[c];
+                const size_t blocks_in_mcu = data->channels[channel].h * data->channels[channel].v;
+                for (size_t i = 0; i < blocks_in_mcu; ++i) {
+                    ReadBlock(scan.dc_trees[c], scan.ac_trees[c], prev_dc[c],
+                              data->Block(channel, now_block[c]++));
                 }
             }
         }
     }
+}
 
-    // DLOG(INFO) << "Finished reading image data\n";
-    return ImageData(std::move(channel_matrix), channel_ids, mcu_h, mcu_w);
+void Parser::DecodeComponentScan(const Scan& scan, ImageData* data) {
+    const size_t channel = scan.channels[0];
+    const size_t h = data->channels[channel].h, v = data->channels[channel].v;
+    const size_t row_blocks = data->BlocksInMcuRow(channel);
+    auto& blocks = data->channel_blocks[channel];
+
+    int16_t prev_dc = 0;
+    size_t block_index = 0;
+    uint16_t restarts = 0;
+    for (size_t y = 0; y < scan.blocks_h; ++y) {
+        if (y % v == 0) {
+            blocks.resize((y / v + 1) * row_blocks * kBlockSz);
+        }
+        for (size_t x = 0; x < scan.blocks_w; ++x, ++block_index) {
+            if (scan.restart_interval != 0 && block_index != 0 &&
+                block_index % scan.restart_interval == 0) {
+                ReadRestartMarker(restarts++);
+                prev_dc = 0;
+            }
+            const size_t mcu = y / v * data->mcu_w + x / h;
+            ReadBlock(scan.dc_trees[0], scan.ac_trees[0], prev_dc,
+                      data->Block(channel, mcu * h * v + y % v * h + x % h));
+        }
+    }
+    // Blocks of the MCU grid beyond the component are not coded.
+    blocks.resize(data->mcu_h * row_blocks * kBlockSz);
 }
@@ -1,34 +1,47 @@
 #pragma once
 
 #include "bit_reader.h"
+#include "include/decode_stats.h"
 #include "include/huffman.h"
+#include "include/jpeg_decoder.h"
 
 #include <array>
+#include <bitset>
 #include <cstdint>
 #include <limits>
 #include <optional>
+#include <string>
 #include <vector>
 
 constexpr int kU8Cnt = std::numeric_limits<uint8_t>::max() + 1;
 constexpr int kU16Cnt = std::numeric_limits<uint16_t>::max() + 1;
 
-struct QuantumTable {
-    QuantumTable(uint8_t table_id, const std::vector<uint16_t> &data)
-        : table_id(table_id), data(data) {
-    }
+constexpr size_t kBlockSz = 64;
+// DHT table ids are 4 bits wide, each id may hold a DC and an AC table.
+constexpr size_t kHuffmanTablesCnt = 16 * 2;
+// DQT table ids are 4 bits wide too.
+constexpr size_t kQuantTablesCnt = 16;
+// Components of one scan, the standard allows no more.
+constexpr size_t kMaxScanChannels = 4;
 
-    uint8_t table_id;
-    std::vector<uint16_t> data;
-};
+// Row-major index of the i-th coefficient in zig-zag order.
+inline constexpr std::array<uint8_t, kBlockSz> kZigZagToNatural = [] {
+    constexpr uint8_t kZigZagMap[kBlockSz] = {
+        0,  1,  5,  6,  14, 15, 27, 28, 2,  4,  7,  13, 16, 26, 29, 42, 3,  8,  12, 17, 25, 30,
+        41, 43, 9,  11, 18, 24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38,
+        46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63};
 
-struct Huffman {
-    Huffman(bool is_dc, uint8_t table_id, HuffmanTree &&tree)
-        : is_dc(is_dc), table_id(table_id), tree(std::move(tree)) {
+    std::array<uint8_t, kBlockSz> ans{};
+    for (uint8_t i = 0; i < kBlockSz; ++i) {
+        ans[kZigZagMap[i]] = i;
     }
+    return ans;
+}();
 
-    bool is_dc;
-    uint8_t table_id;
-    HuffmanTree tree;
+struct QuantumTable {
+    uint8_t table_id = 0;
+    // Row-major 8x8, already out of zig-zag order.
+    std::array<uint16_t, kBlockSz> data{};
 };
 
 struct ChannelMetadata {
@@ -40,47 +53,122 @@ struct ChannelMetadata {
 };
 
 struct ImageMetadata {
+    ImageMetadata() = default;
     ImageMetadata(uint8_t precision, uint8_t channels_cnt, uint16_t height, uint16_t width,
                   const std::vector<ChannelMetadata> &channels);
 
-    uint8_t precision, channels_cnt;
-    uint16_t height, width;
+    uint8_t precision = 0, channels_cnt = 0;
+    uint16_t height = 0, width = 0;
     std::vector<ChannelMetadata> channels;
 
     const ChannelMetadata &GetMetaByChannelId(uint8_t channel_id) const;
+    size_t GetIndexByChannelId(uint8_t channel_id) const;
 };
 
+// Coefficients (and later samples) of the image. Each channel keeps its blocks
+// in one flat buffer, 64 values per block in row-major order, blocks in the
+// order an interleaved scan stores them: MCU by MCU, v * h blocks of the
+// channel per MCU. Blocks of one-component scans are put in the same order.
 struct ImageData {
-    ImageData(std::vector<std::vector<std::vector<int16_t>>> &&channel_matrix,
-              const std::vector<uint8_t> &channel_ids, uint16_t mcu_h, uint16_t mcu_w)
-        : channel_matrix(std::move(channel_matrix)),
-          channel_ids(channel_ids),
-          mcu_h(mcu_h),
-          mcu_w(mcu_w) {
+    int16_t *Block(size_t channel, size_t index) {
+        return channel_blocks[channel].data() + index * kBlockSz;
     }
-    std::vector<std::vector<std::vector<int16_t>>> channel_matrix;
-    std::vector<uint8_t> channel_ids;
-    uint16_t mcu_h, mcu_w;
-};
 
-struct RawImage {
-    RawImage(ImageData &&data, const ImageMetadata &meta, const std::string &comment,
-             const std::array<std::optional<QuantumTable>, kU8Cnt> &quantum_tables)
-        : comment(comment), data(std::move(data)), metadata(meta), quantum_tables(quantum_tables) {
+    const int16_t *Block(size_t channel, size_t index) const {
+        return channel_blocks[channel].data() + index * kBlockSz;
+    }
+
+    size_t BlocksCount(size_t channel) const {
+        return channel_blocks[channel].size() / kBlockSz;
     }
 
+    size_t BlocksInMcuRow(size_t channel) const {
+        return static_cast<size_t>(mcu_w) * channels[channel].h * channels[channel].v;
+    }
+
+    size_t ChannelsCount() const {
+        return channels.size();
+    }
+
+    // Buffers are never shrunk, so only the first ChannelsCount() are in use.
+    std::vector<std::vector<int16_t>> channel_blocks;
+    // Frame components, in frame order.
+    std::vector<ChannelMetadata> channels;
+    uint16_t mcu_h = 0, mcu_w = 0;
+    uint8_t h_max = 0, v_max = 0;
+};
+
+struct RawImage {
     std::string comment;
     ImageData data;
     ImageMetadata metadata;
-    std::array<std::optional<QuantumTable>, kU8Cnt> quantum_tables;
+    std::array<std::optional<QuantumTable>, kQuantTablesCnt> quantum_tables;
+    // EXIF orientation, 1..8. Read only if Parser::SetReadOrientation was called.
+    uint8_t orientation = 1;
 };
 
+// Reads the markers and the scan of a baseline JPEG. A Parser may be reused
+// for many images: Huffman trees and all the buffers of RawImage keep their
+// memory, so an image of an already seen layout is parsed without allocations.
 class Parser {
 public:
-    explicit Parser(std::istream &is) : bit_reader_(is) {
+    Parser() = default;
+
+    // |stats| may be null, see decode_stats.h.
+    explicit Parser(std::istream &is, DecodeStats *stats = nullptr)
+        : bit_reader_(is), stats_(stats) {
+    }
+
+    // With |segments| every APPn and COM segment is kept there as a view, see
+    // JpegSegment; |is| must then read through a MemoryStreamBuf. Without it
+    // APPn segments are skipped by length.
+    void Reset(std::istream &is, DecodeStats *stats = nullptr,
+               std::vector<JpegSegment> *segments = nullptr) {
+        bit_reader_.Reset(is);
+        stats_ = stats;
+        segments_ = segments;
+    }
+
+    // Whether APP1 EXIF segments are read for RawImage::orientation instead of
+    // being skipped. Off by default.
+    void SetReadOrientation(bool read_orientation) {
+        read_orientation_ = read_orientation;
+    }
+
+    // Whether the quantization and Huffman tables of an image stay defined for
+    // the next ones read by this Parser, as Motion-JPEG frames expect: a frame
+    // may redefine them but need not. Off by default.
+    void SetKeepTables(bool keep_tables) {
+        keep_tables_ = keep_tables;
     }
 
     RawImage ReadRawImage();
+    // Same, but fills |image| in place reusing its buffers.
+    void ReadRawImage(RawImage *image);
+    // Reads the next image of a stream of concatenated ones, skipping whatever
+    // precedes its SOI. Returns false if the stream ends before one starts.
+    bool ReadNextRawImage(RawImage *image);
+
+    // With |defer_scans| the scans of an in-memory input with more than one
+    // scan are only located, not decoded: ReadRawImage leaves them to
+    // DecodePendingScan. A single scan is decoded in place. Off by default.
+    void SetDeferScans(bool defer_scans) {
+        defer_scans_ = defer_scans;
+    }
+
+    // Scans of the last image left by ReadRawImage.
+    size_t PendingScansCount() const {
+        return pending_scans_cnt_;
+    }
+
+    // Decodes pending scan |index| into |image|, the one ReadRawImage filled.
+    // Each scan owns its trees and writes its own components only, so distinct
+    // scans may be decoded on different threads, each with its own |stats|.
+    void DecodePendingScan(size_t index, RawImage *image, DecodeStats *stats = nullptr);
+
+    // Decodes one block of the scan into |block| (64 values, row-major).
+    // Public for the allocation tests and the kernel benchmarks.
+    void ReadBlock(HuffmanTree *dc_tree, HuffmanTree *ac_tree, int16_t &prev_dc, int16_t *block);
 
 private:
     enum class MarkerType {
@@ -91,20 +179,81 @@ private:
         Quant,
         Meta,
         Huffman,
+        RestartInterval,
         Data,
     };
 
-    constexpr static std::array<std::optional<MarkerType>, kU16Cnt> GetMarkerArr();
+    constexpr static std::array<std::optional<MarkerType>, kU8Cnt> GetMarkerArr();
     MarkerType ReadMarkerType();
     Word ReadSz();
     uint8_t ReadFromHuffmanTree(HuffmanTree *tree);
-    std::vector<int16_t> ReadBlock(HuffmanTree *, HuffmanTree *, int16_t &);
-    std::string ReadComment();
-    ImageMetadata ReadImageMeta();
-    std::vector<QuantumTable> ReadQuantTable();
-    std::vector<Huffman> ReadHuffmanTree();
-    ImageData ReadImageData(std::array<std::optional<HuffmanTree>, kU8Cnt * 2> &,
-                            const ImageMetadata &);
+    // Everything after SOI up to and including EOI.
+    void ReadImage(RawImage *image);
+    void ReadComment(std::string *comment);
+    void ReadAppSegment(uint8_t *orientation);
+    void ReadImageMeta(ImageMetadata *meta);
+    void ReadQuantTable(std::array<std::optional<QuantumTable>, kQuantTablesCnt> *quantum_tables);
+    // The tree for a table the scan uses, the standard one if the image has no DHT.
+    HuffmanTree *GetHuffmanTree(uint8_t table_id, bool is_dc);
+    void ReadHuffmanTree();
+    void ReadRestartInterval();
+    void ReadRestartMarker(uint16_t index);
+    // Components of one scan as indices into ImageData::channels, with their trees.
+    struct Scan {
+        uint8_t channels_cnt = 0;
+        std::array<uint8_t, kMaxScanChannels> channels{};
+        std::array<uint8_t, kMaxScanChannels> dc_ids{}, ac_ids{};
+        std::array<HuffmanTree *, kMaxScanChannels> dc_trees{}, ac_trees{};
+        uint16_t restart_interval = 0;
+        // Size of the component in blocks, for a non-interleaved scan.
+        size_t blocks_w = 0, blocks_h = 0;
+    };
+
+    // A located scan: its entropy-coded bytes and trees built just for it.
+    // A HuffmanTree keeps decoding state, so scans decoded concurrently
+    // cannot share one.
+    struct PendingScan {
+        Scan scan;
+        std::string_view data;
+        std::array<std::optional<HuffmanTree>, 2 * kMaxScanChannels> trees;
+    };
+
+    void ReadImageData(const ImageMetadata &meta, ImageData *data);
+    // Sets up |data| for the components of the frame, at its first scan.
+    void StartImageData(const ImageMetadata &meta, ImageData *data);
+    void DecodeScan(const Scan &scan, ImageData *data);
+    void DecodeInterleavedScan(const Scan &scan, ImageData *data);
+    void DecodeComponentScan(const Scan &scan, ImageData *data);
+    void DeferScan(const Scan &scan);
     BitReader bit_reader_;
-    static const std::array<std::optional<MarkerType>, kU16Cnt> kWordToMarkerType;
-};
\ No newline at end of file
+    DecodeStats *stats_ = nullptr;
+    std::vector<JpegSegment> *segments_ = nullptr;
+    // Second byte of the last marker read.
+    uint8_t marker_ = 0;
+    bool read_orientation_ = false;
+    // APP1 payload when it cannot be viewed in place.
+    std::string exif_buffer_;
+    bool keep_tables_ = false;
+    // Trees are built in place by every DHT, |huffman_defined_| tells which of
+    // them hold a table the scan may use. An image without DHT gets the
+    // standard tables instead, built once and kept like any other.
+    std::array<std::optional<HuffmanTree>, kHuffmanTablesCnt> huffman_trees_;
+    std::array<bool, kHuffmanTablesCnt> huffman_defined_{};
+    // Tables defined by the current image, bit per table. A DHT may redefine a
+    // table for a later scan, deferred scans have copies of the earlier one.
+    uint32_t huffman_in_image_ = 0;
+    uint16_t quant_in_image_ = 0;
+    // Code lengths and values of every tree, for the trees of deferred scans.
+    std::array<std::vector<uint8_t>, kHuffmanTablesCnt> code_lengths_, huffman_values_;
+    // MCUs between RSTn markers as set by DRI, 0 if there are none.
+    uint16_t restart_interval_ = 0;
+    // Scans read so far in the current image, each frame component must be in one.
+    size_t scans_in_image_ = 0;
+    std::bitset<kU8Cnt> scanned_channels_;
+    bool defer_scans_ = false;
+    // Only the first |pending_scans_cnt_| are in use, the rest keep their trees.
+    std::vector<PendingScan> pending_scans_;
+    size_t pending_scans_cnt_ = 0;
+    // Marker types by the second byte of the marker, the first one is always 0xff.
+    static const std::array<std::optional<MarkerType>, kU8Cnt> kMarkerTypeByLowByte;
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Adaptive probability of a zero bit in one context. After n bits it moves
+// 1/(n + 2) of the way towards the next one, until n reaches kMaxSeen: a new
+// context learns quickly and a busy one settles. A model keeps one per context.
+struct BitProbability {
+    // Out of 1 << 16.
+    uint16_t zero = 1 << 15;
+    uint8_t seen = 0;
+};
+
+constexpr BitProbability kEvenProbability{};
+
+namespace range_coder {
+
+constexpr int kProbabilityBits = 12;
+// The coder never treats a bit as more likely than this, out of
+// 1 << kProbabilityBits, so that every bit costs at least 0.0056 bits.
+constexpr uint32_t kMaxProbability = (1 << kProbabilityBits) - 16;
+constexpr uint32_t kTop = 1 << 24;
+constexpr uint8_t kMaxSeen = 60;
+
+constexpr std::array<uint32_t, kMaxSeen + 1> kSteps = [] {
+    std::array<uint32_t, kMaxSeen + 1> steps{};
+    for (size_t n = 0; n <= kMaxSeen; ++n) {
+        steps[n] = 65536 / (n + 2);
+    }
+    return steps;
+}();
+
+inline uint32_t Scaled(const BitProbability& probability) {
+    return std::clamp<uint32_t>(probability.zero >> (16 - kProbabilityBits),
+                                (1 << kProbabilityBits) - kMaxProbability, kMaxProbability);
+}
+
+inline void Update(BitProbability& probability, int bit) {
+    const uint32_t step = kSteps[probability.seen];
+    if (bit) {
+        probability.zero -= probability.zero * step >> 16;
+    } else {
+        probability.zero += (65535 - probability.zero) * step >> 16;
+    }
+    if (probability.seen < kMaxSeen) {
+        ++probability.seen;
+    }
+}
+
+}  // namespace range_coder
+
+// Binary range coder of LZMA: every bit is coded with the probability of its
+// context, which then adapts to it.
+class RangeEncoder {
+public:
+    explicit RangeEncoder(std::string* out) : out_(out) {
+    }
+
+    // Returns |bit|, so that models can be written once for both directions.
+    int Bit(BitProbability& probability, int bit) {
+        using namespace range_coder;
+        const uint32_t bound = (range_ >> kProbabilityBits) * Scaled(probability);
+        if (bit == 0) {
+            range_ = bound;
+        } else {
+            low_ += bound;
+            range_ -= bound;
+        }
+        Update(probability, bit);
+        while (range_ < kTop) {
+            range_ <<= 8;
+            ShiftLow();
+        }
+        return bit;
+    }
+
+    void Flush() {
+        for (int i = 0; i < 5; ++i) {
+            ShiftLow();
+        }
+    }
+
+private:
+    // Writes the top byte of |low_| once no carry can reach it any more.
+    void ShiftLow() {
+        if (static_cast<uint32_t>(low_) < 0xff000000u || (low_ >> 32) != 0) {
+            const auto carry = static_cast<uint8_t>(low_ >> 32);
+            uint8_t byte = cache_;
+            do {
+                out_->push_back(static_cast<char>(byte + carry));
+                byte = 0xff;
+            } while (--cache_size_ != 0);
+            cache_ = static_cast<uint8_t>(low_ >> 24);
+        }
+        ++cache_size_;
+        low_ = (low_ & 0x00ffffff) << 8;
+    }
+
+    std::string* out_;
+    uint64_t low_ = 0;
+    uint32_t range_ = 0xffffffff;
+    uint8_t cache_ = 0;
+    uint64_t cache_size_ = 1;
+};
+
+class RangeDecoder {
+public:
+    // Past the end of |in| the coder reads zeros, as the encoder's flush implies.
+    explicit RangeDecoder(std::string_view in) : in_(in) {
+        for (int i = 0; i < 5; ++i) {
+            code_ = (code_ << 8) | NextByte();
+        }
+    }
+
+    // |bit| is ignored: the decoded one is returned.
+    int Bit(BitProbability& probability, int = 0) {
+        using namespace range_coder;
+        const uint32_t bound = (range_ >> kProbabilityBits) * Scaled(probability);
+        int bit;
+        if (code_ < bound) {
+            range_ = bound;
+            bit = 0;
+        } else {
+            code_ -= bound;
+            range_ -= bound;
+            bit = 1;
+        }
+        Update(probability, bit);
+        while (range_ < kTop) {
+            range_ <<= 8;
+            code_ = (code_ << 8) | NextByte();
+        }
+        return bit;
+    }
+
+private:
+    uint8_t NextByte() {
+        return position_ < in_.size() ? static_cast<uint8_t>(in_[position_++]) : 0;
+    }
+
+    std::string_view in_;
+    size_t position_ = 0;
+    uint32_t code_ = 0;
+    uint32_t range_ = 0xffffffff;
+};
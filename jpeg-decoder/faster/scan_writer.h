@@ -0,0 +1,31 @@
+#pragma once
+
+#include <jpeg_coefficients.h>
+
+#include "parsers.h"
+#include "standard_tables.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Huffman table ids a baseline scan may use, per class.
+constexpr size_t kBaselineTableIds = 4;
+
+// How the single scan over all components of an image is coded.
+struct ScanLayout {
+    // Per component, in frame order.
+    std::array<uint8_t, kMaxScanChannels> dc_ids{}, ac_ids{};
+    // In MCUs, 0 is none.
+    uint16_t restart_interval = 0;
+};
+
+// Appends the entropy-coded data of that scan to |output|: what follows the
+// SOS header, up to the next marker, with RSTn markers between intervals. The
+// tables of ids the layout does not use may be empty. EncodeCoefficients
+// writes the same data with its own tables and no restarts.
+// Throws std::invalid_argument when a symbol has no code in its table.
+void WriteScanData(const JpegCoefficients& coefficients, const ScanLayout& layout,
+                   const std::array<HuffmanSpec, kBaselineTableIds>& dc_specs,
+                   const std::array<HuffmanSpec, kBaselineTableIds>& ac_specs,
+                   std::string* output);
@@ -6,4 +6,9 @@ add_library(decoder_faster
         bit_reader.cpp
         huffman.cpp
         fft.cpp
-        decoder.cpp)
+        trace.cpp
+        exif.cpp
+        decoder.cpp
+        encoder.cpp
+        transcoder.cpp
+        archive.cpp)
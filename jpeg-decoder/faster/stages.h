@@ -0,0 +1,45 @@
+#pragma once
+
+#include <fft.h>
+#include <image.h>
+
+#include "parsers.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Stages of Decode after entropy decoding, in the order they run. They live
+// in decoder.cpp and are declared here so they can be benchmarked one by one.
+// Each stage works on the MCU rows [mcu_row_begin, mcu_row_end) of the image.
+
+// Scratch memory of the stages, kept between images so that they do not allocate.
+struct StagesContext {
+#ifndef DECODER_FAST_START
+    StagesContext()
+        : idct_input(kBlockSz), idct_output(kBlockSz), dct(8, &idct_input, &idct_output) {
+    }
+
+    std::vector<double> idct_input, idct_output;
+    DctCalculator dct;
+#endif
+    // One MCU of samples per channel, upsampled to the full resolution.
+    std::vector<int16_t> mcu_samples;
+};
+
+void Mult(int16_t *block, const std::array<uint16_t, kBlockSz> &table);
+
+RGB YCbCrToRGB(int16_t y, int16_t cb = 128, int16_t cr = 128);
+
+void Quantization(const RawImage &raw_image, ImageData &image_data, uint16_t mcu_row_begin,
+                  uint16_t mcu_row_end);
+
+void IDCT(ImageData &image_data, StagesContext &context, uint16_t mcu_row_begin,
+          uint16_t mcu_row_end);
+
+void Rationing(ImageData &image_data, uint16_t mcu_row_begin, uint16_t mcu_row_end);
+
+// Writes the rows upright for EXIF |orientation| (1..8): |ans| must already
+// have the transposed size for orientations 5..8.
+void GetAns(const ImageData &image_data, const ImageMetadata &meta, StagesContext &context,
+            uint16_t mcu_row_begin, uint16_t mcu_row_end, Image &ans, uint8_t orientation = 1);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <decode_stats.h>
+
+#include <chrono>
+#include <cstddef>
+
+#ifdef DECODER_STATS
+#include <allocations_checker.h>
+
+inline constexpr bool kCollectStats = true;
+
+inline size_t AllocationsCount() {
+    return alloc_checker::AllocCount();
+}
+#else
+inline constexpr bool kCollectStats = false;
+
+inline size_t AllocationsCount() {
+    return 0;
+}
+#endif
+
+// Adds the wall time of its scope to one of the DecodeStats stages.
+class StageTimer {
+public:
+    using Stage = std::chrono::nanoseconds DecodeStats::Stages::*;
+
+    StageTimer(DecodeStats* stats, Stage stage) {
+        if constexpr (kCollectStats) {
+            stats_ = stats;
+            stage_ = stage;
+            begin_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        if constexpr (kCollectStats) {
+            if (stats_ != nullptr) {
+                stats_->time.*stage_ += std::chrono::steady_clock::now() - begin_;
+            }
+        }
+    }
+
+private:
+    DecodeStats* stats_ = nullptr;
+    Stage stage_ = nullptr;
+    std::chrono::steady_clock::time_point begin_;
+};
@@ -0,0 +1,80 @@
+// Fuzz target for inputs that decode correctly or fail cleanly, but cost far
+// more than their size: the algorithmic-complexity cases fuzz_jpeg.cpp does
+// not see because nothing crashes.
+//
+// Every input gets a budget of time and memory proportional to its size. An
+// input over budget is reported and the process aborts, so libFuzzer keeps it
+// as a crash-* reproducer. Budgets, from the environment:
+//   SLOW_INPUT_NS_PER_BYTE     decode time per input byte, 20000 by default.
+//   SLOW_INPUT_MIN_NS          time always allowed, 20 ms by default.
+//   SLOW_INPUT_BYTES_PER_BYTE  peak heap per input byte, 16384 by default.
+//   SLOW_INPUT_MIN_BYTES       heap always allowed, 64 MiB by default.
+// Keep libFuzzer's own -timeout and -rss_limit_mb as the hard limits above them.
+//
+// Run: fuzz_slow_input_faster -max_len=65536 corpus/ ../tests/
+
+#include <allocations_checker.h>
+#include <decoder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace {
+
+struct Budget {
+    double ns_per_byte = 20000;
+    double min_ns = 20e6;
+    double bytes_per_byte = 16384;
+    double min_bytes = 64 << 20;
+};
+
+double FromEnv(const char* name, double fallback) {
+    const char* value = std::getenv(name);
+    return value ? std::strtod(value, nullptr) : fallback;
+}
+
+Budget ReadBudget() {
+    Budget budget;
+    budget.ns_per_byte = FromEnv("SLOW_INPUT_NS_PER_BYTE", budget.ns_per_byte);
+    budget.min_ns = FromEnv("SLOW_INPUT_MIN_NS", budget.min_ns);
+    budget.bytes_per_byte = FromEnv("SLOW_INPUT_BYTES_PER_BYTE", budget.bytes_per_byte);
+    budget.min_bytes = FromEnv("SLOW_INPUT_MIN_BYTES", budget.min_bytes);
+    return budget;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static const Budget kBudget = ReadBudget();
+
+    std::string s(reinterpret_cast<const char*>(data), size);
+    std::stringstream ss(s);
+    alloc_checker::ResetPeakLiveBytes();
+    const size_t live_before = alloc_checker::LiveBytes();
+    const auto begin = std::chrono::steady_clock::now();
+    try {
+        auto image = Decode(ss);
+        (void)image;
+    } catch (...) {
+    }
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - begin;
+    const double peak_bytes = alloc_checker::PeakLiveBytes() - live_before;
+
+    const double time_limit = std::max(kBudget.min_ns, kBudget.ns_per_byte * size);
+    const double memory_limit = std::max(kBudget.min_bytes, kBudget.bytes_per_byte * size);
+    if (elapsed.count() > time_limit || peak_bytes > memory_limit) {
+        std::fprintf(stderr,
+                     "Slow input: %zu bytes, %.0f ns (%.0f ns/byte, limit %.0f ns), "
+                     "peak %.0f bytes (%.0f bytes/byte, limit %.0f bytes)\n",
+                     size, elapsed.count(), elapsed.count() / size, time_limit, peak_bytes,
+                     peak_bytes / size, memory_limit);
+        std::abort();
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <allocations_checker.h>
+#include <decoder.h>
+#include <huffman.h>
+#include <jpeg_decoder.h>
+#include <test_commons.hpp>
+
+#include <catch.hpp>
+
+#include "parsers.h"
+#include "stages.h"
+
+#include <array>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Once a decoder has seen an image of some size, nothing on the hot path may
+// touch the heap again: no per-block vectors, no per-row scratch, no rebuilt
+// tables. Every stream is created outside of the checked expressions.
+
+TEST_CASE("Blocks are decoded without allocations", "[allocations]") {
+    // DC: "0" -> size 2. AC: "0" -> EOB, "1" -> run 0, size 1.
+    // Every byte 0x7E = 0 11 1 1 1 1 0 is a block: DC diff 3, two ones, EOB.
+    constexpr size_t kBlocks = 256;
+    std::istringstream input(std::string(kBlocks, '\x7e'));
+    HuffmanTree dc_tree, ac_tree;
+    dc_tree.Build({1}, {2});
+    ac_tree.Build({2}, {0x00, 0x01});
+
+    Parser parser(input);
+    std::array<int16_t, kBlockSz> block;
+    int16_t prev_dc = 0;
+    parser.ReadBlock(&dc_tree, &ac_tree, prev_dc, block.data());
+
+    EXPECT_ZERO_ALLOCATIONS(for (size_t i = 1; i < kBlocks; ++i) {
+        parser.ReadBlock(&dc_tree, &ac_tree, prev_dc, block.data());
+    });
+
+    REQUIRE(prev_dc == 3 * kBlocks);
+    REQUIRE(block[0] == 3 * kBlocks);
+    REQUIRE(block[1] == 1);
+    REQUIRE(block[8] == 1);
+    REQUIRE(block[2] == 0);
+}
+
+TEST_CASE("MCU rows are processed without allocations", "[allocations]") {
+    // 4:4:4, 4:2:0 and grayscale.
+    for (const auto* filename : {"lenna.jpg", "test.jpg", "grayscale.jpg"}) {
+        std::istringstream input(ReadTestFile(filename));
+        auto raw = Parser(input).ReadRawImage();
+        auto& data = raw.data;
+        REQUIRE(data.mcu_h >= 2);
+
+        StagesContext context;
+        Image image(raw.metadata.width, raw.metadata.height);
+        auto process_rows = [&](uint16_t begin, uint16_t end) {
+            Quantization(raw, data, begin, end);
+            IDCT(data, context, begin, end);
+            Rationing(data, begin, end);
+            GetAns(data, raw.metadata, context, begin, end, image);
+        };
+        process_rows(0, 1);
+
+        EXPECT_ZERO_ALLOCATIONS(process_rows(1, 2));
+        EXPECT_ZERO_ALLOCATIONS(process_rows(2, data.mcu_h));
+    }
+}
+
+TEST_CASE("Images of a seen size are decoded without allocations", "[allocations]") {
+    for (const auto* filename : {"lenna.jpg", "test.jpg", "grayscale.jpg"}) {
+        const auto data = ReadTestFile(filename);
+        std::istringstream first(data), second(data), third(data);
+
+        JpegDecoder decoder;
+        Image image;
+        decoder.Decode(first, &image);
+        const auto expected = decoder.Decode(second);
+
+        EXPECT_ZERO_ALLOCATIONS(decoder.Decode(third, &image));
+
+        REQUIRE(image.Width() == expected.Width());
+        REQUIRE(image.Height() == expected.Height());
+        for (size_t y = 0; y < image.Height(); y += 7) {
+            for (size_t x = 0; x < image.Width(); x += 7) {
+                const auto actual_pixel = image.GetPixel(y, x);
+                const auto expected_pixel = expected.GetPixel(y, x);
+                REQUIRE(actual_pixel.r == expected_pixel.r);
+                REQUIRE(actual_pixel.g == expected_pixel.g);
+                REQUIRE(actual_pixel.b == expected_pixel.b);
+            }
+        }
+    }
+}
+
+TEST_CASE("Threads of the decoder are not started per image", "[allocations]") {
+    const auto data = ReadTestFile("lenna.jpg");
+    JpegDecoder decoder(4);
+    Image image;
+    std::vector<JpegSegment> segments;
+    decoder.Decode(data, &image, &segments);
+
+    EXPECT_ZERO_ALLOCATIONS(decoder.Decode(data, &image, &segments));
+}
+
+TEST_CASE("Peak live bytes are tracked", "[allocations]") {
+    constexpr size_t kSize = 1 << 20;
+    const size_t live_before = alloc_checker::LiveBytes();
+    const size_t allocated_before = alloc_checker::AllocatedBytes();
+
+    EXPECT_PEAK_BYTES_BELOW(std::vector<char> buffer(kSize), 2 * kSize);
+
+    REQUIRE(alloc_checker::PeakLiveBytes() >= live_before + kSize);
+    REQUIRE(alloc_checker::AllocatedBytes() >= allocated_before + kSize);
+    REQUIRE(alloc_checker::LiveBytes() == live_before);
+}
+
+TEST_CASE("huge.jpg fits into its memory budget", "[allocations]") {
+    const auto data = ReadTestFile("huge.jpg");
+    std::istringstream input(data);
+    constexpr size_t kWidth = 10315, kHeight = 7049;
+    const size_t output_bytes = kWidth * kHeight * sizeof(RGB);
+
+    // The output itself plus int16_t coefficients of every sample: at 4:2:0
+    // that is 3 bytes per pixel against 12 of RGB, a quarter of the output.
+    // Anything close to another copy of the image breaks the budget.
+    Image image;
+    EXPECT_PEAK_BYTES_BELOW(image = Decode(input), output_bytes * 3 / 2);
+    REQUIRE(image.Width() == kWidth);
+    REQUIRE(image.Height() == kHeight);
+}
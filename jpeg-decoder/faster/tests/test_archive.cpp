@@ -0,0 +1,180 @@
+#include <jpeg_archive.h>
+#include <jpeg_generator.hpp>
+#include <test_commons.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// The mode byte after "JARC" and the version.
+bool IsModeled(const std::string& archive) {
+    return archive.size() > 5 && archive[5] == 1;
+}
+
+// A 4-byte big-endian size of the archive layout.
+size_t SizeAt(const std::string& archive, size_t pos) {
+    size_t size = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        size = size << 8 | static_cast<uint8_t>(archive[pos + i]);
+    }
+    return size;
+}
+
+std::string RoundTrip(JpegArchiver* archiver, const std::string& jpeg) {
+    std::string archive, restored;
+    archiver->Compress(jpeg, &archive);
+    archiver->Decompress(archive, &restored);
+    CHECK(restored == jpeg);
+    return archive;
+}
+
+}  // namespace
+
+TEST_CASE("Archives give back the exact file", "[archive]") {
+    JpegArchiver archiver;
+    for (auto subsampling : {Subsampling::k444, Subsampling::k422, Subsampling::k420,
+                             Subsampling::kGray}) {
+        for (auto content : {Content::kNoise, Content::kGradient, Content::kFlat}) {
+            for (unsigned restart_interval : {0u, 1u, 5u}) {
+                JpegSpec spec;
+                spec.width = 157;
+                spec.height = 99;
+                spec.subsampling = subsampling;
+                spec.content = content;
+                spec.restart_interval = restart_interval;
+                const auto jpeg = GenerateJpeg(spec);
+                INFO("subsampling " << static_cast<int>(subsampling) << ", content "
+                                    << static_cast<int>(content) << ", restarts every "
+                                    << restart_interval);
+                CHECK(IsModeled(RoundTrip(&archiver, jpeg)));
+            }
+        }
+    }
+}
+
+TEST_CASE("Archives of test files", "[archive]") {
+    JpegArchiver archiver;
+    for (const char* name : {"lenna.jpg", "colors.jpg", "grayscale.jpg", "small.jpg",
+                             "tiny.jpg", "progressive.jpg", "bad_quality.jpg"}) {
+        INFO(name);
+        const auto jpeg = ReadTestFile(name);
+        CHECK(RoundTrip(&archiver, jpeg).size() <= jpeg.size() + 6);
+    }
+}
+
+TEST_CASE("Archives are smaller than the files", "[archive]") {
+    JpegArchiver archiver;
+    for (const char* name : {"architecture.jpg", "witch.jpg", "chroma_halfed.jpg"}) {
+        INFO(name);
+        const auto jpeg = ReadTestFile(name);
+        const auto archive = RoundTrip(&archiver, jpeg);
+        CHECK(IsModeled(archive));
+        CHECK(archive.size() < jpeg.size() * 0.8);
+    }
+}
+
+TEST_CASE("Archives save a fifth of the photo set", "[archive]") {
+    JpegArchiver archiver;
+    double savings = 0;
+    size_t files_cnt = 0;
+    for (const char* name : {"architecture.jpg", "bad_quality.jpg", "chroma_halfed.jpg",
+                             "colors.jpg", "grayscale.jpg", "lenna.jpg", "prostitute.jpg",
+                             "save_for_web.jpg", "test.jpg", "witch.jpg"}) {
+        INFO(name);
+        const auto jpeg = ReadTestFile(name);
+        const auto archive = RoundTrip(&archiver, jpeg);
+        CHECK(IsModeled(archive));
+        savings += 1 - static_cast<double>(archive.size()) / jpeg.size();
+        ++files_cnt;
+    }
+    CHECK(savings / files_cnt >= 0.2);
+}
+
+TEST_CASE("Files the model does not cover are stored", "[archive]") {
+    JpegArchiver archiver;
+    JpegSpec spec;
+    spec.width = spec.height = 40;
+    spec.scan_per_component = true;
+    for (const auto& data : {GenerateJpeg(spec), std::string("not a jpeg"), std::string(),
+                             ReadTestFile("progressive.jpg")}) {
+        CHECK_FALSE(IsModeled(RoundTrip(&archiver, data)));
+    }
+}
+
+TEST_CASE("Bytes after the scan are kept", "[archive]") {
+    JpegArchiver archiver;
+    JpegSpec spec;
+    spec.width = spec.height = 96;
+    const auto jpeg = GenerateJpeg(spec) + "trailing bytes";
+    CHECK(IsModeled(RoundTrip(&archiver, jpeg)));
+}
+
+TEST_CASE("Bad archives throw", "[archive]") {
+    JpegArchiver archiver;
+    JpegSpec spec;
+    spec.width = spec.height = 96;
+    std::string archive, jpeg;
+    archiver.Compress(GenerateJpeg(spec), &archive);
+    REQUIRE(IsModeled(archive));
+
+    CHECK_THROWS_AS(archiver.Decompress("JPEG", &jpeg), std::runtime_error);
+    CHECK_THROWS_AS(archiver.Decompress(archive.substr(0, 12), &jpeg), std::runtime_error);
+    auto bad_mode = archive;
+    bad_mode[5] = 7;
+    CHECK_THROWS_AS(archiver.Decompress(bad_mode, &jpeg), std::runtime_error);
+    auto bad_head = archive;
+    bad_head[11] = 0;  // The second byte of SOI.
+    CHECK_THROWS_AS(archiver.Decompress(bad_head, &jpeg), std::runtime_error);
+}
+
+TEST_CASE("Corrupted coefficients do not decode out of bounds", "[archive]") {
+    JpegArchiver archiver;
+    JpegSpec spec;
+    spec.width = spec.height = 96;
+    std::string archive, jpeg;
+    archiver.Compress(GenerateJpeg(spec), &archive);
+    REQUIRE(IsModeled(archive));
+    // Magic, version, mode, then the sizes of the header, the tail and the scan.
+    const size_t tail_at = 10 + SizeAt(archive, 6);
+    const size_t coded_at = tail_at + 8 + SizeAt(archive, tail_at);
+    REQUIRE(coded_at < archive.size());
+
+    // All ones push every bit length to its limit.
+    for (char fill : {'\xff', '\x80', '\x00'}) {
+        auto corrupted = archive;
+        std::fill(corrupted.begin() + coded_at, corrupted.end(), fill);
+        try {
+            archiver.Decompress(corrupted, &jpeg);
+        } catch (const std::runtime_error&) {
+        }
+    }
+}
+
+TEST_CASE("Archived frames larger than their scan are rejected", "[archive]") {
+    JpegArchiver archiver;
+    JpegSpec spec;
+    spec.width = spec.height = 96;
+    std::string archive, jpeg;
+    archiver.Compress(GenerateJpeg(spec), &archive);
+    REQUIRE(IsModeled(archive));
+    const size_t sof = archive.find("\xff\xc0");
+    REQUIRE(sof != std::string::npos);
+    const size_t tail_at = 10 + SizeAt(archive, 6);
+    const size_t scan_size_at = tail_at + 4 + SizeAt(archive, tail_at);
+
+    // 65535x65535 at 4:2:0: about 13 GB of coefficients.
+    auto forged = archive;
+    std::fill(forged.begin() + sof + 5, forged.begin() + sof + 9, '\xff');
+    CHECK_THROWS_AS(archiver.Decompress(forged, &jpeg), std::runtime_error);
+    // The scan size is no way around it either: the coded bytes bound the blocks.
+    std::fill(forged.begin() + scan_size_at, forged.begin() + scan_size_at + 4, '\xff');
+    CHECK_THROWS_AS(archiver.Decompress(forged, &jpeg), std::runtime_error);
+    // Nor is a scan size that does not match the rebuilt scan.
+    auto wrong_size = archive;
+    ++wrong_size[scan_size_at + 3];
+    CHECK_THROWS_AS(archiver.Decompress(wrong_size, &jpeg), std::runtime_error);
+}
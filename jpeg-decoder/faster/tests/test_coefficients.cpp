@@ -0,0 +1,104 @@
+#include <allocations_checker.h>
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+#include <libjpg_reader.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace {
+
+void CheckSameAsLibjpeg(const std::string& jpeg, const JpegCoefficients& coefficients) {
+    const auto expected = ReadJpgCoefficients(jpeg);
+    REQUIRE(coefficients.components.size() == expected.size());
+    for (size_t c = 0; c < expected.size(); ++c) {
+        const auto& component = coefficients.components[c];
+        CHECK(component.quant_table == expected[c].quant_table);
+        REQUIRE(component.blocks_w >= expected[c].blocks_w);
+        REQUIRE(component.blocks_h >= expected[c].blocks_h);
+        const int16_t* block = expected[c].blocks.data();
+        bool same = true;
+        for (size_t row = 0; row < expected[c].blocks_h; ++row) {
+            for (size_t column = 0; column < expected[c].blocks_w; ++column, block += 64) {
+                same &= std::equal(block, block + 64, coefficients.Block(c, row, column));
+            }
+        }
+        CHECK(same);
+    }
+}
+
+}  // namespace
+
+TEST_CASE("Coefficients match libjpeg", "[coefficients]") {
+    for (auto subsampling :
+         {Subsampling::k444, Subsampling::k422, Subsampling::k420, Subsampling::kGray}) {
+        for (bool scan_per_component : {false, true}) {
+            JpegSpec spec;
+            spec.width = 75;
+            spec.height = 53;
+            spec.subsampling = subsampling;
+            spec.content = Content::kNoise;
+            spec.scan_per_component = scan_per_component;
+            INFO(spec.Name());
+            const auto jpeg = GenerateJpeg(spec);
+
+            JpegDecoder decoder;
+            JpegCoefficients coefficients;
+            decoder.DecodeCoefficients(jpeg, &coefficients);
+            CHECK(coefficients.width == 75);
+            CHECK(coefficients.height == 53);
+            CheckSameAsLibjpeg(jpeg, coefficients);
+
+            std::istringstream input(jpeg);
+            JpegCoefficients from_stream;
+            JpegDecoder(2).DecodeCoefficients(input, &from_stream);
+            CHECK(from_stream.coefficients == coefficients.coefficients);
+        }
+    }
+}
+
+TEST_CASE("Coefficients have the layout of the MCU grid", "[coefficients]") {
+    JpegSpec spec;
+    spec.width = 40;
+    spec.height = 24;
+    spec.subsampling = Subsampling::k420;
+    const auto jpeg = GenerateJpeg(spec);
+    JpegCoefficients coefficients;
+    JpegDecoder().DecodeCoefficients(jpeg, &coefficients);
+
+    CHECK(coefficients.h_max == 2);
+    CHECK(coefficients.v_max == 2);
+    REQUIRE(coefficients.components.size() == 3);
+    // 3 x 2 MCUs of 16 x 16 pixels.
+    const auto& luma = coefficients.components[0];
+    CHECK(luma.h == 2);
+    CHECK(luma.blocks_w == 6);
+    CHECK(luma.blocks_h == 4);
+    CHECK(luma.offset == 0);
+    const auto& chroma = coefficients.components[2];
+    CHECK(chroma.blocks_w == 3);
+    CHECK(chroma.blocks_h == 2);
+    CHECK(chroma.offset == (24 + 6) * 64);
+    CHECK(coefficients.coefficients.size() == (24 + 6 + 6) * 64);
+}
+
+TEST_CASE("Coefficients move without copies and decode without allocations",
+          "[coefficients][allocations]") {
+    JpegSpec spec;
+    spec.width = spec.height = 64;
+    const auto jpeg = GenerateJpeg(spec);
+    JpegDecoder decoder;
+    JpegCoefficients coefficients;
+    decoder.DecodeCoefficients(jpeg, &coefficients);
+
+    const int16_t* data = coefficients.coefficients.data();
+    JpegCoefficients moved = std::move(coefficients);
+    CHECK(moved.coefficients.data() == data);
+
+    EXPECT_ZERO_ALLOCATIONS(decoder.DecodeCoefficients(jpeg, &moved));
+    CHECK(moved.coefficients.data() == data);
+}
@@ -0,0 +1,122 @@
+#include <allocations_checker.h>
+#include <jpeg_decoder.h>
+#include <jpeg_encoder.h>
+#include <jpeg_generator.hpp>
+#include <libjpg_reader.hpp>
+
+#include <catch.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+Image DecodeGenerated(size_t width, size_t height, Content content) {
+    JpegSpec spec;
+    spec.width = width;
+    spec.height = height;
+    spec.subsampling = Subsampling::k444;
+    spec.quality = 100;
+    spec.content = content;
+    Image image;
+    JpegDecoder().Decode(GenerateJpeg(spec), &image);
+    return image;
+}
+
+double Psnr(const Image& actual, const Image& expected) {
+    REQUIRE(actual.Width() == expected.Width());
+    REQUIRE(actual.Height() == expected.Height());
+    double squares = 0;
+    for (size_t y = 0; y < actual.Height(); ++y) {
+        for (size_t x = 0; x < actual.Width(); ++x) {
+            const auto a = actual.GetPixel(y, x), e = expected.GetPixel(y, x);
+            squares += (a.r - e.r) * (a.r - e.r) + (a.g - e.g) * (a.g - e.g) +
+                       (a.b - e.b) * (a.b - e.b);
+        }
+    }
+    const double mse = squares / (3.0 * actual.Width() * actual.Height());
+    return 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+}  // namespace
+
+TEST_CASE("Encoded images decode close to the source", "[encoder]") {
+    const auto source = DecodeGenerated(75, 53, Content::kGradient);
+    for (auto subsampling : {ChromaSubsampling::k444, ChromaSubsampling::k420}) {
+        for (int quality : {50, 90}) {
+            INFO("quality " << quality << (subsampling == ChromaSubsampling::k420 ? ", 4:2:0"
+                                                                                   : ", 4:4:4"));
+            JpegEncoder encoder(quality, subsampling);
+            std::string jpeg;
+            encoder.Encode(source, &jpeg);
+
+            Image image;
+            JpegDecoder().Decode(jpeg, &image);
+            CHECK(Psnr(image, source) > (quality == 90 ? 38 : 32));
+            CHECK(Psnr(ReadJpgFromMemory(jpeg), source) > (quality == 90 ? 38 : 32));
+        }
+    }
+}
+
+TEST_CASE("Quantization tables are the ones libjpeg uses", "[encoder]") {
+    const auto source = DecodeGenerated(16, 16, Content::kFlat);
+    for (int quality : {1, 10, 50, 75, 95, 100}) {
+        INFO("quality " << quality);
+        JpegSpec spec;
+        spec.width = spec.height = 16;
+        spec.quality = quality;
+        JpegCoefficients expected;
+        JpegDecoder().DecodeCoefficients(GenerateJpeg(spec), &expected);
+
+        JpegEncoder encoder(quality);
+        std::string jpeg;
+        encoder.Encode(source, &jpeg);
+        const auto& actual = encoder.Coefficients();
+        for (size_t c = 0; c < 3; ++c) {
+            CHECK(actual.components[c].quant_table == expected.components[c].quant_table);
+        }
+    }
+}
+
+TEST_CASE("Flat blocks have only DC", "[encoder]") {
+    Image image(8, 8);
+    for (size_t y = 0; y < 8; ++y) {
+        for (size_t x = 0; x < 8; ++x) {
+            image.SetPixel(y, x, {200, 200, 200});
+        }
+    }
+    JpegEncoder encoder(50, ChromaSubsampling::k444);
+    std::string jpeg;
+    encoder.Encode(image, &jpeg);
+
+    const auto& coefficients = encoder.Coefficients();
+    // (200 - 128) * 8 / 16: the DC step of the quality 50 luminance table is 16.
+    CHECK(coefficients.Block(0, 0, 0)[0] == 36);
+    size_t nonzero = 0;
+    for (size_t i = 0; i < coefficients.coefficients.size(); ++i) {
+        nonzero += coefficients.coefficients[i] != 0;
+    }
+    CHECK(nonzero == 1);
+
+    JpegCoefficients decoded;
+    JpegDecoder().DecodeCoefficients(jpeg, &decoded);
+    CHECK(decoded.coefficients == coefficients.coefficients);
+}
+
+TEST_CASE("Encoder reuses its buffers", "[encoder][allocations]") {
+    const auto source = DecodeGenerated(64, 48, Content::kNoise);
+    JpegEncoder encoder;
+    std::string jpeg;
+    encoder.Encode(source, &jpeg);
+    const std::string first = jpeg;
+    EXPECT_ZERO_ALLOCATIONS(encoder.Encode(source, &jpeg));
+    CHECK(jpeg == first);
+}
+
+TEST_CASE("Encoder rejects bad arguments", "[encoder]") {
+    CHECK_THROWS_AS(JpegEncoder(0), std::invalid_argument);
+    CHECK_THROWS_AS(JpegEncoder(101), std::invalid_argument);
+    std::string jpeg;
+    CHECK_THROWS_AS(JpegEncoder().Encode(Image(), &jpeg), std::invalid_argument);
+}
@@ -0,0 +1,233 @@
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+
+#include <catch.hpp>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace {
+
+class TiffWriter {
+public:
+    explicit TiffWriter(bool little_endian)
+        : little_endian_(little_endian), data_(little_endian ? "II" : "MM") {
+        Write16(42);
+        Write32(8);
+    }
+
+    void Write16(uint16_t value) {
+        const char bytes[] = {static_cast<char>(value >> 8), static_cast<char>(value & 0xff)};
+        data_ += little_endian_ ? std::string{bytes[1], bytes[0]} : std::string{bytes[0], bytes[1]};
+    }
+
+    void Write32(uint32_t value) {
+        if (little_endian_) {
+            Write16(value & 0xffff);
+            Write16(value >> 16);
+        } else {
+            Write16(value >> 16);
+            Write16(value & 0xffff);
+        }
+    }
+
+    // IFD entries with a single value, a SHORT one is left-justified.
+    void WriteShort(uint16_t tag, uint16_t value) {
+        Write16(tag);
+        Write16(3);
+        Write32(1);
+        Write16(value);
+        Write16(0);
+    }
+
+    void WriteLong(uint16_t tag, uint32_t value) {
+        Write16(tag);
+        Write16(4);
+        Write32(1);
+        Write32(value);
+    }
+
+    std::string& Data() {
+        return data_;
+    }
+
+private:
+    bool little_endian_;
+    std::string data_;
+};
+
+// APP1 with the orientation tag in IFD0 unless |orientation| is 0, and an IFD1
+// pointing at |thumbnail|, stored right after it, unless |thumbnail| is empty.
+std::string ExifSegment(const std::string& thumbnail, bool little_endian,
+                        uint16_t orientation = 0) {
+    TiffWriter tiff(little_endian);
+    const uint32_t ifd1 = orientation ? 26 : 14;
+    tiff.Write16(orientation ? 1 : 0);
+    if (orientation) {
+        tiff.WriteShort(0x0112, orientation);
+    }
+    tiff.Write32(thumbnail.empty() ? 0 : ifd1);
+    if (!thumbnail.empty()) {
+        tiff.Write16(2);
+        tiff.WriteLong(0x0201, ifd1 + 30);
+        tiff.WriteLong(0x0202, thumbnail.size());
+        tiff.Write32(0);
+    }
+    const std::string payload = std::string("Exif\0\0", 6) + tiff.Data() + thumbnail;
+    const size_t size = payload.size() + 2;
+    return std::string{'\xff', '\xe1', static_cast<char>(size >> 8),
+                       static_cast<char>(size & 0xff)} +
+           payload;
+}
+
+std::string WithSegmentAfterSoi(const std::string& data, const std::string& segment) {
+    return data.substr(0, 2) + segment + data.substr(2);
+}
+
+std::string Generate(size_t width, size_t height, Subsampling subsampling) {
+    JpegSpec spec;
+    spec.width = width;
+    spec.height = height;
+    spec.subsampling = subsampling;
+    return GenerateJpeg(spec);
+}
+
+}  // namespace
+
+TEST_CASE("EXIF thumbnail", "[exif][thumbnail]") {
+    const auto thumbnail = Generate(16, 12, Subsampling::k420);
+    const auto image_data = Generate(640, 480, Subsampling::k420);
+    JpegDecoder decoder;
+    const Image expected = [&] {
+        Image image;
+        decoder.Decode(thumbnail, &image);
+        return image;
+    }();
+
+    for (bool little_endian : {true, false}) {
+        INFO(little_endian);
+        const auto data = WithSegmentAfterSoi(image_data, ExifSegment(thumbnail, little_endian));
+        Image image;
+        decoder.DecodeThumbnail(data, &image);
+        REQUIRE(image.Width() == 16);
+        REQUIRE(image.Height() == 12);
+        CHECK(image.GetPixel(5, 7).r == expected.GetPixel(5, 7).r);
+        CHECK(image.GetPixel(11, 15).b == expected.GetPixel(11, 15).b);
+    }
+}
+
+TEST_CASE("DC-only preview without EXIF", "[thumbnail]") {
+    for (auto subsampling : {Subsampling::k444, Subsampling::k420, Subsampling::kGray}) {
+        INFO(static_cast<int>(subsampling));
+        const auto data = Generate(100, 61, subsampling);
+        JpegDecoder decoder;
+        Image full, preview;
+        decoder.Decode(data, &full);
+        decoder.DecodeThumbnail(data, &preview);
+        REQUIRE(preview.Width() == 13);
+        REQUIRE(preview.Height() == 8);
+
+        // Each preview pixel is close to the mean of its block in the full image.
+        // A subsampled chroma DC is the mean over a larger area, so it is less exact.
+        const int tolerance = subsampling == Subsampling::k420 ? 12 : 4;
+        for (size_t y = 0; y + 1 < preview.Height(); ++y) {
+            for (size_t x = 0; x + 1 < preview.Width(); ++x) {
+                int sum = 0;
+                for (size_t dy = 0; dy < 8; ++dy) {
+                    for (size_t dx = 0; dx < 8; ++dx) {
+                        sum += full.GetPixel(y * 8 + dy, x * 8 + dx).g;
+                    }
+                }
+                CHECK(std::abs(sum / 64 - preview.GetPixel(y, x).g) <= tolerance);
+            }
+        }
+    }
+}
+
+TEST_CASE("Broken EXIF falls back to the preview", "[thumbnail]") {
+    const auto image_data = Generate(64, 64, Subsampling::k420);
+    auto segment = ExifSegment("not a jpeg", true);
+    JpegDecoder decoder;
+    Image image;
+    decoder.DecodeThumbnail(WithSegmentAfterSoi(image_data, segment), &image);
+    CHECK(image.Width() == 8);
+
+    // Thumbnail length past the end of the segment.
+    segment = ExifSegment(Generate(16, 12, Subsampling::k420), true);
+    segment.resize(segment.size() - 10);
+    segment[2] = static_cast<char>((segment.size() - 2) >> 8);
+    segment[3] = static_cast<char>((segment.size() - 2) & 0xff);
+    decoder.DecodeThumbnail(WithSegmentAfterSoi(image_data, segment), &image);
+    CHECK(image.Width() == 8);
+}
+
+TEST_CASE("EXIF orientation", "[exif]") {
+    const auto plain = Generate(37, 21, Subsampling::k420);
+    Image upright;
+    JpegDecoder(1).Decode(plain, &upright);
+    const size_t w = upright.Width(), h = upright.Height();
+
+    for (size_t threads : {1, 3}) {
+        JpegDecoder decoder(threads);
+        decoder.SetApplyExifOrientation(true);
+        for (uint16_t orientation = 1; orientation <= 8; ++orientation) {
+            INFO(threads << " threads, orientation " << orientation);
+            const bool little_endian = orientation % 2;
+            const auto data =
+                WithSegmentAfterSoi(plain, ExifSegment("", little_endian, orientation));
+            Image image;
+            decoder.Decode(data, &image);
+            const bool transposed = orientation >= 5;
+            REQUIRE(image.Width() == (transposed ? h : w));
+            REQUIRE(image.Height() == (transposed ? w : h));
+
+            // The stored pixel (y, x) as seen in the upright image.
+            auto oriented = [&](size_t y, size_t x) {
+                switch (orientation) {
+                    case 2:
+                        return image.GetPixel(y, w - 1 - x);
+                    case 3:
+                        return image.GetPixel(h - 1 - y, w - 1 - x);
+                    case 4:
+                        return image.GetPixel(h - 1 - y, x);
+                    case 5:
+                        return image.GetPixel(x, y);
+                    case 6:
+                        return image.GetPixel(x, h - 1 - y);
+                    case 7:
+                        return image.GetPixel(w - 1 - x, h - 1 - y);
+                    case 8:
+                        return image.GetPixel(w - 1 - x, y);
+                    default:
+                        return image.GetPixel(y, x);
+                }
+            };
+            size_t mismatches = 0;
+            for (size_t y = 0; y < h; ++y) {
+                for (size_t x = 0; x < w; ++x) {
+                    const auto expected = upright.GetPixel(y, x), actual = oriented(y, x);
+                    mismatches += expected.r != actual.r || expected.g != actual.g ||
+                                  expected.b != actual.b;
+                }
+            }
+            CHECK(mismatches == 0);
+        }
+    }
+}
+
+TEST_CASE("EXIF orientation is off by default", "[exif]") {
+    const auto plain = Generate(37, 21, Subsampling::k420);
+    const auto rotated = WithSegmentAfterSoi(plain, ExifSegment("", true, 6));
+    JpegDecoder decoder;
+    Image image;
+    decoder.Decode(rotated, &image);
+    CHECK(image.Width() == 37);
+
+    std::istringstream input(rotated);
+    decoder.SetApplyExifOrientation(true);
+    CHECK(decoder.Decode(input).Width() == 21);
+    decoder.DecodeThumbnail(rotated, &image);
+    CHECK(image.Width() == 3);
+    CHECK(image.Height() == 5);
+}
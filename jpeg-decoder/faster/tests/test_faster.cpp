@@ -1,9 +1,19 @@
+#include <decoder.h>
+#include <jpeg_decoder.h>
 #include <test_commons.hpp>
 
 #include <catch.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 TEST_CASE("huge", "[jpg]") {
 #ifdef NDEBUG
@@ -17,3 +27,148 @@ TEST_CASE("huge", "[jpg]") {
         << std::endl;
 #endif
 }
+
+namespace {
+
+// Throughput floors, in megapixels per second per giga-op/s of the calibration
+// loops below, so that one table holds on slow and fast machines alike. They
+// are about a third of what decoder_faster reaches, so only a real regression
+// trips them; raise a floor together with an optimization it should protect.
+struct ThroughputBudget {
+    const char* image;
+    double min_normalized;
+};
+
+constexpr ThroughputBudget kBudgets[] = {
+    {"architecture.jpg", 3},  {"bad_quality.jpg", 2.5}, {"chroma_halfed.jpg", 2},
+    {"colors.jpg", 1.8},      {"google.jpg", 3.5},      {"grayscale.jpg", 2.8},
+    {"huge.jpg", 2.7},        {"lenna.jpg", 0.9},       {"save_for_web.jpg", 1.4},
+    {"small.jpg", 4},         {"test.jpg", 2},          {"tiny.jpg", 0.05},
+    {"witch.jpg", 2.3},
+};
+
+using Clock = std::chrono::steady_clock;
+
+volatile uint64_t calibration_sink;
+volatile float calibration_float_sink;
+
+// Giga-ops per second of a fixed integer multiply-add loop over 64 KiB, the
+// kind of work entropy decoding and color conversion do, best of several runs.
+double IntegerGops() {
+    constexpr size_t kSize = 16384, kRounds = 256;
+    std::vector<uint32_t> data(kSize);
+    uint32_t state = 1;
+    for (auto& value : data) {
+        value = state = state * 1664525 + 1013904223;
+    }
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        const auto begin = Clock::now();
+        uint64_t acc[4] = {};
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (size_t i = 0; i < kSize; i += 4) {
+                for (size_t k = 0; k < 4; ++k) {
+                    acc[k] = acc[k] * 31 + data[i + k] * data[(i * 7 + k) % kSize];
+                }
+            }
+        }
+        calibration_sink = acc[0] + acc[1] + acc[2] + acc[3];
+        const std::chrono::duration<double> elapsed = Clock::now() - begin;
+        best = std::max(best, kRounds * kSize / elapsed.count() / 1e9);
+    }
+    return best;
+}
+
+// Giga multiply-adds per second of 8x8 float matrix products over 64 KiB of
+// blocks, the shape of the IDCT, best of several runs.
+double FloatGops() {
+    constexpr size_t kBlocks = 256, kRounds = 64;
+    std::vector<float> blocks(kBlocks * 64), out(64);
+    float matrix[64];
+    for (size_t i = 0; i < 64; ++i) {
+        matrix[i] = static_cast<float>((i * 37) % 17) / 17 - 0.5f;
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        blocks[i] = static_cast<float>(i % 255) - 128;
+    }
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        const auto begin = Clock::now();
+        float acc = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (size_t b = 0; b < kBlocks; ++b) {
+                const float* block = blocks.data() + b * 64;
+                for (size_t row = 0; row < 8; ++row) {
+                    for (size_t column = 0; column < 8; ++column) {
+                        float sum = 0;
+                        for (size_t k = 0; k < 8; ++k) {
+                            sum += matrix[row * 8 + k] * block[k * 8 + column];
+                        }
+                        out[row * 8 + column] = sum;
+                    }
+                }
+                acc += out[b % 64];
+            }
+        }
+        calibration_float_sink = acc;
+        const std::chrono::duration<double> elapsed = Clock::now() - begin;
+        best = std::max(best, kRounds * kBlocks * 512 / elapsed.count() / 1e9);
+    }
+    return best;
+}
+
+// The geometric mean of both loops: decoding is about as much of one as of the
+// other.
+double CalibrationGops() {
+    return std::sqrt(IntegerGops() * FloatGops());
+}
+
+// Best single decode of at least two, repeated for at least 0.2 s, with one
+// decoder, so that FFTW planning and buffer setup are not measured.
+double MegapixelsPerSecond(JpegDecoder& decoder, const std::string& data) {
+    double best_seconds = 0, total_seconds = 0;
+    Image image;
+    for (int run = 0; run < 2 || total_seconds < 0.2; ++run) {
+        std::istringstream input(data);
+        const auto begin = Clock::now();
+        decoder.Decode(input, &image);
+        const std::chrono::duration<double> elapsed = Clock::now() - begin;
+        best_seconds = run == 0 ? elapsed.count() : std::min(best_seconds, elapsed.count());
+        total_seconds += elapsed.count();
+    }
+    return image.Width() * image.Height() / best_seconds / 1e6;
+}
+
+}  // namespace
+
+TEST_CASE("Throughput budgets", "[perf]") {
+#ifdef NDEBUG
+    const double calibration = CalibrationGops();
+    // DECODER_PERF_REPORT, when set, names a JSON file for the numbers below;
+    // without it the report stream is never opened and writes nothing.
+    const char* report_path = std::getenv("DECODER_PERF_REPORT");
+    std::ofstream report;
+    if (report_path != nullptr) {
+        report.open(report_path);
+    }
+    report << "{\"calibration_gops\":" << calibration << ",\"images\":[";
+    bool first = true;
+    JpegDecoder decoder;
+    for (const auto& budget : kBudgets) {
+        const double mpx_per_second = MegapixelsPerSecond(decoder, ReadTestFile(budget.image));
+        const double normalized = mpx_per_second / calibration;
+        std::cerr << budget.image << ": " << mpx_per_second << " Mpx/s, " << normalized
+                  << " normalized, floor " << budget.min_normalized << '\n';
+        report << (first ? "" : ",") << "{\"image\":\"" << budget.image
+               << "\",\"mpx_per_second\":" << mpx_per_second << ",\"normalized\":" << normalized
+               << ",\"floor\":" << budget.min_normalized
+               << ",\"pass\":" << (normalized >= budget.min_normalized ? "true" : "false") << "}";
+        first = false;
+        INFO(budget.image);
+        CHECK(normalized >= budget.min_normalized);
+    }
+    report << "]}\n";
+#else
+    std::cerr << "WARNING!: Build in release mode to test throughput" << std::endl;
+#endif
+}
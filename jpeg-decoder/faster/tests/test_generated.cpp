@@ -0,0 +1,70 @@
+#include <jpeg_generator.hpp>
+#include <test_commons.hpp>
+
+#include <catch.hpp>
+
+// Encoder settings the files in tests/ do not cover, generated with libjpeg.
+// Subsampled noise is left out: libjpeg upsamples chroma with interpolation,
+// so on noise its output legitimately differs from plain replication.
+
+namespace {
+
+Content ComparableContent(Subsampling subsampling) {
+    const bool full_chroma = subsampling == Subsampling::k444 || subsampling == Subsampling::kGray;
+    return full_chroma ? Content::kNoise : Content::kGradient;
+}
+
+}  // namespace
+
+TEST_CASE("Generated subsamplings", "[jpg][generated]") {
+    for (auto subsampling :
+         {Subsampling::k444, Subsampling::k422, Subsampling::k420, Subsampling::kGray}) {
+        for (auto content : {ComparableContent(subsampling), Content::kGradient, Content::kFlat}) {
+            JpegSpec spec;
+            spec.width = 67;
+            spec.height = 45;
+            spec.subsampling = subsampling;
+            spec.content = content;
+            INFO(spec.Name());
+            CheckJpegData(GenerateJpeg(spec));
+        }
+    }
+}
+
+TEST_CASE("Generated restart intervals", "[jpg][generated]") {
+    for (auto subsampling : {Subsampling::k444, Subsampling::k420, Subsampling::kGray}) {
+        for (unsigned restart_interval : {1, 3, 8, 100}) {
+            JpegSpec spec;
+            spec.width = 100;
+            spec.height = 60;
+            spec.subsampling = subsampling;
+            spec.restart_interval = restart_interval;
+            spec.content = ComparableContent(subsampling);
+            INFO(spec.Name());
+            CheckJpegData(GenerateJpeg(spec));
+        }
+    }
+}
+
+TEST_CASE("Generated sizes and qualities", "[jpg][generated]") {
+    for (size_t size : {1, 8, 16, 17, 255}) {
+        for (int quality : {1, 50, 100}) {
+            JpegSpec spec;
+            spec.width = size;
+            spec.height = size + 3;
+            spec.quality = quality;
+            INFO(spec.Name());
+            CheckJpegData(GenerateJpeg(spec));
+        }
+    }
+}
+
+TEST_CASE("Generation is deterministic", "[generated]") {
+    JpegSpec spec;
+    spec.width = spec.height = 64;
+    spec.content = Content::kNoise;
+    const auto first = GenerateJpeg(spec);
+    REQUIRE(GenerateJpeg(spec) == first);
+    spec.seed = 1;
+    REQUIRE(GenerateJpeg(spec) != first);
+}
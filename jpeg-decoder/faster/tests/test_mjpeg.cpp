@@ -0,0 +1,149 @@
+#include <allocations_checker.h>
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+
+#include <catch.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// |jpeg| without its segments of type |marker| (they all come before SOS).
+std::string Strip(std::string jpeg, uint8_t marker) {
+    const std::string header{'\xff', static_cast<char>(marker)};
+    size_t sos = jpeg.find("\xff\xda");
+    for (size_t pos = jpeg.find(header); pos < sos; pos = jpeg.find(header)) {
+        const size_t size = (static_cast<uint8_t>(jpeg[pos + 2]) << 8) |
+                            static_cast<uint8_t>(jpeg[pos + 3]);
+        jpeg.erase(pos, size + 2);
+        sos = jpeg.find("\xff\xda");
+    }
+    return jpeg;
+}
+
+std::string Frame(uint32_t seed, Subsampling subsampling = Subsampling::k420) {
+    JpegSpec spec;
+    spec.width = 64;
+    spec.height = 48;
+    spec.subsampling = subsampling;
+    spec.content = Content::kNoise;
+    spec.seed = seed;
+    return GenerateJpeg(spec);
+}
+
+Image DecodeAlone(const std::string& jpeg) {
+    std::istringstream input(jpeg);
+    return JpegDecoder().Decode(input);
+}
+
+bool SamePixels(const Image& lhs, const Image& rhs) {
+    if (lhs.Width() != rhs.Width() || lhs.Height() != rhs.Height()) {
+        return false;
+    }
+    for (size_t y = 0; y < lhs.Height(); ++y) {
+        for (size_t x = 0; x < lhs.Width(); ++x) {
+            const auto a = lhs.GetPixel(y, x), b = rhs.GetPixel(y, x);
+            if (a.r != b.r || a.g != b.g || a.b != b.b) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+TEST_CASE("Concatenated frames are decoded one by one", "[mjpeg]") {
+    const std::vector<std::string> frames = {Frame(1), Frame(2, Subsampling::k444),
+                                             Frame(3, Subsampling::kGray), Frame(4)};
+    std::string stream;
+    for (const auto& frame : frames) {
+        stream += frame;
+    }
+
+    std::istringstream input(stream);
+    MjpegDecoder decoder(input);
+    Image image;
+    for (const auto& frame : frames) {
+        REQUIRE(decoder.NextFrame(&image));
+        CHECK(SamePixels(image, DecodeAlone(frame)));
+    }
+    CHECK_FALSE(decoder.NextFrame(&image));
+    CHECK_FALSE(decoder.NextFrame(&image));
+}
+
+TEST_CASE("Frames without DHT use the standard tables", "[mjpeg]") {
+    // libjpeg writes the standard tables, so dropping them changes nothing.
+    const auto frame = Frame(5);
+    const auto stripped = Strip(frame, 0xc4);
+    REQUIRE(stripped.size() < frame.size());
+    CHECK(SamePixels(DecodeAlone(stripped), DecodeAlone(frame)));
+
+    std::istringstream input(stripped + stripped);
+    MjpegDecoder decoder(input);
+    Image image;
+    REQUIRE(decoder.NextFrame(&image));
+    REQUIRE(decoder.NextFrame(&image));
+    CHECK(SamePixels(image, DecodeAlone(frame)));
+}
+
+TEST_CASE("Tables of one frame stay for the next ones", "[mjpeg]") {
+    const auto first = Frame(6), second = Frame(7);
+    const auto bare = Strip(Strip(second, 0xdb), 0xc4);
+
+    // A single image must define its quantization tables.
+    CHECK_THROWS(DecodeAlone(bare));
+
+    std::istringstream input(first + bare + first);
+    MjpegDecoder decoder(input);
+    Image image;
+    REQUIRE(decoder.NextFrame(&image));
+    REQUIRE(decoder.NextFrame(&image));
+    CHECK(SamePixels(image, DecodeAlone(second)));
+    // Redefining the tables in a later frame is fine.
+    REQUIRE(decoder.NextFrame(&image));
+    CHECK(SamePixels(image, DecodeAlone(first)));
+    CHECK_FALSE(decoder.NextFrame(&image));
+}
+
+TEST_CASE("Bytes between frames are skipped", "[mjpeg]") {
+    const auto first = Frame(8), second = Frame(9);
+    // AVI chunk header with its size and a padding byte.
+    const std::string chunk("00dc\x10\x27\x00\x00", 8);
+    std::istringstream input(chunk + first + '\0' + chunk + "\xff\xff" + second + "\xff");
+    MjpegDecoder decoder(input);
+    Image image;
+    REQUIRE(decoder.NextFrame(&image));
+    CHECK(SamePixels(image, DecodeAlone(first)));
+    REQUIRE(decoder.NextFrame(&image));
+    CHECK(SamePixels(image, DecodeAlone(second)));
+    CHECK_FALSE(decoder.NextFrame(&image));
+}
+
+TEST_CASE("A broken frame throws", "[mjpeg]") {
+    const auto frame = Frame(10);
+    std::istringstream input(frame + frame.substr(0, frame.size() / 2));
+    MjpegDecoder decoder(input);
+    Image image;
+    REQUIRE(decoder.NextFrame(&image));
+    CHECK_THROWS(decoder.NextFrame(&image));
+}
+
+TEST_CASE("Frames are decoded without allocations", "[mjpeg][allocations]") {
+    const auto first = Frame(11);
+    const auto bare = Strip(Strip(Frame(12), 0xdb), 0xc4);
+    std::string stream = first;
+    for (int i = 0; i < 8; ++i) {
+        stream += i % 2 ? first : bare;
+    }
+    std::istringstream input(stream);
+    MjpegDecoder decoder(input);
+    Image image;
+    REQUIRE(decoder.NextFrame(&image));
+    // One frame of each kind first: with and without tables.
+    REQUIRE(decoder.NextFrame(&image));
+    EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 7; ++i) { decoder.NextFrame(&image); });
+    CHECK_FALSE(decoder.NextFrame(&image));
+}
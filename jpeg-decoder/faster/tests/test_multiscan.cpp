@@ -0,0 +1,136 @@
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+
+#include <catch.hpp>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+JpegSpec MultiscanSpec(Subsampling subsampling, unsigned restart_interval = 0) {
+    JpegSpec spec;
+    // Not a multiple of the MCU size, so the scans do not cover the MCU grid.
+    spec.width = 75;
+    spec.height = 53;
+    spec.subsampling = subsampling;
+    spec.restart_interval = restart_interval;
+    spec.content = Content::kNoise;
+    spec.scan_per_component = true;
+    return spec;
+}
+
+Image DecodeStream(const std::string& jpeg) {
+    std::istringstream input(jpeg);
+    return JpegDecoder().Decode(input);
+}
+
+bool SamePixels(const Image& lhs, const Image& rhs) {
+    if (lhs.Width() != rhs.Width() || lhs.Height() != rhs.Height()) {
+        return false;
+    }
+    for (size_t y = 0; y < lhs.Height(); ++y) {
+        for (size_t x = 0; x < lhs.Width(); ++x) {
+            const auto a = lhs.GetPixel(y, x), b = rhs.GetPixel(y, x);
+            if (a.r != b.r || a.g != b.g || a.b != b.b) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+TEST_CASE("Scans per component decode like one interleaved scan", "[multiscan]") {
+    for (auto subsampling :
+         {Subsampling::k444, Subsampling::k422, Subsampling::k420, Subsampling::kGray}) {
+        for (unsigned restart_interval : {0u, 3u}) {
+            auto spec = MultiscanSpec(subsampling, restart_interval);
+            const auto multiscan = GenerateJpeg(spec);
+            spec.scan_per_component = false;
+            const auto interleaved = GenerateJpeg(spec);
+            INFO(spec.Name());
+            // A single component always makes a single scan.
+            REQUIRE((multiscan != interleaved) == (subsampling != Subsampling::kGray));
+
+            const auto expected = DecodeStream(interleaved);
+            CHECK(SamePixels(DecodeStream(multiscan), expected));
+
+            // In memory with threads, the scans are decoded concurrently.
+            JpegDecoder decoder(3);
+            Image image;
+            decoder.Decode(multiscan, &image);
+            CHECK(SamePixels(image, expected));
+            decoder.Decode(interleaved, &image);
+            CHECK(SamePixels(image, expected));
+        }
+    }
+}
+
+TEST_CASE("Every component needs exactly one scan", "[multiscan]") {
+    const auto jpeg = GenerateJpeg(MultiscanSpec(Subsampling::k420));
+    const size_t last_scan = jpeg.rfind("\xff\xda");
+    const size_t first_scan = jpeg.find("\xff\xda");
+    REQUIRE(last_scan != first_scan);
+
+    const auto missing = jpeg.substr(0, last_scan) + "\xff\xd9";
+    CHECK_THROWS(DecodeStream(missing));
+
+    // The first scan again in place of the last one.
+    size_t first_end = first_scan + 2;
+    while (jpeg[first_end] != '\xff' || jpeg[first_end + 1] == '\0' ||
+           (static_cast<uint8_t>(jpeg[first_end + 1]) & 0xf8) == 0xd0) {
+        ++first_end;
+    }
+    const auto twice = jpeg.substr(0, last_scan) +
+                       jpeg.substr(first_scan, first_end - first_scan) + "\xff\xd9";
+    CHECK_THROWS(DecodeStream(twice));
+    JpegDecoder decoder(3);
+    Image image;
+    CHECK_THROWS(decoder.Decode(twice, &image));
+}
+
+TEST_CASE("Tables may be defined again before every scan", "[multiscan]") {
+    // As libjpeg writes multi-scan files with optimized tables.
+    const auto jpeg = GenerateJpeg(MultiscanSpec(Subsampling::k420));
+    std::string tables;
+    for (size_t pos = jpeg.find("\xff\xc4"); pos < jpeg.find("\xff\xda");
+         pos = jpeg.find("\xff\xc4", pos + 2)) {
+        const size_t size = static_cast<uint8_t>(jpeg[pos + 2]) << 8 |
+                            static_cast<uint8_t>(jpeg[pos + 3]);
+        tables += jpeg.substr(pos, size + 2);
+    }
+    REQUIRE_FALSE(tables.empty());
+    std::string redefined = jpeg;
+    for (size_t pos = redefined.find("\xff\xda"); pos != std::string::npos;
+         pos = redefined.find("\xff\xda", pos + tables.size() + 2)) {
+        redefined.insert(pos, tables);
+    }
+
+    const auto expected = DecodeStream(jpeg);
+    CHECK(SamePixels(DecodeStream(redefined), expected));
+    JpegDecoder decoder(4);
+    Image image;
+    decoder.Decode(redefined, &image);
+    CHECK(SamePixels(image, expected));
+
+    // One segment still may not define a table twice.
+    const size_t first_size = static_cast<uint8_t>(tables[2]) << 8 |
+                              static_cast<uint8_t>(tables[3]);
+    const auto payload = tables.substr(4, first_size - 2);
+    const size_t size = 2 * payload.size() + 2;
+    const auto twice = jpeg.substr(0, jpeg.find("\xff\xda")) + "\xff\xc4" +
+                       static_cast<char>(size >> 8) + static_cast<char>(size & 0xff) + payload +
+                       payload + jpeg.substr(jpeg.find("\xff\xda"));
+    CHECK_THROWS(DecodeStream(twice));
+}
+
+TEST_CASE("A frame without components is rejected", "[multiscan]") {
+    // SOI, SOF0 of a 16x16 image with no components, SOS of one component.
+    const std::string jpeg("\xff\xd8\xff\xc0\x00\x08\x08\x00\x10\x00\x10\x00"
+                           "\xff\xda\x00\x08\x01\x01\x00\x00\x3f\x00",
+                           22);
+    CHECK_THROWS_AS(DecodeStream(jpeg), std::runtime_error);
+}
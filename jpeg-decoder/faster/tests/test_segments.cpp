@@ -0,0 +1,80 @@
+#include <allocations_checker.h>
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+#include <test_commons.hpp>
+
+#include <catch.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A generated JPEG with an EXIF-sized APP1, an APP2 and a comment before the scan.
+std::string JpegWithSegments() {
+    JpegSpec spec;
+    spec.width = spec.height = 40;
+    auto data = GenerateJpeg(spec);
+    const auto segments = Segment(0xe1, "Exif" + std::string(65000, 'e')) +
+                          Segment(0xe2, "ICC_PROFILE") + Segment(0xfe, "hello");
+    data.insert(data.find("\xff\xda"), segments);
+    return data;
+}
+
+bool PointsInto(std::string_view view, const std::string& buffer) {
+    return view.data() >= buffer.data() &&
+           view.data() + view.size() <= buffer.data() + buffer.size();
+}
+
+}  // namespace
+
+TEST_CASE("Segments are views into the input", "[segments]") {
+    const auto data = JpegWithSegments();
+    JpegDecoder decoder;
+    Image image;
+    std::vector<JpegSegment> segments;
+    decoder.Decode(data, &image, &segments);
+
+    // APP0 (JFIF) written by libjpeg comes first.
+    REQUIRE(segments.size() == 4);
+    CHECK(segments[0].marker == 0xe0);
+    CHECK(segments[1].marker == 0xe1);
+    CHECK(segments[1].data.substr(0, 4) == "Exif");
+    CHECK(segments[1].data.size() == 65004);
+    CHECK(segments[2].marker == 0xe2);
+    CHECK(segments[2].data == "ICC_PROFILE");
+    CHECK(segments[3].marker == 0xfe);
+    CHECK(segments[3].data == "hello");
+    for (const auto& segment : segments) {
+        CHECK(PointsInto(segment.data, data));
+    }
+    CHECK(image.GetComment() == "hello");
+
+    std::istringstream input(data);
+    const auto expected = decoder.Decode(input);
+    CHECK(expected.GetComment() == "hello");
+    CHECK(image.GetPixel(20, 20).r == expected.GetPixel(20, 20).r);
+}
+
+TEST_CASE("Segments without a list are skipped", "[segments]") {
+    const auto data = JpegWithSegments();
+    JpegDecoder decoder;
+    Image image;
+    decoder.Decode(data, &image);
+    CHECK(image.GetComment() == "hello");
+
+    std::vector<JpegSegment> segments;
+    const auto truncated = data.substr(0, data.find("ICC_PROFILE"));
+    CHECK_THROWS(decoder.Decode(truncated, &image));
+    CHECK_THROWS(decoder.Decode(truncated, &image, &segments));
+}
+
+TEST_CASE("Segments are returned without allocations", "[segments][allocations]") {
+    const auto data = JpegWithSegments();
+    JpegDecoder decoder;
+    Image image;
+    std::vector<JpegSegment> segments;
+    decoder.Decode(data, &image, &segments);
+    EXPECT_ZERO_ALLOCATIONS(decoder.Decode(data, &image, &segments));
+}
@@ -0,0 +1,119 @@
+#include <allocations_checker.h>
+#include <decoder.h>
+#include <jpeg_generator.hpp>
+#include <test_commons.hpp>
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Inputs that are cheap to send and used to be expensive to decode. Every one
+// must cost time and memory in proportion to its size, not to what its headers
+// promise. Fuzzing for more of them is fuzz_slow_input.cpp.
+
+namespace {
+
+constexpr uint8_t kSof = 0xc0, kDht = 0xc4, kSos = 0xda, kApp1 = 0xe1, kCom = 0xfe;
+
+size_t FindMarker(const std::string& data, uint8_t marker) {
+    const auto pos = data.find(std::string{'\xff', static_cast<char>(marker)});
+    REQUIRE(pos != std::string::npos);
+    return pos;
+}
+
+// |segments| inserted right before the scan.
+std::string WithSegmentsBeforeScan(const std::string& data, const std::string& segments) {
+    std::string result = data;
+    result.insert(FindMarker(data, kSos), segments);
+    return result;
+}
+
+Image DecodeData(const std::string& data) {
+    std::istringstream input(data);
+    return Decode(input);
+}
+
+double NanosecondsPerByte(const std::string& data) {
+    const auto begin = std::chrono::steady_clock::now();
+    try {
+        DecodeData(data);
+    } catch (const std::exception&) {
+    }
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / data.size();
+}
+
+std::string SmallJpeg() {
+    JpegSpec spec;
+    spec.width = spec.height = 64;
+    return GenerateJpeg(spec);
+}
+
+}  // namespace
+
+TEST_CASE("Header promising a huge image", "[slow_input]") {
+    auto data = SmallJpeg();
+    // SOF: marker, length, precision, then height and width. 8192x8192 is
+    // 200 MB of coefficients, small enough for the allocation to succeed.
+    const size_t sof = FindMarker(data, kSof);
+    data.replace(sof + 5, 4, std::string{'\x20', '\0', '\x20', '\0'});
+
+    constexpr size_t kLimit = 16 << 20;
+    EXPECT_PEAK_BYTES_BELOW(CHECK_THROWS(DecodeData(data)), kLimit);
+#ifdef NDEBUG
+    CHECK(NanosecondsPerByte(data) < 100'000);
+#endif
+}
+
+TEST_CASE("Many tiny DHT segments", "[slow_input]") {
+    const auto data = SmallJpeg();
+    // AC table 3, unused by the scan, with one code of length 1. Tables may be
+    // redefined between scans, so every segment rebuilds the tree: each must
+    // cost no more than its bytes.
+    std::string table(18, '\0');
+    table[0] = 0x13;
+    table[1] = 1;
+    const auto segment = Segment(kDht, table);
+    std::string segments;
+    for (size_t i = 0; i < 20000; ++i) {
+        segments += segment;
+    }
+    const auto slow = WithSegmentsBeforeScan(data, segments);
+
+    CHECK(DecodeData(WithSegmentsBeforeScan(data, segment)).Width() == 64);
+    CHECK(DecodeData(slow).Width() == 64);
+#ifdef NDEBUG
+    CHECK(NanosecondsPerByte(slow) < 100);
+#endif
+}
+
+TEST_CASE("Long APPn and COM segments", "[slow_input]") {
+    const auto data = SmallJpeg();
+    const std::string payload(65533, 'x');
+    std::string segments;
+    for (size_t i = 0; i < 50; ++i) {
+        segments += Segment(kApp1, payload) + Segment(kCom, payload);
+    }
+    segments += Segment(kCom, "last");
+    const auto slow = WithSegmentsBeforeScan(data, segments);
+
+    Image image;
+    EXPECT_PEAK_BYTES_BELOW(image = DecodeData(slow), 4 * slow.size());
+    CHECK(image.GetComment() == "last");
+#ifdef NDEBUG
+    CHECK(NanosecondsPerByte(slow) < 200);
+#endif
+}
+
+TEST_CASE("Sampling factors above 4", "[slow_input]") {
+    auto data = SmallJpeg();
+    // SOF: marker, length, precision, height, width, components, then the
+    // first component id and its sampling factors.
+    const size_t sof = FindMarker(data, kSof);
+    data[sof + 11] = 0x5f;
+    CHECK_THROWS(DecodeData(data));
+}
@@ -0,0 +1,58 @@
+#include <decode_stats.h>
+
+#include <catch.hpp>
+
+#include <fstream>
+#include <string>
+
+#ifndef HSE_TASK_DIR
+#define HSE_TASK_DIR "./"
+#endif
+
+namespace {
+
+DecodeStats DecodeWithStats(const std::string& filename) {
+    std::ifstream fin(std::string(HSE_TASK_DIR) + "tests/" + filename);
+    REQUIRE(fin.is_open());
+    DecodeStats stats;
+    auto image = Decode(fin, &stats);
+    (void)image;
+    return stats;
+}
+
+}  // namespace
+
+#ifdef DECODER_STATS
+
+TEST_CASE("Stats count blocks", "[stats]") {
+    // 512x512 4:4:4: 64 * 64 blocks in each of the three channels.
+    const auto stats = DecodeWithStats("lenna.jpg");
+    REQUIRE(stats.blocks == 64 * 64 * 3);
+    REQUIRE(stats.dc_only_blocks <= stats.blocks);
+    REQUIRE(stats.AverageEobPosition() >= 1.0);
+    REQUIRE(stats.AverageEobPosition() <= 64.0);
+    REQUIRE(stats.stuffed_bytes < stats.scan_bytes);
+    REQUIRE(stats.allocations > 0);
+    REQUIRE(stats.time.entropy.count() > 0);
+    REQUIRE(stats.time.idct.count() > 0);
+    REQUIRE(stats.time.color.count() > 0);
+}
+
+TEST_CASE("Stats scan bytes", "[stats]") {
+    // 4:2:0 with 16x16 MCUs, the scan is most of the 112884 bytes of the file.
+    const auto stats = DecodeWithStats("test.jpg");
+    REQUIRE(stats.blocks == 20 * 30 * 6);
+    REQUIRE(stats.scan_bytes > 100000);
+    REQUIRE(stats.scan_bytes < 112884);
+}
+
+#else
+
+TEST_CASE("Stats are disabled", "[stats]") {
+    const auto stats = DecodeWithStats("lenna.jpg");
+    REQUIRE(stats.blocks == 0);
+    REQUIRE(stats.scan_bytes == 0);
+    REQUIRE(stats.time.entropy.count() == 0);
+}
+
+#endif
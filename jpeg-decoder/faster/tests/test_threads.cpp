@@ -0,0 +1,63 @@
+#include <jpeg_decoder.h>
+#include <jpeg_generator.hpp>
+#include <test_commons.hpp>
+
+#include <catch.hpp>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+void RequireSameAsSingleThreaded(const std::string& data, size_t threads) {
+    std::istringstream serial_input(data), parallel_input(data);
+    const auto expected = JpegDecoder().Decode(serial_input);
+    const auto actual = JpegDecoder(threads).Decode(parallel_input);
+
+    REQUIRE(actual.Width() == expected.Width());
+    REQUIRE(actual.Height() == expected.Height());
+    REQUIRE(actual.GetComment() == expected.GetComment());
+    for (size_t y = 0; y < actual.Height(); ++y) {
+        for (size_t x = 0; x < actual.Width(); ++x) {
+            const auto actual_pixel = actual.GetPixel(y, x);
+            const auto expected_pixel = expected.GetPixel(y, x);
+            REQUIRE(actual_pixel.r == expected_pixel.r);
+            REQUIRE(actual_pixel.g == expected_pixel.g);
+            REQUIRE(actual_pixel.b == expected_pixel.b);
+        }
+    }
+}
+
+}  // namespace
+
+TEST_CASE("Parallel decoding matches single-threaded", "[threads]") {
+    for (const auto* filename : {"lenna.jpg", "test.jpg", "grayscale.jpg", "small.jpg"}) {
+        INFO(filename);
+        const auto data = ReadTestFile(filename);
+        for (size_t threads : {2, 3, 8}) {
+            RequireSameAsSingleThreaded(data, threads);
+        }
+    }
+}
+
+TEST_CASE("More threads than MCU rows", "[threads]") {
+    JpegSpec spec;
+    spec.width = 40;
+    spec.height = 16;
+    RequireSameAsSingleThreaded(GenerateJpeg(spec), 16);
+}
+
+TEST_CASE("Parallel decoding reuses the decoder", "[threads]") {
+    const auto data = ReadTestFile("test.jpg");
+    JpegDecoder decoder(4);
+    Image image;
+    for (int i = 0; i < 3; ++i) {
+        std::istringstream input(data);
+        decoder.Decode(input, &image);
+    }
+    std::istringstream input(data);
+    const auto expected = JpegDecoder().Decode(input);
+    REQUIRE(image.GetPixel(100, 100).r == expected.GetPixel(100, 100).r);
+    REQUIRE_THROWS_AS(JpegDecoder(0), std::invalid_argument);
+}
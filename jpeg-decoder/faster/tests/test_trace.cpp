@@ -0,0 +1,122 @@
+#include <jpeg_decoder.h>
+#include <trace.h>
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifndef HSE_TASK_DIR
+#define HSE_TASK_DIR "./"
+#endif
+
+namespace {
+
+void DecodeFile(JpegDecoder& decoder, const std::string& filename) {
+    std::ifstream fin(std::string(HSE_TASK_DIR) + "tests/" + filename);
+    REQUIRE(fin.is_open());
+    (void)decoder.Decode(fin);
+}
+
+size_t CountSubstr(const std::string& text, const std::string& pattern) {
+    size_t cnt = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos;
+         pos = text.find(pattern, pos + 1)) {
+        ++cnt;
+    }
+    return cnt;
+}
+
+}  // namespace
+
+TEST_CASE("Trace is off by default", "[trace]") {
+    trace::Clear();
+    JpegDecoder decoder;
+    DecodeFile(decoder, "small.jpg");
+    std::stringstream out;
+    trace::Dump(out);
+    REQUIRE(CountSubstr(out.str(), "\"ph\":\"X\"") == 0);
+}
+
+TEST_CASE("Trace records stages per thread", "[trace]") {
+    trace::Clear();
+    JpegDecoder first_decoder, second_decoder;
+    std::thread first([&] {
+        trace::ScopedEnable tracing;
+        DecodeFile(first_decoder, "small.jpg");
+    });
+    std::thread second([&] {
+        trace::ScopedEnable tracing;
+        DecodeFile(second_decoder, "tiny.jpg");
+    });
+    first.join();
+    second.join();
+
+    std::stringstream out;
+    trace::Dump(out);
+    const auto json = out.str();
+    REQUIRE(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+    REQUIRE(CountSubstr(json, "\"name\":\"decode\"") == 2);
+    REQUIRE(CountSubstr(json, "\"name\":\"entropy\"") == 2);
+    REQUIRE(CountSubstr(json, "\"name\":\"idct\"") == 2);
+}
+
+TEST_CASE("Traced decodes run next to untraced ones", "[trace]") {
+    trace::Clear();
+    constexpr size_t kRounds = 20;
+    // Two threads each, the traced decoder traces its worker too.
+    JpegDecoder traced_decoder(2), untraced_decoder(2);
+    std::atomic<bool> done{false};
+    std::thread untraced([&] {
+        while (!done) {
+            DecodeFile(untraced_decoder, "small.jpg");
+        }
+    });
+    std::string json;
+    std::thread traced([&] {
+        for (size_t i = 0; i < kRounds; ++i) {
+            trace::ScopedEnable tracing;
+            DecodeFile(traced_decoder, "small.jpg");
+        }
+        DecodeFile(traced_decoder, "small.jpg");
+    });
+    // Collected while both keep decoding.
+    for (size_t i = 0; i < kRounds; ++i) {
+        std::stringstream out;
+        trace::Dump(out);
+        json += out.str();
+    }
+    traced.join();
+    done = true;
+    untraced.join();
+    std::stringstream out;
+    trace::Dump(out);
+    json += out.str();
+
+    REQUIRE(CountSubstr(json, "\"name\":\"decode\"") == kRounds);
+    // small.jpg has more than one MCU row: every decode splits its IDCT in two.
+    REQUIRE(CountSubstr(json, "\"name\":\"idct\"") == 2 * kRounds);
+    REQUIRE(!trace::IsEnabled());
+}
+
+TEST_CASE("Trace keeps the newest events of a thread", "[trace]") {
+    trace::Clear();
+    const size_t dropped = trace::DroppedEvents();
+    constexpr size_t kOverflow = 100;
+    {
+        trace::ScopedEnable tracing;
+        for (size_t i = 0; i < trace::kThreadCapacity + kOverflow; ++i) {
+            TRACE_SCOPE("event");
+        }
+    }
+    std::stringstream first, second;
+    trace::Dump(first);
+    trace::Dump(second);
+    REQUIRE(CountSubstr(first.str(), "\"name\":\"event\"") == trace::kThreadCapacity);
+    REQUIRE(trace::DroppedEvents() == dropped + kOverflow);
+    // Dump drains what it writes.
+    REQUIRE(CountSubstr(second.str(), "\"name\":\"event\"") == 0);
+}
@@ -0,0 +1,449 @@
+#include <jpeg_decoder.h>
+#include <jpeg_encoder.h>
+#include <jpeg_generator.hpp>
+#include <jpeg_transcoder.h>
+#include <libjpg_reader.hpp>
+
+#include "parsers.h"
+
+#include <catch.hpp>
+
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr JpegTransform kTransforms[] = {
+    JpegTransform::kFlipHorizontal, JpegTransform::kFlipVertical, JpegTransform::kTranspose,
+    JpegTransform::kTransverse,     JpegTransform::kRotate90,     JpegTransform::kRotate180,
+    JpegTransform::kRotate270};
+
+std::string Generate(size_t width, size_t height, Subsampling subsampling,
+                     Content content = Content::kNoise) {
+    JpegSpec spec;
+    spec.width = width;
+    spec.height = height;
+    spec.subsampling = subsampling;
+    spec.content = content;
+    return GenerateJpeg(spec);
+}
+
+// Pixels of |actual| that differ from |expected(y, x)| by more than the IDCT rounding.
+size_t CountMismatches(const Image& actual, const std::function<RGB(size_t, size_t)>& expected) {
+    size_t mismatches = 0;
+    for (size_t y = 0; y < actual.Height(); ++y) {
+        for (size_t x = 0; x < actual.Width(); ++x) {
+            const auto a = actual.GetPixel(y, x), e = expected(y, x);
+            mismatches += std::abs(a.r - e.r) > 2 || std::abs(a.g - e.g) > 2 ||
+                          std::abs(a.b - e.b) > 2;
+        }
+    }
+    return mismatches;
+}
+
+}  // namespace
+
+TEST_CASE("Lossless transforms move pixels", "[transcoder]") {
+    for (auto subsampling :
+         {Subsampling::k444, Subsampling::k422, Subsampling::k420, Subsampling::kGray}) {
+        const auto jpeg = Generate(75, 53, subsampling);
+        JpegDecoder decoder;
+        Image original;
+        decoder.Decode(jpeg, &original);
+        // Partial MCUs on the right and bottom edges are dropped by flips.
+        const size_t mcu_w = subsampling == Subsampling::k422 || subsampling == Subsampling::k420
+                                 ? 16 : 8;
+        const size_t mcu_h = subsampling == Subsampling::k420 ? 16 : 8;
+        const size_t trimmed_w = 75 / mcu_w * mcu_w, trimmed_h = 53 / mcu_h * mcu_h;
+
+        JpegTranscoder transcoder;
+        for (auto transform : kTransforms) {
+            INFO(ToString(subsampling) << ", transform " << static_cast<int>(transform));
+            std::string output;
+            transcoder.Transform(jpeg, transform, &output);
+            Image image;
+            decoder.Decode(output, &image);
+            const auto libjpeg = ReadJpgFromMemory(output);
+            CHECK(libjpeg.Width() == image.Width());
+            CHECK(libjpeg.Height() == image.Height());
+
+            std::function<RGB(size_t, size_t)> expected;
+            size_t width = 75, height = 53;
+            switch (transform) {
+                case JpegTransform::kFlipHorizontal:
+                    width = trimmed_w;
+                    expected = [&](size_t y, size_t x) {
+                        return original.GetPixel(y, trimmed_w - 1 - x);
+                    };
+                    break;
+                case JpegTransform::kFlipVertical:
+                    height = trimmed_h;
+                    expected = [&](size_t y, size_t x) {
+                        return original.GetPixel(trimmed_h - 1 - y, x);
+                    };
+                    break;
+                case JpegTransform::kTranspose:
+                    width = 53;
+                    height = 75;
+                    expected = [&](size_t y, size_t x) { return original.GetPixel(x, y); };
+                    break;
+                case JpegTransform::kTransverse:
+                    width = trimmed_h;
+                    height = trimmed_w;
+                    expected = [&](size_t y, size_t x) {
+                        return original.GetPixel(trimmed_h - 1 - x, trimmed_w - 1 - y);
+                    };
+                    break;
+                case JpegTransform::kRotate90:
+                    width = trimmed_h;
+                    height = 75;
+                    expected = [&](size_t y, size_t x) {
+                        return original.GetPixel(trimmed_h - 1 - x, y);
+                    };
+                    break;
+                case JpegTransform::kRotate180:
+                    width = trimmed_w;
+                    height = trimmed_h;
+                    expected = [&](size_t y, size_t x) {
+                        return original.GetPixel(trimmed_h - 1 - y, trimmed_w - 1 - x);
+                    };
+                    break;
+                case JpegTransform::kRotate270:
+                    width = 53;
+                    height = trimmed_w;
+                    expected = [&](size_t y, size_t x) {
+                        return original.GetPixel(x, trimmed_w - 1 - y);
+                    };
+                    break;
+            }
+            REQUIRE(image.Width() == width);
+            REQUIRE(image.Height() == height);
+            CHECK(CountMismatches(image, expected) == 0);
+        }
+    }
+}
+
+TEST_CASE("Four rotations give the same coefficients", "[transcoder]") {
+    const auto jpeg = Generate(64, 48, Subsampling::k422);
+    JpegCoefficients original, rotated, next;
+    JpegDecoder().DecodeCoefficients(jpeg, &original);
+    rotated = original;
+    for (int i = 0; i < 4; ++i) {
+        TransformCoefficients(rotated, JpegTransform::kRotate90, &next);
+        std::swap(rotated, next);
+        CHECK(rotated.h_max == (i % 2 == 0 ? 1 : 2));
+    }
+    CHECK(rotated.width == 64);
+    CHECK(rotated.height == 48);
+    CHECK(rotated.coefficients == original.coefficients);
+
+    TransformCoefficients(original, JpegTransform::kTranspose, &next);
+    TransformCoefficients(next, JpegTransform::kTranspose, &rotated);
+    CHECK(rotated.coefficients == original.coefficients);
+    CHECK(rotated.components[1].quant_table == original.components[1].quant_table);
+    CHECK(next.components[0].v == 2);
+}
+
+TEST_CASE("Encoded coefficients decode to the same ones", "[transcoder]") {
+    for (auto subsampling :
+         {Subsampling::k444, Subsampling::k422, Subsampling::k420, Subsampling::kGray}) {
+        INFO(ToString(subsampling));
+        const auto jpeg = Generate(75, 53, subsampling);
+        JpegDecoder decoder;
+        JpegCoefficients coefficients, decoded;
+        decoder.DecodeCoefficients(jpeg, &coefficients);
+        std::string output;
+        EncodeCoefficients(coefficients, &output);
+        decoder.DecodeCoefficients(output, &decoded);
+        CHECK(decoded.width == coefficients.width);
+        CHECK(decoded.height == coefficients.height);
+        REQUIRE(decoded.components.size() == coefficients.components.size());
+        for (size_t c = 0; c < coefficients.components.size(); ++c) {
+            CHECK(decoded.components[c].quant_table == coefficients.components[c].quant_table);
+        }
+        CHECK(decoded.coefficients == coefficients.coefficients);
+        CHECK(ReadJpgFromMemory(output).Width() == 75);
+    }
+}
+
+TEST_CASE("Quantization steps above 255 use extended sequential", "[transcoder]") {
+    JpegCoefficients coefficients;
+    coefficients.width = 12;
+    coefficients.height = 9;
+    coefficients.h_max = coefficients.v_max = 1;
+    auto& component = coefficients.components.emplace_back();
+    component.id = 1;
+    component.h = component.v = 1;
+    component.quant_table.fill(300);
+    component.blocks_w = component.blocks_h = 2;
+    coefficients.coefficients.assign(4 * 64, 0);
+    coefficients.Block(0, 1, 0)[0] = -5;
+    coefficients.Block(0, 0, 1)[9] = 3;
+
+    std::string output;
+    EncodeCoefficients(coefficients, &output);
+    JpegCoefficients decoded;
+    JpegDecoder().DecodeCoefficients(output, &decoded);
+    CHECK(decoded.components[0].quant_table == component.quant_table);
+    CHECK(decoded.coefficients == coefficients.coefficients);
+
+    coefficients.Block(0, 0, 0)[1] = 1100;
+    CHECK_THROWS_AS(EncodeCoefficients(coefficients, &output), std::invalid_argument);
+}
+
+TEST_CASE("Extended sequential files must have 8-bit samples", "[transcoder]") {
+    JpegCoefficients coefficients;
+    coefficients.width = coefficients.height = 8;
+    coefficients.h_max = coefficients.v_max = 1;
+    auto& component = coefficients.components.emplace_back();
+    component.id = 1;
+    component.h = component.v = 1;
+    component.quant_table.fill(300);
+    component.blocks_w = component.blocks_h = 1;
+    coefficients.coefficients.assign(64, 0);
+    std::string output;
+    EncodeCoefficients(coefficients, &output);
+
+    // The precision byte follows the marker and the length of SOF1.
+    const size_t sof = output.find("\xff\xc1");
+    REQUIRE(sof != std::string::npos);
+    output[sof + 4] = 12;
+    JpegCoefficients decoded;
+    CHECK_THROWS_AS(JpegDecoder().DecodeCoefficients(output, &decoded), std::runtime_error);
+}
+
+TEST_CASE("Crop on MCU boundaries", "[transcoder]") {
+    const auto jpeg = Generate(75, 53, Subsampling::k420);
+    JpegDecoder decoder;
+    Image original, image;
+    decoder.Decode(jpeg, &original);
+
+    JpegTranscoder transcoder;
+    std::string output;
+    transcoder.Crop(jpeg, 16, 32, 50, 21, &output);
+    decoder.Decode(output, &image);
+    REQUIRE(image.Width() == 50);
+    REQUIRE(image.Height() == 21);
+    CHECK(CountMismatches(image, [&](size_t y, size_t x) {
+              return original.GetPixel(y + 32, x + 16);
+          }) == 0);
+
+    CHECK_THROWS_AS(transcoder.Crop(jpeg, 8, 0, 16, 16, &output), std::invalid_argument);
+    CHECK_THROWS_AS(transcoder.Crop(jpeg, 0, 0, 76, 16, &output), std::invalid_argument);
+    CHECK_THROWS_AS(transcoder.Crop(jpeg, 0, 0, 0, 16, &output), std::invalid_argument);
+}
+
+TEST_CASE("Optimized Huffman tables keep coefficients and segments", "[transcoder]") {
+    for (auto subsampling : {Subsampling::k444, Subsampling::k420, Subsampling::kGray}) {
+        for (auto content : {Content::kNoise, Content::kGradient}) {
+            for (bool scan_per_component : {false, true}) {
+                JpegSpec spec;
+                spec.width = 200;
+                spec.height = 120;
+                spec.subsampling = subsampling;
+                spec.content = content;
+                spec.scan_per_component = scan_per_component;
+                INFO(spec.Name());
+                const auto jpeg = GenerateJpeg(spec);
+
+                JpegTranscoder transcoder;
+                std::string optimized;
+                transcoder.Optimize(jpeg, &optimized);
+                JpegDecoder decoder;
+                JpegCoefficients original, decoded;
+                std::vector<JpegSegment> segments, optimized_segments;
+                decoder.DecodeCoefficients(jpeg, &original, &segments);
+                decoder.DecodeCoefficients(optimized, &decoded, &optimized_segments);
+                CHECK(decoded.coefficients == original.coefficients);
+                REQUIRE(optimized_segments.size() == segments.size());
+                for (size_t i = 0; i < segments.size(); ++i) {
+                    CHECK(optimized_segments[i].marker == segments[i].marker);
+                    CHECK(optimized_segments[i].data == segments[i].data);
+                }
+
+                // libjpeg writes the standard tables, like EncodeCoefficients by default.
+                std::string standard;
+                EncodeCoefficients(original, &standard);
+                CHECK(optimized.size() < standard.size());
+                CHECK(ReadJpgFromMemory(optimized).Width() == 200);
+            }
+        }
+    }
+}
+
+TEST_CASE("Optimized Huffman codes are at most 16 bits long", "[transcoder]") {
+    // Symbol k of 20 appears Fibonacci(k) times: unlimited, the rarest would
+    // need codes of about 20 bits.
+    constexpr size_t kSymbols = 20;
+    std::vector<size_t> counts = {1, 1};
+    while (counts.size() < kSymbols) {
+        counts.push_back(counts[counts.size() - 1] + counts[counts.size() - 2]);
+    }
+    size_t blocks = 0;
+    for (size_t count : counts) {
+        blocks += count;
+    }
+    // Blocks past the counted ones are empty.
+    const size_t blocks_w = 256, blocks_h = (blocks + blocks_w - 1) / blocks_w;
+    JpegCoefficients coefficients;
+    coefficients.width = 8 * blocks_w;
+    coefficients.height = static_cast<uint16_t>(8 * blocks_h);
+    coefficients.h_max = coefficients.v_max = 1;
+    auto& component = coefficients.components.emplace_back();
+    component.id = 1;
+    component.h = component.v = 1;
+    component.quant_table.fill(1);
+    component.blocks_w = blocks_w;
+    component.blocks_h = blocks_h;
+    coefficients.coefficients.assign(blocks_w * blocks_h * 64, 0);
+    size_t index = 0;
+    for (size_t symbol = 0; symbol < kSymbols; ++symbol) {
+        // Runs 0..15 of a +-1, then a lone value of category 2..5.
+        const size_t run = symbol < 16 ? symbol : 0;
+        const int16_t value = symbol < 16 ? 1 : static_cast<int16_t>(1 << (symbol - 15));
+        for (size_t i = 0; i < counts[symbol]; ++i, ++index) {
+            coefficients.Block(0, index / blocks_w, index % blocks_w)[kZigZagToNatural[run + 1]] =
+                value;
+        }
+    }
+
+    std::string output;
+    EncodeCoefficients(coefficients, &output, {.optimize_huffman = true});
+    JpegCoefficients decoded;
+    JpegDecoder().DecodeCoefficients(output, &decoded);
+    CHECK(decoded.coefficients == coefficients.coefficients);
+    const auto libjpeg = ReadJpgCoefficients(output);
+    REQUIRE(libjpeg.size() == 1);
+    CHECK(libjpeg[0].blocks == coefficients.coefficients);
+}
+
+TEST_CASE("Requantization rounds to the coarser steps", "[transcoder]") {
+    JpegCoefficients coefficients;
+    coefficients.width = coefficients.height = 8;
+    coefficients.h_max = coefficients.v_max = 1;
+    auto& component = coefficients.components.emplace_back();
+    component.id = 1;
+    component.h = component.v = 1;
+    component.quant_table.fill(2);
+    component.blocks_w = component.blocks_h = 1;
+    coefficients.coefficients = {1, -1, 3, -3, 5, 7, 0, 100};
+    coefficients.coefficients.resize(64);
+
+    std::array<uint16_t, 64> coarse;
+    coarse.fill(4);
+    // A finer step is not taken.
+    coarse[7] = 1;
+    const std::array<uint16_t, 64> tables[] = {coarse};
+    RequantizeCoefficients(coefficients, tables, &coefficients);
+    const std::vector<int16_t> expected = {1, -1, 2, -2, 3, 4, 0, 100};
+    CHECK(std::vector<int16_t>(coefficients.coefficients.begin(),
+                               coefficients.coefficients.begin() + 8) == expected);
+    CHECK(coefficients.components[0].quant_table[0] == 4);
+    CHECK(coefficients.components[0].quant_table[7] == 2);
+
+    CHECK_THROWS_AS(RequantizeCoefficients(coefficients, {}, &coefficients),
+                    std::invalid_argument);
+}
+
+TEST_CASE("Requantized JPEGs are smaller and close to the original", "[transcoder]") {
+    JpegSpec spec;
+    spec.width = 200;
+    spec.height = 120;
+    spec.quality = 95;
+    const auto jpeg = GenerateJpeg(spec);
+    JpegDecoder decoder;
+    Image original, image;
+    decoder.Decode(jpeg, &original);
+
+    JpegTranscoder transcoder;
+    std::string output;
+    transcoder.Requantize(jpeg, 50, &output);
+    CHECK(output.size() < jpeg.size() * 2 / 3);
+    JpegCoefficients coefficients;
+    decoder.DecodeCoefficients(output, &coefficients);
+    CHECK(coefficients.components[0].quant_table == QualityQuantTable(50, false));
+    CHECK(coefficients.components[2].quant_table == QualityQuantTable(50, true));
+
+    decoder.Decode(output, &image);
+    REQUIRE(image.Width() == 200);
+    size_t far = 0;
+    for (size_t y = 0; y < image.Height(); ++y) {
+        for (size_t x = 0; x < image.Width(); ++x) {
+            const auto a = image.GetPixel(y, x), e = original.GetPixel(y, x);
+            far += std::abs(a.r - e.r) > 16 || std::abs(a.g - e.g) > 16 ||
+                   std::abs(a.b - e.b) > 16;
+        }
+    }
+    CHECK(far < image.Width() * image.Height() / 100);
+
+    // Quality above the input's changes nothing.
+    JpegCoefficients original_coefficients;
+    decoder.DecodeCoefficients(jpeg, &original_coefficients);
+    transcoder.Requantize(jpeg, 100, &output);
+    decoder.DecodeCoefficients(output, &coefficients);
+    CHECK(coefficients.coefficients == original_coefficients.coefficients);
+}
+
+TEST_CASE("Stitched tiles give back the image they were cut from", "[transcoder]") {
+    for (auto subsampling : {Subsampling::k444, Subsampling::k420, Subsampling::kGray}) {
+        INFO("subsampling " << static_cast<int>(subsampling));
+        const auto jpeg = Generate(75, 53, subsampling);
+        JpegDecoder decoder;
+        JpegCoefficients original, stitched;
+        decoder.DecodeCoefficients(jpeg, &original);
+
+        // Cut on MCU boundaries of every sampling: columns at 32 and 64, rows at 16.
+        JpegTranscoder transcoder;
+        std::vector<std::string> tiles;
+        for (auto [y, height] : {std::pair<size_t, size_t>{0, 16}, {16, 37}}) {
+            for (auto [x, width] : {std::pair<size_t, size_t>{0, 32}, {32, 32}, {64, 11}}) {
+                transcoder.Crop(jpeg, x, y, width, height, &tiles.emplace_back());
+            }
+        }
+        const std::vector<std::string_view> views(tiles.begin(), tiles.end());
+        std::string output;
+        transcoder.Stitch(views, 3, &output);
+        decoder.DecodeCoefficients(output, &stitched);
+        CHECK(stitched.width == 75);
+        CHECK(stitched.height == 53);
+        CHECK(stitched.coefficients == original.coefficients);
+    }
+}
+
+TEST_CASE("Stitch rejects tiles that do not fit together", "[transcoder]") {
+    const auto tile = Generate(16, 16, Subsampling::k420);
+    JpegTranscoder transcoder;
+    std::string output;
+    using Views = std::vector<std::string_view>;
+
+    transcoder.Stitch(Views{tile, tile, tile, tile}, 2, &output);
+    JpegCoefficients coefficients;
+    JpegDecoder().DecodeCoefficients(output, &coefficients);
+    CHECK(coefficients.width == 32);
+    CHECK(coefficients.height == 32);
+
+    const auto narrow = Generate(12, 16, Subsampling::k420);
+    const auto short_tile = Generate(16, 8, Subsampling::k420);
+    const auto other_sampling = Generate(16, 16, Subsampling::k444);
+    JpegSpec spec;
+    spec.width = spec.height = 16;
+    spec.subsampling = Subsampling::k420;
+    spec.quality = 30;
+    const auto other_quality = GenerateJpeg(spec);
+    CHECK_THROWS_AS(transcoder.Stitch(Views{tile, other_sampling}, 2, &output),
+                    std::invalid_argument);
+    CHECK_THROWS_AS(transcoder.Stitch(Views{tile, other_quality}, 2, &output),
+                    std::invalid_argument);
+    // Ragged edges are only allowed on the right and at the bottom.
+    transcoder.Stitch(Views{tile, narrow}, 2, &output);
+    CHECK_THROWS_AS(transcoder.Stitch(Views{narrow, tile}, 2, &output), std::invalid_argument);
+    CHECK_THROWS_AS(transcoder.Stitch(Views{tile, short_tile}, 2, &output),
+                    std::invalid_argument);
+    CHECK_THROWS_AS(transcoder.Stitch(Views{tile, tile, tile}, 2, &output),
+                    std::invalid_argument);
+    CHECK_THROWS_AS(transcoder.Stitch(Views{}, 1, &output), std::invalid_argument);
+}
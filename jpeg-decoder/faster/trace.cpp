@@ -0,0 +1,174 @@
+#include "include/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+// Fields are relaxed atomics: Dump may read a slot while its thread
+// overwrites it, and then discards what it read.
+struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> begin{0}, end{0};
+};
+
+// A ring written only by its own thread. |written| counts every event ever
+// recorded and is published with release, so Dump can copy the newest
+// kThreadCapacity of them while the thread keeps recording; |started| counts
+// the events whose slot the thread has begun to overwrite. Owned by
+// |registry|: the buffer of a thread that has exited is kept until a Dump or
+// Clear has drained it.
+struct ThreadBuffer {
+    explicit ThreadBuffer(uint32_t tid) : tid(tid), events(kThreadCapacity) {
+    }
+
+    uint32_t tid;
+    std::vector<Event> events;
+    std::atomic<uint64_t> started{0}, written{0};
+    // Guarded by |registry_mutex|.
+    uint64_t drained = 0;
+    bool exited = false;
+};
+
+struct EventCopy {
+    const char* name;
+    int64_t begin, end;
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+uint32_t next_tid = 1;
+size_t dropped_events = 0;  // Guarded by |registry_mutex|.
+
+// Marks the buffer of its thread as exited when the thread ends.
+class LocalBuffer {
+public:
+    ThreadBuffer* Get() {
+        if (buffer_ == nullptr) {
+            std::lock_guard lock(registry_mutex);
+            registry.push_back(std::make_unique<ThreadBuffer>(next_tid++));
+            buffer_ = registry.back().get();
+        }
+        return buffer_;
+    }
+
+    ~LocalBuffer() {
+        if (buffer_ != nullptr) {
+            std::lock_guard lock(registry_mutex);
+            buffer_->exited = true;
+        }
+    }
+
+private:
+    ThreadBuffer* buffer_ = nullptr;
+};
+
+thread_local LocalBuffer local_buffer;
+
+// Copies the events of |buffer| recorded since its last drain into |events|,
+// without those its thread overwrote meanwhile. Under |registry_mutex|.
+void Drain(ThreadBuffer& buffer, std::vector<EventCopy>* events) {
+    const uint64_t written = buffer.written.load(std::memory_order_acquire);
+    const uint64_t oldest = written - std::min<uint64_t>(written, kThreadCapacity);
+    const uint64_t first = std::max(buffer.drained, oldest);
+    events->clear();
+    for (uint64_t i = first; i < written; ++i) {
+        const auto& event = buffer.events[i % kThreadCapacity];
+        events->push_back({event.name.load(std::memory_order_relaxed),
+                           event.begin.load(std::memory_order_relaxed),
+                           event.end.load(std::memory_order_relaxed)});
+    }
+    // Slots the thread began to overwrite while they were copied may be torn.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t started = buffer.started.load(std::memory_order_relaxed);
+    const uint64_t valid = started - std::min<uint64_t>(started, kThreadCapacity);
+    const size_t torn = valid > first ? std::min<uint64_t>(valid - first, events->size()) : 0;
+    events->erase(events->begin(), events->begin() + torn);
+    dropped_events += first - buffer.drained + torn;
+    buffer.drained = written;
+}
+
+// Drains every buffer, passing the events of each to |fn|, and frees the
+// buffers of threads that have exited.
+template <class F>
+void DrainAll(F fn) {
+    std::lock_guard lock(registry_mutex);
+    std::vector<EventCopy> events;
+    for (const auto& buffer : registry) {
+        Drain(*buffer, &events);
+        fn(*buffer, events);
+    }
+    std::erase_if(registry, [](const auto& buffer) { return buffer->exited; });
+}
+
+const auto kEpoch = std::chrono::steady_clock::now();
+
+void WriteMicroseconds(std::ostream& out, int64_t ns) {
+    out << ns / 1000 << '.' << ns / 100 % 10 << ns / 10 % 10 << ns % 10;
+}
+
+}  // namespace
+
+namespace detail {
+
+constinit thread_local bool enabled = false;
+
+int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                kEpoch)
+        .count();
+}
+
+void Record(const char* name, int64_t begin, int64_t end) {
+    auto* buffer = local_buffer.Get();
+    const uint64_t written = buffer->written.load(std::memory_order_relaxed);
+    buffer->started.store(written + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& event = buffer->events[written % kThreadCapacity];
+    event.name.store(name, std::memory_order_relaxed);
+    event.begin.store(begin, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    buffer->written.store(written + 1, std::memory_order_release);
+}
+
+}  // namespace detail
+
+void Enable(bool enabled) {
+    detail::enabled = enabled;
+}
+
+void Dump(std::ostream& out) {
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    DrainAll([&](const ThreadBuffer& buffer, const std::vector<EventCopy>& events) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << buffer.tid << ",\"args\":{\"name\":\"thread " << buffer.tid << "\"}}";
+        first = false;
+        for (const auto& event : events) {
+            out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << buffer.tid << ",\"ts\":";
+            WriteMicroseconds(out, event.begin);
+            out << ",\"dur\":";
+            WriteMicroseconds(out, event.end - event.begin);
+            out << '}';
+        }
+    });
+    out << "\n]}\n";
+}
+
+void Clear() {
+    DrainAll([](const ThreadBuffer&, const std::vector<EventCopy>&) {});
+}
+
+size_t DroppedEvents() {
+    std::lock_guard lock(registry_mutex);
+    return dropped_events;
+}
+
+}  // namespace trace
@@ -0,0 +1,299 @@
+#include <jpeg_encoder.h>
+#include <jpeg_transcoder.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t kBlockSide = 8;
+
+// Components of |input| with the MCU grid of a |width| x |height| image, h and v
+// swapped when |transpose|. The blocks are left for the caller to fill.
+void SetLayout(const JpegCoefficients& input, size_t width, size_t height, bool transpose,
+               JpegCoefficients* output) {
+    output->width = static_cast<uint16_t>(width);
+    output->height = static_cast<uint16_t>(height);
+    output->h_max = transpose ? input.v_max : input.h_max;
+    output->v_max = transpose ? input.h_max : input.v_max;
+    const size_t mcu_w = kBlockSide * output->h_max, mcu_h = kBlockSide * output->v_max;
+    const size_t mcus_w = (width + mcu_w - 1) / mcu_w, mcus_h = (height + mcu_h - 1) / mcu_h;
+
+    output->components.resize(input.components.size());
+    size_t offset = 0;
+    for (size_t c = 0; c < input.components.size(); ++c) {
+        const auto& from = input.components[c];
+        auto& to = output->components[c];
+        to.id = from.id;
+        to.h = transpose ? from.v : from.h;
+        to.v = transpose ? from.h : from.v;
+        to.quant_table = from.quant_table;
+        if (transpose) {
+            for (size_t v = 0; v < kBlockSide; ++v) {
+                for (size_t u = 0; u < kBlockSide; ++u) {
+                    to.quant_table[v * kBlockSide + u] = from.quant_table[u * kBlockSide + v];
+                }
+            }
+        }
+        to.blocks_w = mcus_w * to.h;
+        to.blocks_h = mcus_h * to.v;
+        to.offset = offset;
+        offset += to.blocks_w * to.blocks_h * JpegCoefficients::kBlockSz;
+    }
+    output->coefficients.resize(offset);
+}
+
+}  // namespace
+
+void TransformCoefficients(const JpegCoefficients& input, JpegTransform transform,
+                           JpegCoefficients* output) {
+    if (&input == output) {
+        throw std::invalid_argument("Transform in place");
+    }
+    // Every transform is an optional transpose followed by optional flips.
+    bool transpose = false, flip_h = false, flip_v = false;
+    switch (transform) {
+        case JpegTransform::kFlipHorizontal:
+            flip_h = true;
+            break;
+        case JpegTransform::kFlipVertical:
+            flip_v = true;
+            break;
+        case JpegTransform::kTranspose:
+            transpose = true;
+            break;
+        case JpegTransform::kTransverse:
+            transpose = flip_h = flip_v = true;
+            break;
+        case JpegTransform::kRotate90:
+            transpose = flip_h = true;
+            break;
+        case JpegTransform::kRotate180:
+            flip_h = flip_v = true;
+            break;
+        case JpegTransform::kRotate270:
+            transpose = flip_v = true;
+            break;
+    }
+
+    size_t width = transpose ? input.height : input.width;
+    size_t height = transpose ? input.width : input.height;
+    const size_t mcu_w = kBlockSide * (transpose ? input.v_max : input.h_max);
+    const size_t mcu_h = kBlockSide * (transpose ? input.h_max : input.v_max);
+    if (flip_h) {
+        width -= width % mcu_w;
+    }
+    if (flip_v) {
+        height -= height % mcu_h;
+    }
+    if (width == 0 || height == 0) {
+        throw std::invalid_argument("Image is smaller than an MCU");
+    }
+    SetLayout(input, width, height, transpose, output);
+
+    for (size_t c = 0; c < output->components.size(); ++c) {
+        const size_t blocks_w = output->components[c].blocks_w;
+        const size_t blocks_h = output->components[c].blocks_h;
+        for (size_t row = 0; row < blocks_h; ++row) {
+            for (size_t column = 0; column < blocks_w; ++column) {
+                const size_t from_column = flip_h ? blocks_w - 1 - column : column;
+                const size_t from_row = flip_v ? blocks_h - 1 - row : row;
+                const int16_t* from = transpose ? input.Block(c, from_column, from_row)
+                                                : input.Block(c, from_row, from_column);
+                int16_t* to = output->Block(c, row, column);
+                // A flip negates the coefficients of odd frequency along its axis.
+                for (size_t v = 0; v < kBlockSide; ++v) {
+                    for (size_t u = 0; u < kBlockSide; ++u) {
+                        const int16_t value = transpose ? from[u * kBlockSide + v]
+                                                        : from[v * kBlockSide + u];
+                        const bool negate = (flip_h && u % 2 == 1) != (flip_v && v % 2 == 1);
+                        to[v * kBlockSide + u] = negate ? -value : value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CropCoefficients(const JpegCoefficients& input, size_t x, size_t y, size_t width,
+                      size_t height, JpegCoefficients* output) {
+    if (&input == output) {
+        throw std::invalid_argument("Crop in place");
+    }
+    const size_t mcu_w = kBlockSide * input.h_max, mcu_h = kBlockSide * input.v_max;
+    if (x % mcu_w != 0 || y % mcu_h != 0) {
+        throw std::invalid_argument("Crop offset is not on an MCU boundary");
+    }
+    if (width == 0 || height == 0 || x + width > input.width || y + height > input.height) {
+        throw std::invalid_argument("Crop region is outside of the image");
+    }
+    SetLayout(input, width, height, false, output);
+
+    for (size_t c = 0; c < output->components.size(); ++c) {
+        const auto& component = output->components[c];
+        const size_t first_row = y / mcu_h * component.v;
+        const size_t first_column = x / mcu_w * component.h;
+        for (size_t row = 0; row < component.blocks_h; ++row) {
+            const int16_t* from = input.Block(c, first_row + row, first_column);
+            std::copy(from, from + component.blocks_w * JpegCoefficients::kBlockSz,
+                      output->Block(c, row, 0));
+        }
+    }
+}
+
+void StitchCoefficients(std::span<const JpegCoefficients> tiles, size_t columns,
+                        JpegCoefficients* output) {
+    if (tiles.empty() || columns == 0 || tiles.size() % columns != 0) {
+        throw std::invalid_argument("Tiles do not fill a grid");
+    }
+    const size_t rows = tiles.size() / columns;
+    const auto& first = tiles.front();
+    for (const auto& tile : tiles) {
+        if (&tile == output) {
+            throw std::invalid_argument("Stitch in place");
+        }
+        bool same = tile.components.size() == first.components.size() &&
+                    tile.h_max == first.h_max && tile.v_max == first.v_max;
+        for (size_t c = 0; same && c < first.components.size(); ++c) {
+            const auto &a = tile.components[c], &b = first.components[c];
+            same = a.h == b.h && a.v == b.v && a.quant_table == b.quant_table;
+        }
+        if (!same) {
+            throw std::invalid_argument("Tiles differ in sampling or quantization tables");
+        }
+    }
+
+    const size_t mcu_w = kBlockSide * first.h_max, mcu_h = kBlockSide * first.v_max;
+    size_t width = 0, height = 0;
+    for (size_t column = 0; column < columns; ++column) {
+        const size_t tile_width = tiles[column].width;
+        for (size_t row = 0; row < rows; ++row) {
+            if (tiles[row * columns + column].width != tile_width) {
+                throw std::invalid_argument("Tiles of a column differ in width");
+            }
+        }
+        if (column + 1 < columns && tile_width % mcu_w != 0) {
+            throw std::invalid_argument("Tile width is not a multiple of the MCU width");
+        }
+        width += tile_width;
+    }
+    for (size_t row = 0; row < rows; ++row) {
+        const size_t tile_height = tiles[row * columns].height;
+        for (size_t column = 0; column < columns; ++column) {
+            if (tiles[row * columns + column].height != tile_height) {
+                throw std::invalid_argument("Tiles of a row differ in height");
+            }
+        }
+        if (row + 1 < rows && tile_height % mcu_h != 0) {
+            throw std::invalid_argument("Tile height is not a multiple of the MCU height");
+        }
+        height += tile_height;
+    }
+    if (width > UINT16_MAX || height > UINT16_MAX) {
+        throw std::invalid_argument("Stitched image is too large");
+    }
+    SetLayout(first, width, height, false, output);
+
+    // Full tiles have no padding blocks; those of the last row and column pad
+    // up to the edge of the output grid, so every tile copies all of its blocks.
+    size_t mcu_y = 0;
+    for (size_t row = 0; row < rows; ++row) {
+        size_t mcu_x = 0;
+        for (size_t column = 0; column < columns; ++column) {
+            const auto& tile = tiles[row * columns + column];
+            for (size_t c = 0; c < output->components.size(); ++c) {
+                const auto& component = tile.components[c];
+                const auto& to = output->components[c];
+                for (size_t block_row = 0; block_row < component.blocks_h; ++block_row) {
+                    const int16_t* from = tile.Block(c, block_row, 0);
+                    std::copy(from, from + component.blocks_w * JpegCoefficients::kBlockSz,
+                              output->Block(c, mcu_y * to.v + block_row, mcu_x * to.h));
+                }
+            }
+            mcu_x += tile.width / mcu_w;
+        }
+        mcu_y += tiles[row * columns].height / mcu_h;
+    }
+}
+
+void RequantizeCoefficients(
+    const JpegCoefficients& input,
+    std::span<const std::array<uint16_t, JpegCoefficients::kBlockSz>> quant_tables,
+    JpegCoefficients* output) {
+    if (quant_tables.size() != input.components.size()) {
+        throw std::invalid_argument("Need one quantization table per component");
+    }
+    for (const auto& table : quant_tables) {
+        if (std::find(table.begin(), table.end(), 0) != table.end()) {
+            throw std::invalid_argument("Zero quantization step");
+        }
+    }
+    if (&input != output) {
+        *output = input;
+    }
+    for (size_t c = 0; c < output->components.size(); ++c) {
+        auto& component = output->components[c];
+        std::array<uint16_t, JpegCoefficients::kBlockSz> steps;
+        for (size_t i = 0; i < steps.size(); ++i) {
+            steps[i] = std::max(component.quant_table[i], quant_tables[c][i]);
+        }
+        int16_t* block = output->coefficients.data() + component.offset;
+        const size_t blocks = component.blocks_w * component.blocks_h;
+        for (size_t b = 0; b < blocks; ++b, block += JpegCoefficients::kBlockSz) {
+            for (size_t i = 0; i < JpegCoefficients::kBlockSz; ++i) {
+                if (block[i] == 0 || steps[i] == component.quant_table[i]) {
+                    continue;
+                }
+                const int value = block[i] * component.quant_table[i];
+                const int rounded = (std::abs(value) + steps[i] / 2) / steps[i];
+                block[i] = static_cast<int16_t>(value < 0 ? -rounded : rounded);
+            }
+        }
+        component.quant_table = steps;
+    }
+}
+
+void JpegTranscoder::Transform(std::string_view input, JpegTransform transform,
+                               std::string* output) {
+    decoder_.DecodeCoefficients(input, &input_);
+    TransformCoefficients(input_, transform, &output_);
+    EncodeCoefficients(output_, output, {.optimize_huffman = optimize_huffman_});
+}
+
+void JpegTranscoder::Crop(std::string_view input, size_t x, size_t y, size_t width,
+                          size_t height, std::string* output) {
+    decoder_.DecodeCoefficients(input, &input_);
+    CropCoefficients(input_, x, y, width, height, &output_);
+    EncodeCoefficients(output_, output, {.optimize_huffman = optimize_huffman_});
+}
+
+void JpegTranscoder::Stitch(std::span<const std::string_view> tiles, size_t columns,
+                            std::string* output) {
+    tiles_.resize(tiles.size());
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        decoder_.DecodeCoefficients(tiles[i], &tiles_[i]);
+    }
+    StitchCoefficients(tiles_, columns, &output_);
+    EncodeCoefficients(output_, output, {.optimize_huffman = optimize_huffman_});
+}
+
+void JpegTranscoder::Optimize(std::string_view input, std::string* output) {
+    decoder_.DecodeCoefficients(input, &input_, &segments_);
+    EncodeCoefficients(input_, output, {.optimize_huffman = true, .segments = segments_});
+}
+
+void JpegTranscoder::Requantize(std::string_view input, int quality, std::string* output) {
+    decoder_.DecodeCoefficients(input, &input_, &segments_);
+    quant_tables_.resize(input_.components.size());
+    for (size_t c = 0; c < quant_tables_.size(); ++c) {
+        quant_tables_[c] = QualityQuantTable(quality, c != 0);
+    }
+    RequantizeCoefficients(input_, quant_tables_, &input_);
+    EncodeCoefficients(input_, output,
+                       {.optimize_huffman = optimize_huffman_, .segments = segments_});
+}
+
+void JpegTranscoder::SetOptimizeHuffman(bool optimize) {
+    optimize_huffman_ = optimize;
+}
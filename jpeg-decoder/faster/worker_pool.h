@@ -0,0 +1,123 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Threads started once and woken for every parallel stage, so a stage costs a
+// wake-up instead of creating and joining threads. Run makes no allocations.
+class WorkerPool {
+public:
+    // |workers| threads besides the calling one.
+    explicit WorkerPool(size_t workers) : errors_(workers + 1) {
+        threads_.reserve(workers);
+        for (size_t i = 0; i < workers; ++i) {
+            threads_.emplace_back([this, i] { Work(i + 1); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // Tasks Run can take at once, the calling thread included.
+    size_t Size() const {
+        return threads_.size() + 1;
+    }
+
+    // Calls |fn(i)| for i < |tasks| <= Size(), task 0 on the calling thread and
+    // task i on worker i, and returns when all are done. The first exception a
+    // task threw is rethrown.
+    template <class F>
+    void Run(size_t tasks, F&& fn) {
+        if (tasks <= 1) {
+            if (tasks == 1) {
+                fn(0);
+            }
+            return;
+        }
+        {
+            std::lock_guard lock(mutex_);
+            task_ = [](void* fn, size_t i) { (*static_cast<std::remove_reference_t<F>*>(fn))(i); };
+            fn_ = const_cast<void*>(static_cast<const void*>(&fn));
+            tasks_ = tasks;
+            pending_ = tasks - 1;
+            ++generation_;
+        }
+        wake_.notify_all();
+        RunTask(0);
+        {
+            std::unique_lock lock(mutex_);
+            done_.wait(lock, [this] { return pending_ == 0; });
+        }
+        std::exception_ptr first;
+        for (size_t i = 0; i < tasks; ++i) {
+            if (errors_[i] && !first) {
+                first = errors_[i];
+            }
+            errors_[i] = nullptr;
+        }
+        if (first) {
+            std::rethrow_exception(first);
+        }
+    }
+
+private:
+    void RunTask(size_t i) {
+        try {
+            task_(fn_, i);
+        } catch (...) {
+            errors_[i] = std::current_exception();
+        }
+    }
+
+    void Work(size_t index) {
+        uint64_t seen = 0;
+        std::unique_lock lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+            // Run waits for the tasks it gave out, a worker without one may
+            // miss a generation altogether.
+            if (index >= tasks_) {
+                continue;
+            }
+            lock.unlock();
+            RunTask(index);
+            lock.lock();
+            if (--pending_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    // Guarded by |mutex_|.
+    uint64_t generation_ = 0;
+    size_t tasks_ = 0, pending_ = 0;
+    bool stop_ = false;
+    // Set by Run before waking the workers, stable until it returns.
+    void (*task_)(void*, size_t) = nullptr;
+    void* fn_ = nullptr;
+    std::vector<std::exception_ptr> errors_;
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,175 @@
+#include "jpeg_generator.hpp"
+
+#include <jpeglib.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+uint64_t Mix(uint64_t x) {
+    // splitmix64 finalizer.
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint8_t Sample(const JpegSpec& spec, size_t x, size_t y, size_t channel) {
+    const uint64_t seed = Mix(spec.seed * 4 + channel);
+    switch (spec.content) {
+        case Content::kNoise:
+            return Mix(seed ^ (static_cast<uint64_t>(y) << 32 | x)) & 0xff;
+        case Content::kGradient: {
+            // Ramps of different directions per channel, so chroma is not flat.
+            const size_t period = 64 + (seed & 0xff);
+            const size_t t = channel == 1 ? x + 2 * y : channel == 2 ? 2 * x + y : x + y;
+            const size_t phase = (t + (seed >> 8)) % (2 * period);
+            return (phase < period ? phase : 2 * period - phase) * 255 / period;
+        }
+        case Content::kFlat:
+            return seed & 0xff;
+    }
+    return 0;
+}
+
+}  // namespace
+
+const char* ToString(Subsampling subsampling) {
+    switch (subsampling) {
+        case Subsampling::k444:
+            return "444";
+        case Subsampling::k422:
+            return "422";
+        case Subsampling::k420:
+            return "420";
+        case Subsampling::kGray:
+            return "gray";
+    }
+    return "";
+}
+
+const char* ToString(Content content) {
+    switch (content) {
+        case Content::kNoise:
+            return "noise";
+        case Content::kGradient:
+            return "gradient";
+        case Content::kFlat:
+            return "flat";
+    }
+    return "";
+}
+
+std::string JpegSpec::Name() const {
+    return std::to_string(width) + "x" + std::to_string(height) + "_" + ToString(subsampling) +
+           "_q" + std::to_string(quality) + "_r" + std::to_string(restart_interval) + "_" +
+           ToString(content) + "_s" + std::to_string(seed) +
+           (scan_per_component ? "_multiscan" : "");
+}
+
+std::string GenerateJpeg(const JpegSpec& spec) {
+    if (spec.width == 0 || spec.height == 0 || spec.width > JPEG_MAX_DIMENSION ||
+        spec.height > JPEG_MAX_DIMENSION) {
+        throw std::invalid_argument("Bad image size");
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr err;
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;  // NOLINT
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    const bool gray = spec.subsampling == Subsampling::kGray;
+    cinfo.image_width = spec.width;
+    cinfo.image_height = spec.height;
+    cinfo.input_components = gray ? 1 : 3;
+    cinfo.in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, spec.quality, static_cast<boolean>(true));
+    cinfo.restart_interval = spec.restart_interval;
+    if (!gray) {
+        cinfo.comp_info[0].h_samp_factor = spec.subsampling == Subsampling::k444 ? 1 : 2;
+        cinfo.comp_info[0].v_samp_factor = spec.subsampling == Subsampling::k420 ? 2 : 1;
+        for (int c = 1; c < 3; ++c) {
+            cinfo.comp_info[c].h_samp_factor = cinfo.comp_info[c].v_samp_factor = 1;
+        }
+    }
+
+    std::vector<jpeg_scan_info> scans;
+    if (spec.scan_per_component) {
+        for (int c = 0; c < cinfo.num_components; ++c) {
+            jpeg_scan_info scan{};
+            scan.comps_in_scan = 1;
+            scan.component_index[0] = c;
+            scan.Se = 63;
+            scans.push_back(scan);
+        }
+        cinfo.scan_info = scans.data();
+        cinfo.num_scans = static_cast<int>(scans.size());
+    }
+
+    jpeg_start_compress(&cinfo, static_cast<boolean>(true));
+    std::vector<JSAMPLE> row(spec.width * cinfo.input_components);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const size_t y = cinfo.next_scanline;
+        for (size_t x = 0; x < spec.width; ++x) {
+            for (int c = 0; c < cinfo.input_components; ++c) {
+                row[x * cinfo.input_components + c] = Sample(spec, x, y, c);
+            }
+        }
+        JSAMPROW rows[] = {row.data()};
+        (void)jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::string result(reinterpret_cast<const char*>(buffer), size);  // NOLINT
+    free(buffer);  // NOLINT
+    return result;
+}
+
+std::vector<JpegCorpusAxis> ScalingCorpus(size_t max_size) {
+    std::vector<JpegCorpusAxis> axes;
+    auto add = [&](const std::string& axis, const JpegSpec& spec) {
+        if (spec.width > max_size || spec.height > max_size) {
+            return;
+        }
+        if (axes.empty() || axes.back().name != axis) {
+            axes.push_back({axis, {}});
+        }
+        axes.back().specs.push_back(spec);
+    };
+
+    for (size_t size = 16; size <= 16384; size *= 4) {
+        JpegSpec spec;
+        spec.width = spec.height = size;
+        add("size", spec);
+    }
+    for (auto subsampling :
+         {Subsampling::k444, Subsampling::k422, Subsampling::k420, Subsampling::kGray}) {
+        JpegSpec spec;
+        spec.subsampling = subsampling;
+        add("subsampling", spec);
+    }
+    for (int quality : {10, 50, 75, 90, 100}) {
+        JpegSpec spec;
+        spec.quality = quality;
+        add("quality", spec);
+    }
+    for (unsigned restart_interval : {0, 1, 8, 64}) {
+        JpegSpec spec;
+        spec.restart_interval = restart_interval;
+        add("restart", spec);
+    }
+    for (auto content : {Content::kNoise, Content::kGradient, Content::kFlat}) {
+        JpegSpec spec;
+        spec.content = content;
+        add("content", spec);
+    }
+    return axes;
+}
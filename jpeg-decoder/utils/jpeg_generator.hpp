@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Deterministic synthetic JPEGs encoded with libjpeg, for scaling benchmarks
+// and for tests of encoder features the images in tests/ do not cover.
+
+enum class Subsampling { k444, k422, k420, kGray };
+
+enum class Content {
+    // Independent uniform samples: dense blocks, long Huffman codes.
+    kNoise,
+    // Smooth diagonal ramps: a few low-frequency coefficients per block.
+    kGradient,
+    // One color: DC-only blocks.
+    kFlat,
+};
+
+struct JpegSpec {
+    size_t width = 1024, height = 1024;
+    Subsampling subsampling = Subsampling::k420;
+    int quality = 75;
+    // In MCUs, 0 is no DRI marker.
+    unsigned restart_interval = 0;
+    Content content = Content::kGradient;
+    uint32_t seed = 0;
+    // One non-interleaved scan per component instead of a single interleaved one.
+    bool scan_per_component = false;
+
+    // Unique for every spec, usable as a file or benchmark name,
+    // e.g. "1024x1024_420_q75_r0_gradient_s0", "_multiscan" appended for
+    // |scan_per_component|.
+    std::string Name() const;
+};
+
+const char* ToString(Subsampling subsampling);
+
+const char* ToString(Content content);
+
+// Same spec, same bytes: pixels come from a hash of (x, y, channel, seed).
+// Rows are generated on the fly, so 16k x 16k images need no raw buffer.
+std::string GenerateJpeg(const JpegSpec& spec);
+
+// One named sweep over a single dimension of JpegSpec, the rest is default.
+struct JpegCorpusAxis {
+    std::string name;
+    std::vector<JpegSpec> specs;
+};
+
+// Sweeps over size (16 to 16384 px, square), subsampling, quality, restart
+// interval and content. Specs larger than |max_size| on either side are left out.
+std::vector<JpegCorpusAxis> ScalingCorpus(size_t max_size = 16384);
@@ -5,19 +5,9 @@
 #include <cstdio>
 #include <stdexcept>
 
-Image ReadJpg(const std::string& filename) {
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr err;
-    FILE* infile = fopen(filename.c_str(), "rb");
-
-    if (!infile) {
-        throw std::runtime_error("can't open " + filename);
-    }
-
-    cinfo.err = jpeg_std_error(&err);
-    jpeg_create_decompress(&cinfo);
-    jpeg_stdio_src(&cinfo, infile);
+namespace {
 
+Image Decompress(jpeg_decompress_struct& cinfo) {
     (void)jpeg_read_header(&cinfo, static_cast<boolean>(true));
     (void)jpeg_start_decompress(&cinfo);
 
@@ -45,7 +35,77 @@ Image ReadJpg(const std::string& filename) {
     }
 
     (void)jpeg_finish_decompress(&cinfo);
+    return result;
+}
+
+}  // namespace
+
+Image ReadJpg(const std::string& filename) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+    FILE* infile = fopen(filename.c_str(), "rb");
+
+    if (!infile) {
+        throw std::runtime_error("can't open " + filename);
+    }
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, infile);
+
+    auto result = Decompress(cinfo);
+
     jpeg_destroy_decompress(&cinfo);
     fclose(infile);
     return result;
 }
+
+Image ReadJpgFromMemory(const std::string& data) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, reinterpret_cast<const unsigned char*>(data.data()),  // NOLINT
+                 data.size());
+
+    auto result = Decompress(cinfo);
+
+    jpeg_destroy_decompress(&cinfo);
+    return result;
+}
+
+std::vector<LibjpegComponent> ReadJpgCoefficients(const std::string& data) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, reinterpret_cast<const unsigned char*>(data.data()),  // NOLINT
+                 data.size());
+    (void)jpeg_read_header(&cinfo, static_cast<boolean>(true));
+    jvirt_barray_ptr* arrays = jpeg_read_coefficients(&cinfo);
+
+    std::vector<LibjpegComponent> result(cinfo.num_components);
+    for (int c = 0; c < cinfo.num_components; ++c) {
+        const auto& info = cinfo.comp_info[c];  // NOLINT
+        auto& component = result[c];
+        component.blocks_w = info.width_in_blocks;
+        component.blocks_h = info.height_in_blocks;
+        for (size_t i = 0; i < component.quant_table.size(); ++i) {
+            component.quant_table[i] = info.quant_table->quantval[i];
+        }
+        for (JDIMENSION row = 0; row < info.height_in_blocks; ++row) {
+            JBLOCKARRAY blocks = (*cinfo.mem->access_virt_barray)(  // NOLINT
+                (j_common_ptr)&cinfo, arrays[c], row, 1, static_cast<boolean>(false));
+            for (JDIMENSION column = 0; column < info.width_in_blocks; ++column) {
+                component.blocks.insert(component.blocks.end(), blocks[0][column],
+                                        blocks[0][column] + DCTSIZE2);
+            }
+        }
+    }
+
+    (void)jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return result;
+}
@@ -1,7 +1,23 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "image.h"
 
 Image ReadJpg(const std::string& filename);
+
+// Same as ReadJpg, but decodes an in-memory file instead of reading it from disk.
+Image ReadJpgFromMemory(const std::string& data);
+
+// Quantized DCT coefficients as libjpeg reads them, without MCU padding: per
+// component |blocks_w| x |blocks_h| blocks in raster order, 64 row-major values each.
+struct LibjpegComponent {
+    size_t blocks_w = 0, blocks_h = 0;
+    std::array<uint16_t, 64> quant_table{};
+    std::vector<int16_t> blocks;
+};
+
+std::vector<LibjpegComponent> ReadJpgCoefficients(const std::string& data);
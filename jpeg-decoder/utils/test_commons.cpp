@@ -12,6 +12,7 @@
 #include <iostream>
 #include <fstream>
 #include <optional>
+#include <sstream>
 
 int artifact_index = 0;
 #ifdef HSE_ARTIFACTS_DIR
@@ -78,6 +79,12 @@ void CheckImage(const std::string& filename, const std::string& expected_comment
     Compare(image, ok_image);
 }
 
+void CheckJpegData(const std::string& data) {
+    std::istringstream input(data);
+    auto image = Decode(input);
+    Compare(image, ReadJpgFromMemory(data));
+}
+
 void ExpectFail(const std::string& filename) {
     std::cerr << "Running negative test " << filename << "\n";
     std::ifstream fin(kBasePath + "tests/bad/" + filename);
@@ -86,3 +93,20 @@ void ExpectFail(const std::string& filename) {
     }
     CHECK_THROWS(Decode(fin));
 }
+
+std::string ReadTestFile(const std::string& filename) {
+    std::ifstream fin(kBasePath + "tests/" + filename, std::ios::binary);
+    if (!fin.is_open()) {
+        throw std::invalid_argument("Cannot open a file");
+    }
+    std::stringstream buffer;
+    buffer << fin.rdbuf();
+    return buffer.str();
+}
+
+std::string Segment(uint8_t marker, const std::string& payload) {
+    const size_t size = payload.size() + 2;
+    return std::string{'\xff', static_cast<char>(marker), static_cast<char>(size >> 8),
+                       static_cast<char>(size & 0xff)} +
+           payload;
+}
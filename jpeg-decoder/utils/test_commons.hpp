@@ -1,9 +1,19 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <optional>
 
 void CheckImage(const std::string& filename, const std::string& expected_comment = "",
                 std::optional<std::string> output_filename = std::nullopt);
 
+// Decodes an in-memory JPEG and compares it with libjpeg, like CheckImage.
+void CheckJpegData(const std::string& data);
+
 void ExpectFail(const std::string& filename);
+
+// Contents of tests/|filename|.
+std::string ReadTestFile(const std::string& filename);
+
+// Marker segment with its length field in front of |payload|.
+std::string Segment(uint8_t marker, const std::string& payload);